@@ -0,0 +1,320 @@
+#include "aggregate.h"
+
+#include <string.h>
+
+//Selects the vector instructions used by the kernels. AVX2 is detected when the kernels run, since it isn't available
+//on every x86 processor, while NEON is always available on 64-bit ARM.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AGGREGATE_AVX2
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define AGGREGATE_NEON
+#include <arm_neon.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Adds up values one at a time, using several sums so that the additions don't wait on each other.
+ */
+static double sum_numbers_scalar(const double *numbers, size_t count) {
+    double sums[4] = {0.0, 0.0, 0.0, 0.0};
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        sums[0] += numbers[i];
+        sums[1] += numbers[i + 1];
+        sums[2] += numbers[i + 2];
+        sums[3] += numbers[i + 3];
+    }
+    for (; i < count; i++) {
+        sums[0] += numbers[i];
+    }
+    return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+/*
+ * Counts matching kinds one at a time.
+ */
+static size_t count_kinds_scalar(const unsigned char *kinds, size_t count, unsigned char kind) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += kinds[i] == kind;
+    }
+    return total;
+}
+
+/*
+ * Finds the smallest matching value one at a time.
+ */
+static double min_numbers_scalar(const double *numbers, const unsigned char *kinds, size_t count, unsigned char kind,
+                                 double initial) {
+    double result = initial;
+    for (size_t i = 0; i < count; i++) {
+        if (kinds[i] == kind && numbers[i] < result) {
+            result = numbers[i];
+        }
+    }
+    return result;
+}
+
+/*
+ * Finds the largest matching value one at a time.
+ */
+static double max_numbers_scalar(const double *numbers, const unsigned char *kinds, size_t count, unsigned char kind,
+                                 double initial) {
+    double result = initial;
+    for (size_t i = 0; i < count; i++) {
+        if (kinds[i] == kind && numbers[i] > result) {
+            result = numbers[i];
+        }
+    }
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef AGGREGATE_AVX2
+
+/*
+ * Adds up values sixteen at a time, using four vector sums.
+ */
+__attribute__((target("avx2")))
+static double sum_numbers_avx2(const double *numbers, size_t count) {
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    __m256d sum2 = _mm256_setzero_pd();
+    __m256d sum3 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        sum0 = _mm256_add_pd(sum0, _mm256_loadu_pd(numbers + i));
+        sum1 = _mm256_add_pd(sum1, _mm256_loadu_pd(numbers + i + 4));
+        sum2 = _mm256_add_pd(sum2, _mm256_loadu_pd(numbers + i + 8));
+        sum3 = _mm256_add_pd(sum3, _mm256_loadu_pd(numbers + i + 12));
+    }
+    for (; i + 4 <= count; i += 4) {
+        sum0 = _mm256_add_pd(sum0, _mm256_loadu_pd(numbers + i));
+    }
+
+    //Adds the lanes of the vector sums together, then the values left over.
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(_mm256_add_pd(sum0, sum1), _mm256_add_pd(sum2, sum3)));
+    double total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; i++) {
+        total += numbers[i];
+    }
+    return total;
+}
+
+/*
+ * Counts matching kinds thirty two at a time, by comparing them all at once and counting the matching bits.
+ */
+__attribute__((target("avx2,popcnt")))
+static size_t count_kinds_avx2(const unsigned char *kinds, size_t count, unsigned char kind) {
+    __m256i target = _mm256_set1_epi8((char) kind);
+    size_t total = 0;
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (kinds + i)), target);
+        total += (size_t) __builtin_popcount((unsigned int) _mm256_movemask_epi8(equal));
+    }
+    for (; i < count; i++) {
+        total += kinds[i] == kind;
+    }
+    return total;
+}
+
+/*
+ * Widens four kinds into a mask with one 64 bit lane per value, which is set if the kind matches.
+ */
+__attribute__((target("avx2")))
+static inline __m256d kind_mask_avx2(const unsigned char *kinds, __m256i target) {
+    int packed;
+    memcpy(&packed, kinds, sizeof(packed));
+    __m256i lanes = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(packed));
+    return _mm256_castsi256_pd(_mm256_cmpeq_epi64(lanes, target));
+}
+
+/*
+ * Finds the smallest matching value four at a time. Values whose kind doesn't match are replaced by the current
+ * result, so they can't change it.
+ */
+__attribute__((target("avx2")))
+static double min_numbers_avx2(const double *numbers, const unsigned char *kinds, size_t count, unsigned char kind,
+                               double initial) {
+    __m256i target = _mm256_set1_epi64x(kind);
+    __m256d result = _mm256_set1_pd(initial);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d values = _mm256_blendv_pd(result, _mm256_loadu_pd(numbers + i), kind_mask_avx2(kinds + i, target));
+        result = _mm256_min_pd(result, values);
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, result);
+    double smallest = initial;
+    for (int lane = 0; lane < 4; lane++) {
+        if (lanes[lane] < smallest) {
+            smallest = lanes[lane];
+        }
+    }
+    return min_numbers_scalar(numbers + i, kinds + i, count - i, kind, smallest);
+}
+
+/*
+ * Finds the largest matching value four at a time, in the same way as min_numbers_avx2.
+ */
+__attribute__((target("avx2")))
+static double max_numbers_avx2(const double *numbers, const unsigned char *kinds, size_t count, unsigned char kind,
+                               double initial) {
+    __m256i target = _mm256_set1_epi64x(kind);
+    __m256d result = _mm256_set1_pd(initial);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d values = _mm256_blendv_pd(result, _mm256_loadu_pd(numbers + i), kind_mask_avx2(kinds + i, target));
+        result = _mm256_max_pd(result, values);
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, result);
+    double largest = initial;
+    for (int lane = 0; lane < 4; lane++) {
+        if (lanes[lane] > largest) {
+            largest = lanes[lane];
+        }
+    }
+    return max_numbers_scalar(numbers + i, kinds + i, count - i, kind, largest);
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef AGGREGATE_NEON
+
+/*
+ * Adds up values eight at a time, using four vector sums.
+ */
+static double sum_numbers_neon(const double *numbers, size_t count) {
+    float64x2_t sum0 = vdupq_n_f64(0.0);
+    float64x2_t sum1 = vdupq_n_f64(0.0);
+    float64x2_t sum2 = vdupq_n_f64(0.0);
+    float64x2_t sum3 = vdupq_n_f64(0.0);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        sum0 = vaddq_f64(sum0, vld1q_f64(numbers + i));
+        sum1 = vaddq_f64(sum1, vld1q_f64(numbers + i + 2));
+        sum2 = vaddq_f64(sum2, vld1q_f64(numbers + i + 4));
+        sum3 = vaddq_f64(sum3, vld1q_f64(numbers + i + 6));
+    }
+    double total = vaddvq_f64(vaddq_f64(vaddq_f64(sum0, sum1), vaddq_f64(sum2, sum3)));
+    for (; i < count; i++) {
+        total += numbers[i];
+    }
+    return total;
+}
+
+/*
+ * Counts matching kinds sixteen at a time, by comparing them all at once and adding up the matches.
+ */
+static size_t count_kinds_neon(const unsigned char *kinds, size_t count, unsigned char kind) {
+    uint8x16_t target = vdupq_n_u8(kind);
+    size_t total = 0;
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        //Each match is all ones, so shifting leaves a 1 for every match.
+        total += vaddvq_u8(vshrq_n_u8(vceqq_u8(vld1q_u8(kinds + i), target), 7));
+    }
+    for (; i < count; i++) {
+        total += kinds[i] == kind;
+    }
+    return total;
+}
+
+/*
+ * Builds a mask with one 64 bit lane per value, which is set if the kind matches.
+ */
+static inline uint64x2_t kind_mask_neon(const unsigned char *kinds, unsigned char kind) {
+    uint64_t lanes[2] = {kinds[0] == kind ? ~0ULL : 0ULL, kinds[1] == kind ? ~0ULL : 0ULL};
+    return vld1q_u64(lanes);
+}
+
+/*
+ * Finds the smallest matching value two at a time. Values whose kind doesn't match are replaced by the current result,
+ * so they can't change it.
+ */
+static double min_numbers_neon(const double *numbers, const unsigned char *kinds, size_t count, unsigned char kind,
+                               double initial) {
+    float64x2_t result = vdupq_n_f64(initial);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        float64x2_t values = vbslq_f64(kind_mask_neon(kinds + i, kind), vld1q_f64(numbers + i), result);
+        result = vminq_f64(result, values);
+    }
+    double smallest = vminvq_f64(result);
+    return min_numbers_scalar(numbers + i, kinds + i, count - i, kind, smallest < initial ? smallest : initial);
+}
+
+/*
+ * Finds the largest matching value two at a time, in the same way as min_numbers_neon.
+ */
+static double max_numbers_neon(const double *numbers, const unsigned char *kinds, size_t count, unsigned char kind,
+                               double initial) {
+    float64x2_t result = vdupq_n_f64(initial);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        float64x2_t values = vbslq_f64(kind_mask_neon(kinds + i, kind), vld1q_f64(numbers + i), result);
+        result = vmaxq_f64(result, values);
+    }
+    double largest = vmaxvq_f64(result);
+    return max_numbers_scalar(numbers + i, kinds + i, count - i, kind, largest > initial ? largest : initial);
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+double sum_numbers(const double *numbers, size_t count) {
+#if defined(AGGREGATE_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        return sum_numbers_avx2(numbers, count);
+    }
+#elif defined(AGGREGATE_NEON)
+    return sum_numbers_neon(numbers, count);
+#endif
+    return sum_numbers_scalar(numbers, count);
+}
+
+size_t count_kinds(const unsigned char *kinds, size_t count, unsigned char kind) {
+#if defined(AGGREGATE_AVX2)
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        return count_kinds_avx2(kinds, count, kind);
+    }
+#elif defined(AGGREGATE_NEON)
+    return count_kinds_neon(kinds, count, kind);
+#endif
+    return count_kinds_scalar(kinds, count, kind);
+}
+
+double min_numbers(const double *numbers, const unsigned char *kinds, size_t count, unsigned char kind,
+                   double initial) {
+#if defined(AGGREGATE_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        return min_numbers_avx2(numbers, kinds, count, kind, initial);
+    }
+#elif defined(AGGREGATE_NEON)
+    return min_numbers_neon(numbers, kinds, count, kind, initial);
+#endif
+    return min_numbers_scalar(numbers, kinds, count, kind, initial);
+}
+
+double max_numbers(const double *numbers, const unsigned char *kinds, size_t count, unsigned char kind,
+                   double initial) {
+#if defined(AGGREGATE_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        return max_numbers_avx2(numbers, kinds, count, kind, initial);
+    }
+#elif defined(AGGREGATE_NEON)
+    return max_numbers_neon(numbers, kinds, count, kind, initial);
+#endif
+    return max_numbers_scalar(numbers, kinds, count, kind, initial);
+}
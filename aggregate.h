@@ -0,0 +1,31 @@
+#ifndef ASSIGNMENT_AGGREGATE_H
+#define ASSIGNMENT_AGGREGATE_H
+
+#include <stddef.h>
+
+// Vectorized kernels used to aggregate a run of cells in one column of a tile.
+//
+// Each run is described by 'count' consecutive numeric values and the
+// matching one byte kind of each cell. Cells without a numeric value are
+// expected to hold 0 in 'numbers', so they don't affect a sum.
+//
+// The kernels use AVX2 when the processor supports it, NEON on ARM, and a
+// portable scalar loop otherwise.
+
+// Adds up 'count' values.
+double sum_numbers(const double *numbers, size_t count);
+
+// Counts how many of the 'count' kinds are equal to 'kind'.
+size_t count_kinds(const unsigned char *kinds, size_t count, unsigned char kind);
+
+// Finds the smallest value whose kind is equal to 'kind'. Returns 'initial'
+// if it is smaller than all of them, or if there are none.
+double min_numbers(const double *numbers, const unsigned char *kinds, size_t count, unsigned char kind,
+                   double initial);
+
+// Finds the largest value whose kind is equal to 'kind'. Returns 'initial' if
+// it is larger than all of them, or if there are none.
+double max_numbers(const double *numbers, const unsigned char *kinds, size_t count, unsigned char kind,
+                   double initial);
+
+#endif //ASSIGNMENT_AGGREGATE_H
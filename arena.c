@@ -0,0 +1,225 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//Size of each slab the blocks of the size classes are carved out of.
+#define SLAB_SIZE (64 * 1024)
+//Size of the header at the start of each slab and large block, which keeps the blocks aligned to 16 bytes.
+#define HEADER_SIZE 16
+
+/*
+ * Struct to represent a slab, the header at the start of a large allocation which blocks are carved out of.
+ * next: Next older slab.
+ */
+struct ArenaSlab {
+    ArenaSlab *next;
+};
+
+/*
+ * Struct to represent the header in front of a block larger than the largest size class, which is allocated on its
+ * own. The blocks are kept in a list so that they can all be freed when the arena is reset.
+ * previous: Previous block in the list, or NULL if it is the first.
+ * next: Next block in the list, or NULL if it is the last.
+ */
+struct ArenaBlock {
+    ArenaBlock *previous;
+    ArenaBlock *next;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Finds the smallest size class which fits a block.
+ * size: Size of the block.
+ * return: Index of the size class, or -1 if the block is larger than the largest size class.
+ */
+static int get_size_class(size_t size) {
+    if (size > ARENA_MAX_CLASS_SIZE) {
+        return -1;
+    }
+    int size_class = 0;
+    while ((size_t) 16 << size_class < size) {
+        size_class++;
+    }
+    return size_class;
+}
+
+/*
+ * Allocates a block larger than the largest size class, and adds it to the list of large blocks.
+ */
+static void *allocate_large_block(Arena *arena, size_t size) {
+    ArenaBlock *block = malloc(HEADER_SIZE + size);
+    //Checks if the memory allocation was successful.
+    if (block == NULL) {
+        return NULL;
+    }
+    block->previous = NULL;
+    block->next = arena->large_blocks;
+    if (arena->large_blocks != NULL) {
+        arena->large_blocks->previous = block;
+    }
+    arena->large_blocks = block;
+    return (unsigned char *) block + HEADER_SIZE;
+}
+
+/*
+ * Removes a block larger than the largest size class from the list of large blocks, and frees it.
+ */
+static void free_large_block(Arena *arena, void *memory) {
+    ArenaBlock *block = (ArenaBlock *) ((unsigned char *) memory - HEADER_SIZE);
+    if (block->previous != NULL) {
+        block->previous->next = block->next;
+    } else {
+        arena->large_blocks = block->next;
+    }
+    if (block->next != NULL) {
+        block->next->previous = block->previous;
+    }
+    free(block);
+}
+
+/*
+ * Finds the number of bytes a block takes up.
+ * size: Size the block was allocated with.
+ * return: Size of the size class of the block, or its size if it is larger than the largest size class.
+ */
+static size_t get_block_size(size_t size) {
+    int size_class = get_size_class(size);
+    return size_class < 0 ? size : (size_t) 16 << size_class;
+}
+
+/*
+ * Allocates a block of a size class, without counting it.
+ */
+static void *allocate_block(Arena *arena, int size_class) {
+    //Reuses the most recently freed block of the size class.
+    void *block = arena->free_lists[size_class];
+    if (block != NULL) {
+        arena->free_lists[size_class] = *(void **) block;
+        return block;
+    }
+    //Carves the block out of the newest slab, starting a new slab if there isn't enough room left in it.
+    size_t class_size = (size_t) 16 << size_class;
+    if (arena->next == NULL || (size_t) (arena->end - arena->next) < class_size) {
+        ArenaSlab *slab = malloc(SLAB_SIZE);
+        //Checks if the memory allocation was successful.
+        if (slab == NULL) {
+            return NULL;
+        }
+        slab->next = arena->slabs;
+        arena->slabs = slab;
+        arena->next = (unsigned char *) slab + HEADER_SIZE;
+        arena->end = (unsigned char *) slab + SLAB_SIZE;
+    }
+    block = arena->next;
+    arena->next += class_size;
+    return block;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void *arena_allocate(Arena *arena, size_t size) {
+    int size_class = get_size_class(size);
+    void *block = size_class < 0 ? allocate_large_block(arena, size) : allocate_block(arena, size_class);
+    //Counts the block, if it could be allocated.
+    if (block != NULL) {
+        arena->num_blocks++;
+        arena->num_bytes += get_block_size(size);
+        arena->num_allocations++;
+    }
+    return block;
+}
+
+void arena_free(Arena *arena, void *memory, size_t size) {
+    if (memory == NULL) {
+        return;
+    }
+    arena->num_blocks--;
+    arena->num_bytes -= get_block_size(size);
+    int size_class = get_size_class(size);
+    if (size_class < 0) {
+        free_large_block(arena, memory);
+        return;
+    }
+    //Adds the block to the free list of its size class.
+    *(void **) memory = arena->free_lists[size_class];
+    arena->free_lists[size_class] = memory;
+}
+
+void *arena_reallocate(Arena *arena, void *memory, size_t old_size, size_t new_size) {
+    if (memory == NULL) {
+        return arena_allocate(arena, new_size);
+    }
+    //Checks if the block already fits in its size class.
+    int old_class = get_size_class(old_size);
+    if (old_class >= 0 && old_class == get_size_class(new_size)) {
+        return memory;
+    }
+    void *block = arena_allocate(arena, new_size);
+    //Checks if the memory allocation was successful.
+    if (block == NULL) {
+        return NULL;
+    }
+    memcpy(block, memory, old_size < new_size ? old_size : new_size);
+    arena_free(arena, memory, old_size);
+    return block;
+}
+
+void arena_merge(Arena *arena, Arena *other) {
+    //Appends the free list of each size class of the other arena to the front of the free list of this one.
+    for (int i = 0; i < ARENA_NUM_CLASSES; i++) {
+        void *last = other->free_lists[i];
+        if (last == NULL) {
+            continue;
+        }
+        while (*(void **) last != NULL) {
+            last = *(void **) last;
+        }
+        *(void **) last = arena->free_lists[i];
+        arena->free_lists[i] = other->free_lists[i];
+    }
+    //Moves the slabs behind the newest slab of this arena, so that it keeps carving blocks from it.
+    if (other->slabs != NULL) {
+        ArenaSlab *last = other->slabs;
+        while (last->next != NULL) {
+            last = last->next;
+        }
+        if (arena->slabs == NULL) {
+            arena->slabs = other->slabs;
+        } else {
+            last->next = arena->slabs->next;
+            arena->slabs->next = other->slabs;
+        }
+    }
+    //Moves the large blocks to the front of the list of this arena.
+    if (other->large_blocks != NULL) {
+        ArenaBlock *last = other->large_blocks;
+        while (last->next != NULL) {
+            last = last->next;
+        }
+        last->next = arena->large_blocks;
+        if (arena->large_blocks != NULL) {
+            arena->large_blocks->previous = last;
+        }
+        arena->large_blocks = other->large_blocks;
+    }
+    arena->num_blocks += other->num_blocks;
+    arena->num_bytes += other->num_bytes;
+    arena->num_allocations += other->num_allocations;
+    memset(other, 0, sizeof(Arena));
+}
+
+void arena_reset(Arena *arena) {
+    while (arena->slabs != NULL) {
+        ArenaSlab *slab = arena->slabs;
+        arena->slabs = slab->next;
+        free(slab);
+    }
+    while (arena->large_blocks != NULL) {
+        ArenaBlock *block = arena->large_blocks;
+        arena->large_blocks = block->next;
+        free(block);
+    }
+    memset(arena, 0, sizeof(Arena));
+}
@@ -0,0 +1,76 @@
+#ifndef ASSIGNMENT_ARENA_H
+#define ASSIGNMENT_ARENA_H
+
+#include <stddef.h>
+
+// Slab allocator for the many small blocks the model allocates, such as
+// compiled formulas, dependents arrays and interned strings.
+//
+// Each block is rounded up to a power of two size class, from 16 bytes up to
+// ARENA_MAX_CLASS_SIZE bytes, and carved out of large slabs. Each size class
+// has a free list, so a freed block is reused by the next block of the same
+// class without going back to malloc. Larger blocks are allocated on their
+// own. Every block is aligned to 16 bytes.
+//
+// An arena which is all zeros is empty and ready to use. An arena must only
+// be used by one thread at a time.
+
+// Number of size classes, and the size of the largest one.
+#define ARENA_NUM_CLASSES 9
+#define ARENA_MAX_CLASS_SIZE (16 << (ARENA_NUM_CLASSES - 1))
+
+typedef struct ArenaSlab ArenaSlab;
+typedef struct ArenaBlock ArenaBlock;
+
+// An arena, which owns every block allocated from it until it is reset.
+//
+// free_lists: First freed block of each size class, each of which starts
+// with a pointer to the next one.
+// slabs: Slabs the blocks are carved out of, newest first.
+// next: Start of the unused part of the newest slab.
+// end: End of the newest slab.
+// large_blocks: Blocks larger than the largest size class.
+// num_blocks: Number of blocks which are allocated.
+// num_bytes: Number of bytes of the blocks which are allocated, with each
+// block rounded up to its size class.
+// num_allocations: Number of blocks allocated since the arena was last reset,
+// including those which have been freed since.
+typedef struct {
+    void *free_lists[ARENA_NUM_CLASSES];
+    ArenaSlab *slabs;
+    unsigned char *next;
+    unsigned char *end;
+    ArenaBlock *large_blocks;
+    size_t num_blocks;
+    size_t num_bytes;
+    size_t num_allocations;
+} Arena;
+
+// Allocates a block of 'size' bytes. Returns NULL if the memory couldn't be
+// allocated.
+void *arena_allocate(Arena *arena, size_t size);
+
+// Frees a block which was allocated with 'size' bytes. Does nothing if
+// 'memory' is NULL.
+void arena_free(Arena *arena, void *memory, size_t size);
+
+// Changes the size of a block from 'old_size' to 'new_size' bytes, moving it
+// if it needs a different size class. A NULL 'memory' allocates a new block.
+// Returns NULL, leaving the block unchanged, if the memory couldn't be
+// allocated.
+void *arena_reallocate(Arena *arena, void *memory, size_t old_size, size_t new_size);
+
+// Moves every block of 'other' into 'arena', leaving 'other' empty. The
+// blocks are owned and counted by 'arena' from then on, so they can be freed
+// with it. The unused end of the newest slab of 'other' is given up rather
+// than carved into new blocks.
+//
+// This lets several threads each allocate from an arena of their own, and
+// hand what they allocated to a single arena once they have finished.
+void arena_merge(Arena *arena, Arena *other);
+
+// Frees every block of the arena at once, by freeing its slabs and large
+// blocks, leaving it empty.
+void arena_reset(Arena *arena);
+
+#endif //ASSIGNMENT_ARENA_H
@@ -0,0 +1,504 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "defs.h"
+#include "interface.h"
+#include "model.h"
+
+// Micro-benchmarks for the hot paths of the model: parsing formulas,
+// evaluating deep chains and wide fan-in, recalculating after a single edit,
+// editing a column read by many overlapping ranges, loading cells in bulk,
+// undoing and redoing them, reading a view of the sheet while it is edited,
+// converting cells back to text for editing, and saving and loading
+// snapshots, loading a CSV file, and clearing the whole sheet.
+//
+// Usage: bench [--json] [N]
+//
+// N is the number of cells each benchmark works with, 100000 by default. The
+// results are written to standard output as CSV, or as a JSON array with
+// --json, so they can be compared between runs.
+
+//Default number of cells each benchmark works with.
+#define DEFAULT_SCALE 100000
+//Number of single edits timed to determine the recalculation latency.
+#define NUM_EDITS 1000
+//Number of cells referenced by the wide fan-in formula.
+#define FAN_IN_WIDTH 1000
+//Number of cells in each of the rolling sums over a single column.
+#define RANGE_WIDTH 10
+
+//Columns of the sheet used by each benchmark, so the benchmarks don't affect each other.
+#define PARSE_COL 0
+#define CHAIN_COL 1
+#define FAN_IN_COL 2
+#define FAN_IN_RESULT_COL 3
+#define EDIT_INPUT_COL 4
+#define EDIT_DOUBLE_COL 5
+#define EDIT_TOTAL_COL 6
+#define LOAD_COL 7
+#define BATCH_COL 8
+#define RANGE_INPUT_COL 9
+#define RANGE_SUM_COL 10
+#define SHEET_COLS 11
+
+//Number of times the display has been updated, so the stub isn't optimised away.
+static long num_display_updates = 0;
+
+//Whether the results are written as JSON rather than CSV.
+static int json_output = 0;
+//Number of results written so far.
+static int num_results = 0;
+
+void update_cell_display(ROW row, COL col, const char *text) {
+    (void) row;
+    (void) col;
+    (void) text;
+    num_display_updates++;
+}
+
+/*
+ * Reads a monotonic clock.
+ * return: Current time in seconds.
+ */
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec / 1e9;
+}
+
+/*
+ * Writes the reference of a cell into a buffer. ie, A1, B2, AA10, etc.
+ * buffer: Buffer with room for at least 24 characters.
+ * row: Row of the cell.
+ * col: Column of the cell.
+ */
+static void write_reference(char *buffer, int row, int col) {
+    //Writes the letters of the column in reverse, where A is 1, Z is 26 and AA is 27.
+    char letters[8];
+    int num_letters = 0;
+    for (int column = col + 1; column > 0; column = (column - 1) / 26) {
+        letters[num_letters++] = (char) ('A' + (column - 1) % 26);
+    }
+    int length = 0;
+    while (num_letters > 0) {
+        buffer[length++] = letters[--num_letters];
+    }
+    sprintf(buffer + length, "%d", row + 1);
+}
+
+/*
+ * Sets a cell to a copy of the given text.
+ */
+static void set_cell(int row, int col, const char *text) {
+    set_cell_value((ROW) row, (COL) col, strdup(text));
+}
+
+/*
+ * Compares two durations, for sorting them.
+ */
+static int compare_durations(const void *first, const void *second) {
+    double a = *(const double *) first;
+    double b = *(const double *) second;
+    return (a > b) - (a < b);
+}
+
+/*
+ * Writes the result of a benchmark.
+ * name: Name of the benchmark.
+ * count: Number of operations which were timed.
+ * seconds: Total time taken by the operations.
+ * durations: Time taken by each operation, or NULL if they weren't timed individually. The array is sorted.
+ */
+static void report(const char *name, long count, double seconds, double *durations) {
+    //The percentiles are null in JSON and empty in CSV when the operations weren't timed individually.
+    char p50[32] = "";
+    char p99[32] = "";
+    if (durations != NULL) {
+        qsort(durations, (size_t) count, sizeof(double), compare_durations);
+        snprintf(p50, sizeof(p50), "%.3f", durations[count / 2] * 1e6);
+        snprintf(p99, sizeof(p99), "%.3f", durations[(count * 99) / 100] * 1e6);
+    } else if (json_output) {
+        strcpy(p50, "null");
+        strcpy(p99, "null");
+    }
+    double rate = seconds > 0.0 ? (double) count / seconds : 0.0;
+    if (json_output) {
+        printf("%s\n  {\"benchmark\": \"%s\", \"count\": %ld, \"seconds\": %.6f, \"ops_per_second\": %.1f, "
+               "\"p50_us\": %s, \"p99_us\": %s}", num_results == 0 ? "[" : ",", name, count, seconds, rate, p50, p99);
+    } else {
+        if (num_results == 0) {
+            printf("benchmark,count,seconds,ops_per_second,p50_us,p99_us\n");
+        }
+        printf("%s,%ld,%.6f,%.1f,%s,%s\n", name, count, seconds, rate, p50, p99);
+    }
+    num_results++;
+}
+
+/*
+ * Measures how quickly formulas are parsed, by entering formulas which only contain constants so that no
+ * dependencies are involved.
+ */
+static void bench_parse(int scale) {
+    double start = now();
+    for (int row = 0; row < scale; row++) {
+        set_cell(row, PARSE_COL, "=1.5+2*(3-4/5)-6.25*7+8/(9+10)-11");
+    }
+    report("parse", scale, now() - start, NULL);
+}
+
+/*
+ * Measures how quickly a deep chain of formulas is evaluated, where each cell adds one to the cell above it.
+ */
+static void bench_chain(int scale) {
+    char formula[32];
+    char reference[24];
+    set_cell(0, CHAIN_COL, "1");
+    //Builds the chain from the top, so that each formula only evaluates itself while it is built.
+    for (int row = 1; row < scale; row++) {
+        write_reference(reference, row - 1, CHAIN_COL);
+        snprintf(formula, sizeof(formula), "=%s+1", reference);
+        set_cell(row, CHAIN_COL, formula);
+    }
+    //Times recalculating the whole chain after its first cell changes.
+    double start = now();
+    set_cell(0, CHAIN_COL, "2");
+    report("chain_recalc", scale, now() - start, NULL);
+}
+
+/*
+ * Measures how quickly formulas which read many cells are evaluated, both through a range and through individual
+ * references.
+ */
+static void bench_fan_in(int scale) {
+    char reference[24];
+    for (int row = 0; row < scale; row++) {
+        set_cell(row, FAN_IN_COL, "1");
+    }
+
+    //Sums the whole column with a range.
+    char range[64];
+    char last[24];
+    write_reference(reference, 0, FAN_IN_COL);
+    write_reference(last, scale - 1, FAN_IN_COL);
+    snprintf(range, sizeof(range), "=SUM(%s:%s)", reference, last);
+    double start = now();
+    set_cell(0, FAN_IN_RESULT_COL, range);
+    report("fan_in_range", scale, now() - start, NULL);
+
+    //Adds up the first cells of the column one reference at a time.
+    int width = scale < FAN_IN_WIDTH ? scale : FAN_IN_WIDTH;
+    char *formula = malloc((size_t) width * 24 + 2);
+    size_t length = 0;
+    formula[length++] = '=';
+    for (int row = 0; row < width; row++) {
+        write_reference(reference, row, FAN_IN_COL);
+        length += (size_t) sprintf(formula + length, row == 0 ? "%s" : "+%s", reference);
+    }
+    start = now();
+    set_cell(1, FAN_IN_RESULT_COL, formula);
+    report("fan_in_references", width, now() - start, NULL);
+    free(formula);
+
+    //Times changing a cell read by both formulas.
+    int edits = scale < NUM_EDITS ? scale : NUM_EDITS;
+    start = now();
+    for (int i = 0; i < edits; i++) {
+        set_cell(i % width, FAN_IN_COL, i % 2 == 0 ? "2" : "1");
+    }
+    report("fan_in_edit", edits, now() - start, NULL);
+}
+
+/*
+ * Measures the latency of single edits to a sheet where each input has a doubled value, and a running total of the
+ * doubled values. Each edit recalculates the total of every row below it.
+ */
+static void bench_edit(int scale) {
+    char formula[64];
+    char reference[24];
+    char other[24];
+    //Keeps the sheet small enough that the edits don't take too long.
+    int rows = scale < 10000 ? scale : 10000;
+    for (int row = 0; row < rows; row++) {
+        set_cell(row, EDIT_INPUT_COL, "1");
+        write_reference(reference, row, EDIT_INPUT_COL);
+        snprintf(formula, sizeof(formula), "=%s*2", reference);
+        set_cell(row, EDIT_DOUBLE_COL, formula);
+        write_reference(reference, row, EDIT_DOUBLE_COL);
+        if (row == 0) {
+            snprintf(formula, sizeof(formula), "=%s", reference);
+        } else {
+            write_reference(other, row - 1, EDIT_TOTAL_COL);
+            snprintf(formula, sizeof(formula), "=%s+%s", other, reference);
+        }
+        set_cell(row, EDIT_TOTAL_COL, formula);
+    }
+
+    //Times each edit of a random input.
+    double *durations = malloc(NUM_EDITS * sizeof(double));
+    char number[16];
+    srand(1);
+    double total = 0.0;
+    for (int i = 0; i < NUM_EDITS; i++) {
+        snprintf(number, sizeof(number), "%d", i);
+        int row = rand() % rows;
+        double start = now();
+        set_cell(row, EDIT_INPUT_COL, number);
+        durations[i] = now() - start;
+        total += durations[i];
+    }
+    report("single_edit", NUM_EDITS, total, durations);
+    free(durations);
+}
+
+/*
+ * Measures how quickly the dependents of a cell are found when a column is read by a range on every row, through a
+ * rolling sum of the last few cells of the column on each row.
+ */
+static void bench_ranges(int scale) {
+    char formula[64];
+    char reference[24];
+    char last[24];
+    for (int row = 0; row < scale; row++) {
+        set_cell(row, RANGE_INPUT_COL, "1");
+    }
+    double start = now();
+    for (int row = 0; row < scale; row++) {
+        write_reference(reference, row < RANGE_WIDTH ? 0 : row - RANGE_WIDTH + 1, RANGE_INPUT_COL);
+        write_reference(last, row, RANGE_INPUT_COL);
+        snprintf(formula, sizeof(formula), "=SUM(%s:%s)", reference, last);
+        set_cell(row, RANGE_SUM_COL, formula);
+    }
+    report("range_formulas", scale, now() - start, NULL);
+
+    //Times each edit of a random input, which recalculates the sums containing it.
+    double *durations = malloc(NUM_EDITS * sizeof(double));
+    char number[16];
+    srand(1);
+    double total = 0.0;
+    for (int i = 0; i < NUM_EDITS; i++) {
+        snprintf(number, sizeof(number), "%d", i);
+        int row = rand() % scale;
+        start = now();
+        set_cell(row, RANGE_INPUT_COL, number);
+        durations[i] = now() - start;
+        total += durations[i];
+    }
+    report("range_edit", NUM_EDITS, total, durations);
+    free(durations);
+}
+
+/*
+ * Measures how quickly numbers are loaded into empty cells.
+ */
+static void bench_load(int scale) {
+    char number[16];
+    double start = now();
+    for (int row = 0; row < scale; row++) {
+        snprintf(number, sizeof(number), "%d.5", row);
+        set_cell(row, LOAD_COL, number);
+    }
+    report("bulk_load", scale, now() - start, NULL);
+
+    //Loads the same numbers as a single batch, with a formula reading each of them.
+    char formula[64];
+    char reference[24];
+    start = now();
+    begin_batch();
+    for (int row = 0; row < scale; row++) {
+        write_reference(reference, row, LOAD_COL);
+        snprintf(formula, sizeof(formula), "=%s+1", reference);
+        set_cell(row, BATCH_COL, formula);
+    }
+    for (int row = 0; row < scale; row++) {
+        snprintf(number, sizeof(number), "%d", row);
+        set_cell(row, LOAD_COL, number);
+    }
+    end_batch();
+    report("batch_load", 2L * scale, now() - start, NULL);
+}
+
+/*
+ * Measures how quickly a batch of edits is undone and redone, with each of the formulas reading the edited cells
+ * recalculated once.
+ */
+static void bench_undo(int scale) {
+    char number[16];
+    set_journal_budget((size_t) 1 << 30);
+    begin_batch();
+    for (int row = 0; row < scale; row++) {
+        snprintf(number, sizeof(number), "%d", row + 1);
+        set_cell(row, LOAD_COL, number);
+    }
+    end_batch();
+
+    double start = now();
+    undo();
+    report("batch_undo", scale, now() - start, NULL);
+    start = now();
+    redo();
+    report("batch_redo", scale, now() - start, NULL);
+    set_journal_budget(0);
+}
+
+/*
+ * Measures how quickly a view of the sheet is read, and how much slower edits are while it is open, since each tile
+ * they write to is copied first.
+ */
+static void bench_view(int scale) {
+    double start = now();
+    SheetView *view = open_sheet_view();
+    report("view_open", 1, now() - start, NULL);
+
+    char number[16];
+    start = now();
+    for (int row = 0; row < scale; row++) {
+        snprintf(number, sizeof(number), "%d", row);
+        set_cell(row, LOAD_COL, number);
+    }
+    report("view_edit", scale, now() - start, NULL);
+
+    double total = 0.0;
+    double value;
+    start = now();
+    for (int row = 0; row < scale; row++) {
+        if (get_view_value(view, row, LOAD_COL, &value) == VIEW_NUMBER) {
+            total += value;
+        }
+    }
+    report("view_read", scale, now() - start, NULL);
+    close_sheet_view(view);
+    num_display_updates += total > 0.0;
+}
+
+/*
+ * Measures how quickly cells are converted back to text for editing, for both formulas and numbers, and for formulas
+ * written into a buffer without allocating.
+ */
+static void bench_textual(int scale) {
+    size_t total_length = 0;
+    double start = now();
+    for (int row = 0; row < scale; row++) {
+        char *text = get_textual_value((ROW) row, (COL) PARSE_COL);
+        total_length += strlen(text);
+        free(text);
+    }
+    report("textual_formula", scale, now() - start, NULL);
+
+    start = now();
+    for (int row = 0; row < scale; row++) {
+        char *text = get_textual_value((ROW) row, (COL) LOAD_COL);
+        total_length += strlen(text);
+        free(text);
+    }
+    report("textual_number", scale, now() - start, NULL);
+
+    //Writes the same text into one buffer, as the interface does whenever the cursor moves.
+    char buffer[128];
+    start = now();
+    for (int row = 0; row < scale; row++) {
+        total_length += get_textual_value_into((ROW) row, (COL) PARSE_COL, buffer, sizeof(buffer));
+    }
+    report("textual_formula_into", scale, now() - start, NULL);
+    //Uses the length, so that the conversions aren't optimised away.
+    if (total_length == 0) {
+        fprintf(stderr, "no text was produced\n");
+    }
+}
+
+/*
+ * Measures how quickly the whole sheet is saved to a snapshot and loaded back from it. This is run near the end, since
+ * loading the snapshot replaces the sheet.
+ */
+static void bench_snapshot(int scale) {
+    const char *path = "bench_snapshot.tmp";
+    double start = now();
+    if (save_snapshot(path) != 0) {
+        fprintf(stderr, "the snapshot couldn't be saved\n");
+        return;
+    }
+    report("snapshot_save", (long) scale * SHEET_COLS, now() - start, NULL);
+
+    start = now();
+    if (load_snapshot(path) != 0) {
+        fprintf(stderr, "the snapshot couldn't be loaded\n");
+    }
+    report("snapshot_load", (long) scale * SHEET_COLS, now() - start, NULL);
+    remove(path);
+}
+
+/*
+ * Measures how quickly the whole sheet is loaded from a CSV file into an empty sheet, which parses every field and
+ * evaluates every formula. This is run after the snapshot, since it replaces the sheet.
+ */
+static void bench_csv(int scale) {
+    const char *path = "bench_csv.tmp";
+    if (save_csv(path) < 0) {
+        fprintf(stderr, "the CSV file couldn't be saved\n");
+        return;
+    }
+    model_reset();
+    double start = now();
+    if (load_csv(path) < 0) {
+        fprintf(stderr, "the CSV file couldn't be loaded\n");
+    }
+    report("csv_load", (long) scale * SHEET_COLS, now() - start, NULL);
+    remove(path);
+}
+
+/*
+ * Measures how quickly the whole sheet is cleared, after filling every column with formulas. This is run last, since
+ * it replaces the sheet.
+ */
+static void bench_reset(int scale) {
+    char formula[32];
+    char reference[24];
+    //Fills each column of an empty sheet with a chain of formulas from the top, so that each formula only evaluates
+    //itself.
+    model_reset();
+    for (int col = 0; col < SHEET_COLS; col++) {
+        set_cell(0, col, "1");
+        for (int row = 1; row < scale; row++) {
+            write_reference(reference, row - 1, col);
+            snprintf(formula, sizeof(formula), "=%s+1", reference);
+            set_cell(row, col, formula);
+        }
+    }
+    double start = now();
+    model_reset();
+    report("reset", (long) scale * SHEET_COLS, now() - start, NULL);
+}
+
+int main(int argc, char **argv) {
+    int scale = DEFAULT_SCALE;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json_output = 1;
+        } else {
+            scale = atoi(argv[i]);
+        }
+    }
+    if (scale < 1) {
+        fprintf(stderr, "usage: %s [--json] [N]\n", argv[0]);
+        return 1;
+    }
+
+    model_init(scale, SHEET_COLS);
+    bench_parse(scale);
+    bench_chain(scale);
+    bench_fan_in(scale);
+    bench_edit(scale);
+    bench_ranges(scale);
+    bench_load(scale);
+    bench_undo(scale);
+    bench_view(scale);
+    bench_textual(scale);
+    bench_snapshot(scale);
+    bench_csv(scale);
+    bench_reset(scale);
+    if (json_output) {
+        printf("\n]\n");
+    }
+    return 0;
+}
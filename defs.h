@@ -1,6 +1,9 @@
 #ifndef ASSIGNMENT_DEFS_H
 #define ASSIGNMENT_DEFS_H
 
+// Size of the region of the spreadsheet shown by the test runner, which is
+// also the viewport of the model until 'set_viewport' is called. The model
+// itself is sized at runtime by 'model_init'.
 #define NUM_ROWS 10
 #define NUM_COLS 7
 
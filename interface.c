@@ -4,17 +4,39 @@
 #include <ctype.h>
 #include <errno.h>
 #include <ncurses.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define DEFAULT_EDIT_SIZE 128
 
-// Current cur_row and column.
-static ROW cur_row = ROW_1;
-static COL cur_col = COL_A;
+// Size of the spreadsheet, which is scrolled through a viewport sized to fit
+// the terminal.
+#define SHEET_ROWS 10000
+#define SHEET_COLS 26
+
+// Largest viewport, however large the terminal is.
+#define MAX_VIEW_ROWS 128
+#define MAX_VIEW_COLS SHEET_COLS
+
+// Memory the journal of edits can hold for undoing them.
+#define JOURNAL_BUDGET (64 * 1024 * 1024)
+
+// File the statistics of the model are written to.
+#define STATS_PATH "model_stats.txt"
+
+// Current cur_row and column, in the spreadsheet.
+static int cur_row = 0;
+static int cur_col = 0;
 
 // Column to return to when pressing <enter>.
-static COL return_col = COL_A;
+static int return_col = 0;
+
+// Top left cell of the viewport, and its size.
+static int view_first_row = 0;
+static int view_first_col = 0;
+static int view_rows = 1;
+static int view_cols = 1;
 
 // Current editable text.
 static char *edit_text = NULL;
@@ -23,9 +45,80 @@ static size_t edit_text_length = 0;
 static size_t edit_position = 0;
 static size_t edit_display_offset = 0;
 
+// Text of each cell of the viewport, as it is or will be on the screen once
+// the display is flushed. Indexed by the position of the cell on the screen.
+static char display[MAX_VIEW_ROWS][MAX_VIEW_COLS][CELL_DISPLAY_WIDTH + 1];
+
+// Columns of each row of the screen whose text has changed since the display
+// was last flushed, from 'dirty_first_col' to 'dirty_last_col'. A row is clean
+// when its first dirty column is after its last.
+static int dirty_first_col[MAX_VIEW_ROWS];
+static int dirty_last_col[MAX_VIEW_ROWS];
+
+// Rows which have dirty columns, from 'dirty_first_row' to 'dirty_last_row'.
+static int dirty_first_row = MAX_VIEW_ROWS;
+static int dirty_last_row = -1;
+
 static void set_cell_attr(attr_t attr) {
-    mvchgat(2 * ((int) cur_row + 2) + 1, (CELL_DISPLAY_WIDTH + 1) * (cur_col + 1) + 1, CELL_DISPLAY_WIDTH, attr, 0,
-            NULL);
+    mvchgat(2 * (cur_row - view_first_row + 2) + 1, (CELL_DISPLAY_WIDTH + 1) * (cur_col - view_first_col + 1) + 1,
+            CELL_DISPLAY_WIDTH, attr, 0, NULL);
+}
+
+static void clear_dirty_region(void) {
+    for (int row = 0; row < MAX_VIEW_ROWS; row++) {
+        dirty_first_col[row] = MAX_VIEW_COLS;
+        dirty_last_col[row] = -1;
+    }
+    dirty_first_row = MAX_VIEW_ROWS;
+    dirty_last_row = -1;
+}
+
+// Writes the cells which have changed since the last flush to the screen,
+// padding each one with blanks so it takes a single write. The screen itself
+// is only updated by the next 'refresh'.
+static void flush_display(void) {
+    char text[CELL_DISPLAY_WIDTH + 1];
+    for (int row = dirty_first_row; row <= dirty_last_row; row++) {
+        for (int col = dirty_first_col[row]; col <= dirty_last_col[row]; col++) {
+            snprintf(text, sizeof(text), "%-*s", CELL_DISPLAY_WIDTH, display[row][col]);
+            mvaddnstr(2 * (row + 2) + 1, (CELL_DISPLAY_WIDTH + 1) * (col + 1) + 1, text, CELL_DISPLAY_WIDTH);
+        }
+    }
+    clear_dirty_region();
+}
+
+// Prints the headers of the rows and columns in the viewport.
+static void draw_headers(void) {
+    // Generate the format specifier for the cur_row headers.
+    char format_buffer[8];
+    snprintf(format_buffer, sizeof(format_buffer), "%%%dd", CELL_DISPLAY_WIDTH);
+
+    for (int col = 0; col < view_cols; col++)
+        mvaddch(3, (CELL_DISPLAY_WIDTH + 1) * (col + 1) + CELL_DISPLAY_WIDTH / 2 + 1, view_first_col + col + 'A');
+    for (int row = 0; row < view_rows; row++)
+        mvprintw(2 * (row + 2) + 1, 1, format_buffer, view_first_row + row + 1);
+}
+
+// Scrolls the viewport as little as possible to show the current cell. Only
+// the headers and the cells of the new viewport are drawn, so scrolling takes
+// the same time however large the spreadsheet is.
+static void scroll_to_cursor(void) {
+    int first_row = view_first_row;
+    int first_col = view_first_col;
+    if (cur_row < first_row)
+        first_row = cur_row;
+    if (cur_row >= first_row + view_rows)
+        first_row = cur_row - view_rows + 1;
+    if (cur_col < first_col)
+        first_col = cur_col;
+    if (cur_col >= first_col + view_cols)
+        first_col = cur_col - view_cols + 1;
+    if (first_row == view_first_row && first_col == view_first_col)
+        return;
+    view_first_row = first_row;
+    view_first_col = first_col;
+    draw_headers();
+    set_viewport(view_first_row, view_first_col, view_rows, view_cols);
 }
 
 static void ensure_edit_text_capacity(size_t capacity) {
@@ -64,13 +157,22 @@ int main() {
 
     /* DRAW BORDERS */
 
-    // Include extra column to the left for cur_row numbers.
-    const size_t total_width = (NUM_COLS + 1) * (CELL_DISPLAY_WIDTH + 1) + 1;
-    // Include two extra rows on top for edit field and cur_row numbers.
-    const size_t total_height = (NUM_ROWS + 2) * 2 + 1;
-
-    // Resize window.
-    resizeterm(total_height + 1, total_width);
+    // Fit as many rows and columns as the terminal has room for, leaving an
+    // extra column to the left for cur_row numbers, two extra rows on top for
+    // the edit field and column headers, and a line below for instructions.
+    view_rows = (LINES - 2) / 2 - 2;
+    view_cols = (COLS - 1) / (CELL_DISPLAY_WIDTH + 1) - 1;
+    if (view_rows > MAX_VIEW_ROWS)
+        view_rows = MAX_VIEW_ROWS;
+    if (view_rows < 1)
+        view_rows = 1;
+    if (view_cols > MAX_VIEW_COLS)
+        view_cols = MAX_VIEW_COLS;
+    if (view_cols < 1)
+        view_cols = 1;
+
+    const size_t total_width = (view_cols + 1) * (CELL_DISPLAY_WIDTH + 1) + 1;
+    const size_t total_height = (view_rows + 2) * 2 + 1;
 
     // Draw the top line.
     addch(ACS_ULCORNER);
@@ -79,10 +181,10 @@ int main() {
     addch(ACS_URCORNER);
 
     // Draw the left/right and interior lines.
-    for (size_t i = 0; i < NUM_ROWS + 2; i++) {
+    for (size_t i = 0; i < (size_t) view_rows + 2; i++) {
         if (i > 0) {
             mvaddch(2 * i, 0, ACS_LTEE);
-            for (size_t j = 0; j < NUM_COLS + 1; j++) {
+            for (size_t j = 0; j < (size_t) view_cols + 1; j++) {
                 if (j > 0)
                     addch(i == 1 ? ACS_TTEE : ACS_PLUS);
                 for (size_t k = 0; k < CELL_DISPLAY_WIDTH; k++)
@@ -92,14 +194,14 @@ int main() {
         }
         mvaddch(2 * i + 1, 0, ACS_VLINE);
         if (i > 0)
-            for (size_t j = 1; j < NUM_COLS + 1; j++)
+            for (size_t j = 1; j < (size_t) view_cols + 1; j++)
                 mvaddch(2 * i + 1, (CELL_DISPLAY_WIDTH + 1) * j, ACS_VLINE);
         mvaddch(2 * i + 1, total_width - 1, ACS_VLINE);
     }
 
     // Draw the bottom line.
     mvaddch(total_height - 1, 0, ACS_LLCORNER);
-    for (size_t i = 0; i < NUM_COLS + 1; i++) {
+    for (size_t i = 0; i < (size_t) view_cols + 1; i++) {
         if (i > 0)
             addch(ACS_BTEE);
         for (size_t j = 0; j < CELL_DISPLAY_WIDTH; j++)
@@ -108,26 +210,22 @@ int main() {
     addch(ACS_LRCORNER);
 
     // Draw exit instructions.
-    mvaddstr(total_height, 0, "Press Ctrl+C to exit.");
+    mvaddstr(total_height, 0, "Press Ctrl+C to exit, Ctrl+Z to undo, Ctrl+Y to redo and "
+             "Ctrl+T to save statistics to " STATS_PATH ".");
 
     /* HEADERS */
 
-    // Print the column headers.
-    for (COL col = COL_A; col < NUM_COLS; col++)
-        mvaddch(3, (CELL_DISPLAY_WIDTH + 1) * (col + 1) + CELL_DISPLAY_WIDTH / 2 + 1, col + 'A');
-
-    // Generate the format specifier for the cur_row headers.
-    char format_buffer[8];
-    snprintf(format_buffer, sizeof(format_buffer), "%%%dd", CELL_DISPLAY_WIDTH);
-
-    // Print the cur_row headers.
-    for (ROW row = ROW_1; row < NUM_ROWS; row++)
-        mvprintw(2 * ((int) row + 2) + 1, 1, format_buffer, row + 1);
+    draw_headers();
 
     /* MAIN LOOP */
 
-    // Initialize data structure.
-    model_init();
+    // Initialize data structure, which only displays the cells in the
+    // viewport.
+    memset(display, 0, sizeof(display));
+    clear_dirty_region();
+    model_init(SHEET_ROWS, SHEET_COLS);
+    set_journal_budget(JOURNAL_BUDGET);
+    set_viewport(view_first_row, view_first_col, view_rows, view_cols);
 
     // String of blanks used by main loop.
     char blanks[total_width + 1];
@@ -136,21 +234,29 @@ int main() {
     blanks[total_width] = 0;
 
     while (true) {
+        // Scroll the current cell into view.
+        scroll_to_cursor();
+
         // Print the current cell coordinates in top-left corner.
         mvaddnstr(3, 1, blanks, CELL_DISPLAY_WIDTH);
         mvprintw(3, CELL_DISPLAY_WIDTH / 2, "%c%d", cur_col + 'A', cur_row + 1);
 
         // Show the textual representation of the current cell in the edit field.
-        if (edit_text != NULL)
-            free(edit_text);
-        edit_text = get_textual_value(cur_row, cur_col);
-        edit_text_capacity = edit_text == NULL ? 0 : strlen(edit_text);
-        edit_text_length = edit_text_capacity;
+        // The edit buffer is kept from one cell to the next, and only grows
+        // when the text of a cell doesn't fit in it.
+        ensure_edit_text_capacity(DEFAULT_EDIT_SIZE);
+        edit_text_length = get_textual_value_into(cur_row, cur_col, edit_text,
+                                                  edit_text_capacity);
+        if (edit_text_length >= edit_text_capacity) {
+            ensure_edit_text_capacity(edit_text_length + 1);
+            get_textual_value_into(cur_row, cur_col, edit_text, edit_text_capacity);
+        }
         mvaddnstr(1, 1, blanks, total_width - 2);
-        if (edit_text != NULL)
-            mvaddnstr(1, 1, edit_text, total_width - 2);
+        mvaddnstr(1, 1, edit_text, total_width - 2);
 
-        // Highlight the current cell.
+        // Write the cells changed since the last frame, then highlight the
+        // current cell and update the screen once.
+        flush_display();
         set_cell_attr(A_REVERSE);
         refresh();
 
@@ -164,47 +270,65 @@ int main() {
             case 3: // Ctrl+C
                 endwin();
                 return 0;
+            case 26: // Ctrl+Z
+                undo();
+                continue;
+            case 25: // Ctrl+Y
+                redo();
+                continue;
+            case 20: // Ctrl+T
+                save_model_stats(STATS_PATH);
+                continue;
             case KEY_UP:
-                if (cur_row > ROW_1)
+                if (cur_row > 0)
                     cur_row--;
                 continue;
             case KEY_DOWN:
-                if (cur_row < NUM_ROWS - 1)
+                if (cur_row < SHEET_ROWS - 1)
                     cur_row++;
                 continue;
             case KEY_LEFT:
-                if (cur_col > COL_A)
+                if (cur_col > 0)
                     cur_col--;
                 return_col = cur_col;
                 continue;
             case KEY_RIGHT:
-                if (cur_col < NUM_COLS - 1)
+                if (cur_col < SHEET_COLS - 1)
                     cur_col++;
                 return_col = cur_col;
                 continue;
             case KEY_PPAGE:
-                cur_row = ROW_1;
+                // Move up a screen, scrolling the viewport along with it.
+                cur_row = cur_row < view_rows ? 0 : cur_row - view_rows;
+                view_first_row = view_first_row < view_rows ? 0 : view_first_row - view_rows;
+                draw_headers();
+                set_viewport(view_first_row, view_first_col, view_rows, view_cols);
                 continue;
             case KEY_NPAGE:
-                cur_row = NUM_ROWS - 1;
+                // Move down a screen, scrolling the viewport along with it.
+                cur_row = cur_row + view_rows > SHEET_ROWS - 1 ? SHEET_ROWS - 1 : cur_row + view_rows;
+                view_first_row = view_first_row + view_rows > SHEET_ROWS - view_rows ? SHEET_ROWS - view_rows
+                                                                                     : view_first_row + view_rows;
+                draw_headers();
+                set_viewport(view_first_row, view_first_col, view_rows, view_cols);
                 continue;
             case KEY_HOME:
-                cur_col = COL_A;
-                return_col = COL_A;
+                cur_col = 0;
+                return_col = 0;
                 continue;
             case KEY_END:
-                cur_col = NUM_COLS - 1;
-                return_col = NUM_COLS - 1;
+                cur_col = SHEET_COLS - 1;
+                return_col = SHEET_COLS - 1;
                 continue;
             case '\t':
-                if (cur_col < NUM_COLS - 1)
+                if (cur_col < SHEET_COLS - 1)
                     cur_col++;
                 continue;
             case KEY_DC:
                 clear_cell(cur_row, cur_col);
                 continue;
             case '\n':
-                if (cur_row < NUM_ROWS - 1) {
+                if (cur_row < SHEET_ROWS - 1) {
                     cur_row++;
                     cur_col = return_col;
                 }
@@ -267,10 +391,8 @@ int main() {
                 case KEY_PPAGE:
                 case KEY_NPAGE:
                 case 0033: // Escape key.
-                    // Cancel edit and navigate as usual.
-                    free(edit_text);
-                    edit_text = NULL;
-                    edit_text_capacity = 0;
+                    // Cancel edit and navigate as usual, keeping the buffer for
+                    // the next cell.
                     edit_text_length = 0;
                     goto handle_key;
                 case KEY_BACKSPACE:
@@ -313,13 +435,26 @@ int main() {
     }
 }
 
-void update_cell_display(ROW row, COL col, const char *text) {
-    int console_row = 2 * ((int) row + 2) + 1;
-    int console_col = (CELL_DISPLAY_WIDTH + 1) * (col + 1) + 1;
-    char blanks[CELL_DISPLAY_WIDTH + 1];
-    for (size_t i = 0; i < CELL_DISPLAY_WIDTH; i++)
-        blanks[i] = ' ';
-    blanks[CELL_DISPLAY_WIDTH] = '\0';
-    mvaddstr(console_row, console_col, blanks);
-    mvaddnstr(console_row, console_col, text, CELL_DISPLAY_WIDTH);
+void update_cell_display(ROW sheet_row, COL sheet_col, const char *text) {
+    // Find the cell on the screen, skipping cells outside the viewport.
+    int row = (int) sheet_row - view_first_row;
+    int col = (int) sheet_col - view_first_col;
+    if (row < 0 || row >= view_rows || col < 0 || col >= view_cols)
+        return;
+    // Skip cells whose visible text hasn't changed.
+    char *shown = display[row][col];
+    if (strncmp(shown, text, CELL_DISPLAY_WIDTH) == 0)
+        return;
+    snprintf(shown, CELL_DISPLAY_WIDTH + 1, "%s", text);
+
+    // Grow the dirty region of the row, and the rows, to cover the cell. It
+    // is written to the screen by the next flush.
+    if (col < dirty_first_col[row])
+        dirty_first_col[row] = col;
+    if (col > dirty_last_col[row])
+        dirty_last_col[row] = col;
+    if (row < dirty_first_row)
+        dirty_first_row = row;
+    if (row > dirty_last_row)
+        dirty_last_row = row;
 }
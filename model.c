@@ -1,17 +1,30 @@
 #include "model.h"
 #include "interface.h"
+#include "aggregate.h"
+#include "arena.h"
+#include "number.h"
 
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+#include <sys/stat.h>
+#ifdef MODEL_STATS
+#include <time.h>
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-//Maximum number of operands in a formula.
-#define MAX_TERMS 10
-
 /*
  * Enum to represent the type of cell in the spreadsheet.
  * TEXT: Cell containing a text string.
@@ -28,439 +41,6129 @@ typedef enum {
 typedef struct Cell Cell;
 
 /*
- * Struct to represent the terms in a formula.
- * cell: Pointer to the cell that the term points to. ie, A1, B2, etc.
- * constant: The constant value term. ie, 1.4, 2.9, etc.
+ * Enum to represent the aggregate function applied to a range of cells by a term of a formula.
+ * NO_FUNCTION: The term is a cell reference or constant, rather than a range.
+ * SUM_FUNCTION: Adds up the numbers in the range.
+ * AVERAGE_FUNCTION: Averages the numbers in the range.
+ * MIN_FUNCTION: Finds the smallest number in the range.
+ * MAX_FUNCTION: Finds the largest number in the range.
+ */
+typedef enum {
+    NO_FUNCTION,
+    SUM_FUNCTION,
+    AVERAGE_FUNCTION,
+    MIN_FUNCTION,
+    MAX_FUNCTION,
+    NUM_FUNCTIONS
+} AggregateFunction;
+
+//Names of the aggregate functions, as written in formulas.
+static const char* function_names[NUM_FUNCTIONS] = {"", "SUM", "AVERAGE", "MIN", "MAX"};
+
+/*
+ * Struct to represent a rectangular range of cells. ie, A1:B10.
+ * first_row: First row of the range.
+ * first_col: First column of the range.
+ * last_row: Last row of the range, inclusive.
+ * last_col: Last column of the range, inclusive.
+ */
+typedef struct {
+    int first_row;
+    int first_col;
+    int last_row;
+    int last_col;
+} Range;
+
+/*
+ * Enum to represent the instructions of a compiled formula. A formula is compiled into a program in reverse Polish
+ * notation which is run on a stack of numbers, so evaluating it is a single loop without any recursion.
+ * Instructions which need an operand take the next unused operand of the matching kind from the formula.
+ * PUSH_CONSTANT: Pushes the next constant.
+ * LOAD_CELL: Pushes the value of the next referenced cell.
+ * AGGREGATE: Pushes the result of the next aggregate function.
+ * ADD: Pops two numbers and pushes their sum.
+ * SUBTRACT: Pops two numbers and pushes the first minus the second.
+ * MULTIPLY: Pops two numbers and pushes their product.
+ * DIVIDE: Pops two numbers and pushes the first divided by the second.
+ * NEGATE: Pops a number and pushes its negation.
+ */
+typedef enum {
+    PUSH_CONSTANT,
+    LOAD_CELL,
+    AGGREGATE,
+    ADD,
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    NEGATE
+} Instruction;
+
+//Maximum number of values on the stack while evaluating a formula.
+#define MAX_STACK_DEPTH 64
+//Maximum number of brackets and unary operators a formula can nest.
+#define MAX_NESTING_DEPTH 64
+//Maximum number of characters in the reference of a cell, which is 7 letters for the column and 10 digits for the row.
+#define MAX_REFERENCE_LENGTH 17
+//Maximum number of characters in an operand of a formula, which is a function name and a range of two references.
+#define MAX_OPERAND_LENGTH 48
+//Number of instructions a formula can have for its text to be written without allocating memory.
+#define FORMULA_AFFIX_BUFFER_SIZE 64
+//Size of the buffer on the stack which the text of a formula is written to while it is compiled.
+#define FORMULA_TEXT_BUFFER_SIZE (2 + FORMULA_AFFIX_BUFFER_SIZE * MAX_OPERAND_LENGTH)
+//Size of the buffer on the stack which the textual value of a cell is written to before it is copied to a string.
+#define TEXTUAL_VALUE_BUFFER_SIZE 256
+
+/*
+ * Struct to represent a cell referenced by a formula, resolved to where its value is stored so that it can be read
+ * without looking up the cell.
+ * tile: Index of the tile containing the cell.
+ * slot: Index of the cell in the columns of the tile, which is its column within the tile times TILE_ROWS plus its
+ * row within the tile.
+ */
+typedef struct {
+    int tile;
+    int slot;
+} CellReference;
+
+/*
+ * Struct to represent an aggregate function applied to a range of cells by a formula. ie, SUM(A1:A10).
+ * function: Aggregate function which is applied.
+ * range: Range of cells the function is applied to.
+ */
+typedef struct {
+    AggregateFunction function;
+    Range range;
+} RangeFunction;
+
+/*
+ * Struct to represent a formula, compiled into a program of instructions and the operands they use.
+ * The formula is allocated with exactly enough room for its operands, instructions and text, which are stored in a
+ * single block after the constants: the constants, then the cell references, then the range functions, then the code,
+ * then the text with a null terminator. The text is written once when the formula is compiled, so that it can be
+ * edited and saved without converting the instructions back to text each time.
+ * num_instructions: Number of instructions in the code.
+ * num_constants: Number of constants.
+ * num_references: Number of cell references.
+ * num_ranges: Number of range functions.
+ * error_offset: Byte offset in the text of the formula where it failed to parse, or -1 if it was parsed successfully.
+ * A formula which failed to parse has no instructions, and its text is kept as it was typed so that the user can
+ * correct it. Otherwise the text is written from the instructions, without spaces or unneeded brackets.
+ * text_length: Length of the text, not counting the null terminator.
+ * constants: Constants pushed by the formula. ie, 1.4, 2.9, etc.
+ */
+typedef struct {
+    int num_instructions;
+    int num_constants;
+    int num_references;
+    int num_ranges;
+    int error_offset;
+    int text_length;
+    double constants[];
+} Formula;
+
+/*
+ * Union to represent the value of a cell. Numbers are stored in the columns of the tile containing the cell instead.
+ * text: Id of the text of the cell in the string pool, or 0 if the cell is empty.
+ * formula: Formula of cell.
+ */
+typedef union {
+    unsigned int text;
+    Formula* formula;
+} CellValue;
+
+/*
+ * Struct to represent a string in the string pool.
+ * text: The string, or NULL if the entry is free.
+ * hash: Hash of the string.
+ * references: Number of cells whose text is the string. The string is freed once no cell uses it.
+ * next: Id of the next string in the same bucket of the hash table, or of the next free entry if this one is free. 0
+ * ends either list.
+ */
+typedef struct {
+    char* text;
+    unsigned int hash;
+    int references;
+    unsigned int next;
+} PooledString;
+
+/*
+ * Struct to represent the pool of the distinct texts held by cells. Cells refer to their text by its id in the pool,
+ * so identical texts share a single allocation, however many cells hold them, and two cells hold the same text exactly
+ * when they hold the same id.
+ * strings: Entries of the pool, indexed by id. Id 0 is never used, so that it can stand for no text.
+ * num_strings: Number of entries, including id 0 and the free entries.
+ * capacity: Number of entries the array has room for.
+ * buckets: Id of the first string in each bucket of the hash table, or 0 if the bucket is empty.
+ * num_buckets: Number of buckets, which is a power of two.
+ * free_id: Id of the first free entry, or 0 if there are none.
+ * num_used: Number of entries which hold a string.
+ */
+typedef struct {
+    PooledString* strings;
+    unsigned int num_strings;
+    unsigned int capacity;
+    unsigned int* buckets;
+    unsigned int num_buckets;
+    unsigned int free_id;
+    unsigned int num_used;
+} StringPool;
+
+static StringPool string_pool;
+
+/*
+ * Enum to represent the error which occurred while evaluating the formula of a cell. A formula which reads a cell with
+ * an error gets the same error, apart from a cell whose formula couldn't be parsed, which has no numeric value.
+ * NO_ERROR: The formula evaluated successfully.
+ * PARSE_ERROR: The formula could not be parsed.
+ * CIRCULAR_DEPENDENCY: The formula depends on itself.
+ * NON_NUMERIC_VALUE: The formula references a cell which doesn't contain a number.
+ * DIVISION_BY_ZERO: The formula divides by zero, or averages a range without any numbers.
+ * INVALID_NUMBER: The result of the formula isn't a number, such as infinity minus infinity.
+ */
+typedef enum {
+    NO_ERROR,
+    PARSE_ERROR,
+    CIRCULAR_DEPENDENCY,
+    NON_NUMERIC_VALUE,
+    DIVISION_BY_ZERO,
+    INVALID_NUMBER,
+    NUM_CELL_ERRORS
+} CellError;
+
+//Text displayed in place of the result of a formula with each error, short enough to fit in a cell.
+static const char* error_names[NUM_CELL_ERRORS] = {"", "#PARSE!", "#CIRCULAR!", "#VALUE!", "#DIV/0!", "#NUM!"};
+
+/*
+ * Struct to represent a cell in the spreadsheet.
+ * type: Type of cell. ie, text, number, formula.
+ * value: Value of cell. ie, text, number, formula.
+ * error: Cached error which occurred while evaluating the formula of the cell.
+ * dirty: Set when a cell the formula depends on has changed since the result in the tile columns was cached.
+ * stale: Set in lazy evaluation mode when a cell the formula depends on has changed, and the formula hasn't been
+ * evaluated since because its result hasn't been needed. Every formula which depends on a stale cell is stale too.
+ * dependents: Cells containing a formula which references this cell.
+ * num_dependents: Number of cells in the dependents array, or in the stored dependents if there are any.
+ * dependents_capacity: Number of cells the dependents array has room for.
+ * stored_dependents: References to the dependents in the snapshot the cell was loaded from, or NULL once they have been
+ * resolved into the dependents array. They are only resolved when they are first needed, since resolving them loads
+ * the tiles of the dependents.
+ * visit_mark: Recalculation pass which last visited the cell.
+ * pending_inputs: Number of cells the formula depends on which haven't been recalculated yet in the current pass. The
+ * cell is ready to be evaluated once this reaches 0, and it is counted atomically so that several threads can evaluate
+ * the inputs at the same time.
+ * row: Row of the cell in the spreadsheet.
+ * col: Column of the cell in the spreadsheet.
+ * order: Position of the cell in the topological order of the spreadsheet, where each cell comes before every formula
+ * which reads it, or 0 if the cell isn't in the order. A cell is added to the order when it is first given a formula,
+ * and keeps its position once it holds something else, so that it doesn't need to be added again. A cell given a
+ * formula by a CSV file is taken out of the order until the formulas of the file are registered.
+ * order_mark: Search of the topological order which last visited the cell.
+ * closes_cycle: Set when the formula of the cell reads a cell which depends on it, in which case the cells the formula
+ * reads are left out of the topological order. Every circular dependency has at least one such formula.
+ */
+struct Cell {
+    CellType type;
+    CellValue value;
+    CellError error;
+    int dirty;
+    int stale;
+    Cell** dependents;
+    int num_dependents;
+    int dependents_capacity;
+    const CellReference* stored_dependents;
+    unsigned int visit_mark;
+    atomic_int pending_inputs;
+    int row;
+    int col;
+    int64_t order;
+    unsigned int order_mark;
+    int closes_cycle;
+};
+
+//Number of rows and columns of cells in each tile of the spreadsheet.
+#define TILE_ROWS 64
+#define TILE_COLS 8
+
+/*
+ * Enum to represent the kind of value a cell holds, as stored in the columns of a tile.
+ * VALUE_EMPTY: Cell is empty.
+ * VALUE_NUMBER: Cell holds a number, or a formula whose result is a number.
+ * VALUE_TEXT: Cell holds text.
+ * VALUE_ERROR: Cell holds a formula whose evaluation failed.
+ */
+typedef enum {
+    VALUE_EMPTY,
+    VALUE_NUMBER,
+    VALUE_TEXT,
+    VALUE_ERROR
+} ValueKind;
+
+/*
+ * Struct to represent a tile, a fixed size block of neighbouring cells which is allocated the first time any of its
+ * cells is written to.
+ * cells: Cells of the tile, indexed by their row and column within the tile.
+ */
+typedef struct {
+    Cell cells[TILE_ROWS][TILE_COLS];
+} Tile;
+
+/*
+ * Struct to represent the values of the cells of a tile, stored column by column separately from the cells, so that
+ * reading a range of a column scans contiguous doubles without following pointers or branching on the type of each
+ * cell. The values are kept apart from the tile, so that they can be read straight from a snapshot before the cells of
+ * the tile have been loaded.
+ * numbers: Numeric value of each cell, indexed by column then row. Cells holding an error hold the CellError which
+ * formulas reading them get, and any other cell without a numeric value holds 0.
+ * kinds: ValueKind of each cell, indexed by column then row.
+ */
+typedef struct {
+    double numbers[TILE_COLS][TILE_ROWS];
+    unsigned char kinds[TILE_COLS][TILE_ROWS];
+} TileValues;
+
+/*
+ * Struct to represent values of a tile which were replaced while a view of the spreadsheet was open, so that the views
+ * opened before they were replaced can still read them. The versions of a tile are linked from the newest to the
+ * oldest, and are freed once every view which can read them has been closed.
+ * values: Values the tile held, or NULL if it held none.
+ * first_epoch: Epoch from which the tile held these values.
+ * last_epoch: Epoch from which the tile holds newer values, so only views opened in an earlier epoch read these.
+ * older: Version the tile held before this one, or NULL.
+ * newer: Version which replaced this one, or NULL if it was replaced by the current values of the tile. Only used by
+ * the thread which edits the spreadsheet.
+ * next_retired: Version of any tile which was replaced next, or NULL.
+ * tile: Index of the tile.
+ */
+typedef struct TileVersion {
+    TileValues* values;
+    uint64_t first_epoch;
+    uint64_t last_epoch;
+    struct TileVersion* older;
+    struct TileVersion* newer;
+    struct TileVersion* next_retired;
+    int tile;
+} TileVersion;
+
+/*
+ * Struct to represent a formula cell which aggregates part of a column, so that it is recalculated when any cell in
+ * that part changes. Ranges are tracked per column instead of adding the formula to the dependents of every cell in
+ * the range, so that empty cells in a range don't need to be allocated.
+ * cell: Cell which contains the formula.
+ * first_row: First row of the range.
+ * last_row: Last row of the range, inclusive.
+ */
+typedef struct {
+    Cell* cell;
+    int first_row;
+    int last_row;
+} RangeDependent;
+
+/*
+ * Struct to represent a formula cell which aggregates part of a column, as it is stored in a snapshot.
+ * cell: Reference to the cell which contains the formula.
+ * first_row: First row of the range.
+ * last_row: Last row of the range, inclusive.
+ */
+typedef struct {
+    CellReference cell;
+    int first_row;
+    int last_row;
+} StoredRangeDependent;
+
+/*
+ * Struct to represent the formula cells which aggregate part of a column and belong to the same bucket.
+ * dependents: Array of the formula cells and the rows they aggregate.
+ * num_dependents: Number of entries in the dependents array.
+ * dependents_capacity: Number of entries the dependents array has room for.
+ */
+typedef struct {
+    RangeDependent* dependents;
+    int num_dependents;
+    int dependents_capacity;
+} RangeBucket;
+
+/*
+ * Struct to represent the formula cells which aggregate part of a column, indexed by the rows they aggregate so that
+ * finding the ranges containing a cell doesn't look at every range of the column. The buckets are arranged in levels,
+ * where each bucket of level h covers 2^h rows of tiles. A range is kept in the bucket of the lowest level which covers
+ * all of its rows, so the ranges containing a cell are all in the one bucket of each level which covers the cell.
+ * buckets: Buckets of every level, from the lowest level up, or NULL if the column has never had any range dependents.
+ * num_dependents: Number of entries in all of the buckets.
+ * stored_dependents: Entries in the snapshot the column was loaded from, or NULL once they have been resolved into the
+ * buckets.
+ * num_stored_dependents: Number of entries in the stored dependents.
+ */
+typedef struct {
+    RangeBucket* buckets;
+    int num_dependents;
+    const StoredRangeDependent* stored_dependents;
+    int num_stored_dependents;
+} ColumnDependents;
+
+/*
+ * Struct to represent the spreadsheet as a grid of tiles, so that empty regions of the spreadsheet use no memory.
+ * num_rows: Number of rows in the spreadsheet.
+ * num_cols: Number of columns in the spreadsheet.
+ * tile_rows: Number of rows of tiles.
+ * tile_cols: Number of columns of tiles.
+ * tiles: Pointers to the tiles, in row major order. A tile which hasn't been allocated yet is NULL.
+ * values: Pointers to the values of each tile, in the same order. The values of a tile which hasn't been allocated yet
+ * are NULL, unless they are in a snapshot.
+ * value_epochs: Epoch from which each tile has held its current values. They are only written in place while no open
+ * view can read them.
+ * versions: Newest replaced version of the values of each tile which an open view might still read, or NULL.
+ * column_dependents: Formula cells which aggregate a range of each column.
+ * range_buckets: Number of buckets in the lowest level of the range dependents of a column, which is the number of rows
+ * of tiles rounded up to a power of two.
+ * range_levels: Number of levels of the range dependents of a column.
+ * num_tiles: Number of tiles which have been allocated.
+ * num_formulas: Number of formulas which have been allocated, not counting those in a snapshot.
+ */
+typedef struct {
+    int num_rows;
+    int num_cols;
+    int tile_rows;
+    int tile_cols;
+    Tile** tiles;
+    _Atomic(TileValues*)* values;
+    _Atomic uint64_t* value_epochs;
+    _Atomic(TileVersion*)* versions;
+    ColumnDependents* column_dependents;
+    int range_buckets;
+    int range_levels;
+    size_t num_tiles;
+    size_t num_formulas;
+} Sheet;
+
+static Sheet sheet;
+
+//Arena the formulas, dependents arrays and interned strings of the spreadsheet are allocated from, so that they don't
+//each need their own allocation and can all be freed at once.
+static Arena arena;
+
+/*
+ * Struct to represent where the contents of a tile are stored in a snapshot. An offset of 0 means the tile has no
+ * contents of that kind.
+ * values_offset: Offset of the TileValues of the tile.
+ * cells_offset: Offset of the SnapshotCell of each cell of the tile, in the same order as the values.
+ */
+typedef struct {
+    uint64_t values_offset;
+    uint64_t cells_offset;
+} SnapshotTile;
+
+/*
+ * Struct to represent a cell in a snapshot. The contents of the cell are stored elsewhere in the snapshot, in the same
+ * layout as they have in memory, so that they can be used without being converted.
+ * type: CellType of the cell.
+ * error: CellError of the cell.
+ * closes_cycle: 1 if the formula of the cell closes a circular dependency, otherwise 0.
+ * unused: Padding, which is always 0.
+ * num_dependents: Number of cells in the dependents of the cell.
+ * value: Offset of the formula of the cell, or the id of its text in the string table, or 0 if it has neither.
+ * dependents_offset: Offset of the CellReference of each dependent of the cell.
+ * order: Position of the cell in the topological order, or 0 if it isn't in the order.
+ */
+typedef struct {
+    uint8_t type;
+    uint8_t error;
+    uint8_t closes_cycle;
+    uint8_t unused;
+    uint32_t num_dependents;
+    uint64_t value;
+    uint64_t dependents_offset;
+    int64_t order;
+} SnapshotCell;
+
+/*
+ * Struct to represent where the range dependents of a column are stored in a snapshot.
+ * offset: Offset of the StoredRangeDependent of each entry.
+ * count: Number of entries.
+ */
+typedef struct {
+    uint64_t offset;
+    uint64_t count;
+} SnapshotColumn;
+
+/*
+ * Struct to represent a string of the string pool in the string table of a snapshot, which is indexed by the id of the
+ * string.
+ * offset: Offset of the null terminated string, or 0 if the entry is free.
+ * length: Length of the string.
+ * hash: Hash of the string.
+ * references: Number of cells whose text is the string.
+ * unused: Padding, which is always 0.
+ */
+typedef struct {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t hash;
+    int32_t references;
+    uint32_t unused;
+} SnapshotString;
+
+/*
+ * Struct to represent the header at the start of a snapshot. The sizes of the structs which are stored in the snapshot
+ * as they are in memory are recorded, so that a snapshot written by an incompatible build is rejected.
+ * magic: Identifies the file as a snapshot.
+ * version: Version of the layout of the snapshot.
+ * tile_rows: Number of rows of cells in each tile.
+ * tile_cols: Number of columns of cells in each tile.
+ * num_rows: Number of rows in the spreadsheet.
+ * num_cols: Number of columns in the spreadsheet.
+ * values_size: Size of TileValues.
+ * formula_size: Size of Formula.
+ * range_size: Size of RangeFunction.
+ * file_size: Size of the whole snapshot.
+ * tiles_offset: Offset of the SnapshotTile of each tile, in row major order.
+ * columns_offset: Offset of the SnapshotColumn of each column.
+ * strings_offset: Offset of the string table.
+ * num_strings: Number of entries in the string table, including the unused id 0.
+ * lowest_order: Lowest position given to a cell in the topological order.
+ * highest_order: Highest position given to a cell in the topological order.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t tile_rows;
+    uint32_t tile_cols;
+    int32_t num_rows;
+    int32_t num_cols;
+    uint32_t values_size;
+    uint32_t formula_size;
+    uint32_t range_size;
+    uint64_t file_size;
+    uint64_t tiles_offset;
+    uint64_t columns_offset;
+    uint64_t strings_offset;
+    uint64_t num_strings;
+    int64_t lowest_order;
+    int64_t highest_order;
+} SnapshotHeader;
+
+/*
+ * Struct to represent the snapshot the spreadsheet was loaded from, which stays mapped into memory while the
+ * spreadsheet uses it. The values of its tiles are used where they are, and its cells are only loaded into tiles the
+ * first time they are used.
+ * data: Contents of the snapshot, or NULL if the spreadsheet wasn't loaded from one.
+ * size: Size of the snapshot.
+ * tiles: Where the contents of each tile are stored in the snapshot.
+ */
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    const SnapshotTile* tiles;
+} Snapshot;
+
+static Snapshot snapshot;
+
+/*
+ * Struct to represent the region of the spreadsheet which is shown by the interface. Only the cells inside it are
+ * displayed, so cells which aren't visible are never formatted, and are displayed from their cached values once they
+ * become visible.
+ * first_row: First row which is shown.
+ * first_col: First column which is shown.
+ * num_rows: Number of rows which are shown.
+ * num_cols: Number of columns which are shown.
+ */
+typedef struct {
+    int first_row;
+    int first_col;
+    int num_rows;
+    int num_cols;
+} Viewport;
+
+static Viewport viewport = {0, 0, NUM_ROWS, NUM_COLS};
+
+/*
+ * Scratch arrays used while recalculating the dependents of an edited cell.
+ * Every cell is visited at most once per pass, so the number of affected cells bounds both arrays.
+ * recalc_cells: Cells which need recalculating, in the order they were found.
+ * recalc_ready: Cells whose inputs have all been recalculated, in topological order.
+ * recalc_capacity: Number of cells both arrays have room for.
+ * recalc_pass: Number of the current recalculation pass, compared against the visit mark of each cell.
+ */
+static Cell** recalc_cells = NULL;
+static Cell** recalc_ready = NULL;
+static int recalc_capacity = 0;
+static unsigned int recalc_pass = 0;
+
+/*
+ * Struct to represent the topological order of the cells, which is kept up to date as formulas are installed by the
+ * incremental algorithm of Pearce and Kelly, so that a formula which closes a circular dependency is found as soon as
+ * it is installed. Installing a formula which reads cells later in the order only reorders the cells between them:
+ * those which the cells it reads depend on, found by a search backwards, and those which depend on the formula, found
+ * by a search forwards. The cells found backwards are then given the lowest of the positions of all of them, in the
+ * order they had, and the cells found forwards the rest. If the search forwards reaches a cell found backwards, the
+ * formula closes a cycle. Cells which have never held a formula have no inputs, so they are only added to the order
+ * once they are given one.
+ * lowest: Lowest position given to a cell so far.
+ * highest: Highest position given to a cell so far.
+ * pass: Number of the last search, compared against the order mark of each cell. Each installation uses two numbers,
+ * one for the search backwards and the next for the search forwards.
+ * backward: Cells found by the search backwards, in the order they were found.
+ * num_backward: Number of cells in the backward array.
+ * forward: Cells found by the search forwards, in the order they were found.
+ * num_forward: Number of cells in the forward array.
+ * positions: Positions of the cells found by both searches, which are given back to them in their new order.
+ * capacity: Number of cells each of the arrays has room for.
+ */
+typedef struct {
+    int64_t lowest;
+    int64_t highest;
+    unsigned int pass;
+    Cell** backward;
+    int num_backward;
+    Cell** forward;
+    int num_forward;
+    int64_t* positions;
+    int capacity;
+} TopologicalOrder;
+
+static TopologicalOrder topological_order;
+
+/*
+ * Cells edited since the current batch of edits started, which are recalculated and displayed once the batch ends.
+ * Each edited cell is marked dirty when it is added, so it is only added once.
+ * batch_cells: Cells edited in the batch.
+ * num_batch_cells: Number of cells in the array.
+ * batch_capacity: Number of cells the array has room for.
+ * batch_depth: Number of batches which have been started and not ended, or 0 if the edits aren't being batched.
+ */
+static Cell** batch_cells = NULL;
+static int num_batch_cells = 0;
+static int batch_capacity = 0;
+static int batch_depth = 0;
+
+/*
+ * State of the lazy evaluation mode, where edits only mark the formulas which depend on them stale, and each formula
+ * is evaluated once its result is needed.
+ * lazy_evaluation: Set when the lazy evaluation mode is on.
+ * stale_cells: Cells which have been marked stale, some of which may have been evaluated since.
+ * num_stale_cells: Number of cells in the array.
+ * stale_capacity: Number of cells the array has room for.
+ */
+static int lazy_evaluation = 0;
+static Cell** stale_cells = NULL;
+static int num_stale_cells = 0;
+static int stale_capacity = 0;
+
+/*
+ * Union to represent the contents a cell held before it was edited: its text id, its formula, or its number.
+ */
+typedef union {
+    unsigned int text;
+    Formula* formula;
+    double number;
+} JournalPayload;
+
+/*
+ * Struct to represent a single edit in the journal, holding the contents the edited cell had before the edit. The
+ * contents are moved out of the cell rather than copied, and moved back by undoing the edit, which moves the contents
+ * the cell had after the edit into the entry so that the edit can be redone.
+ * row: Row of the edited cell.
+ * col: Column of the edited cell.
+ * type: Type of the contents held by the entry.
+ * starts_group: Set for the first edit of a batch, or for an edit made outside a batch. Edits are undone a group at a
+ * time.
+ * payload: Contents held by the entry.
+ */
+typedef struct {
+    int row;
+    int col;
+    unsigned char type;
+    unsigned char starts_group;
+    JournalPayload payload;
+} JournalEntry;
+
+/*
+ * Struct to represent the journal of edits which can be undone and redone.
+ * entries: Edits from the oldest to the newest.
+ * first: Index of the oldest edit still kept. Edits before it have been forgotten.
+ * position: Index after the last edit which can be undone. The edits from here on have been undone and can be redone.
+ * count: Number of entries in the array, including those before 'first'.
+ * capacity: Number of entries the array has room for.
+ * num_bytes: Memory held by the kept edits, including the formulas and texts they hold.
+ * budget: Memory the journal is allowed to hold, or 0 if no journal is kept.
+ * new_group: Set when a batch has started but none of its edits have been recorded yet.
+ * discarding: Set when the edits of the current batch aren't recorded, since they didn't fit in the budget.
+ */
+typedef struct {
+    JournalEntry* entries;
+    size_t first;
+    size_t position;
+    size_t count;
+    size_t capacity;
+    size_t num_bytes;
+    size_t budget;
+    int new_group;
+    int discarding;
+} Journal;
+
+static Journal journal;
+
+//Number of views of the spreadsheet which can be open at the same time.
+#define MAX_SHEET_VIEWS 16
+
+/*
+ * Struct to represent a view of the values of the spreadsheet as they were when it was opened. Each view is opened in
+ * its own epoch, and reads the values each tile held in that epoch.
+ * epoch: Epoch the view was opened in, or 0 if it is closed. The view is closed by whichever thread reads it.
+ * num_rows: Number of rows in the spreadsheet when the view was opened.
+ * num_cols: Number of columns in the spreadsheet when the view was opened.
+ * tile_cols: Number of columns of tiles.
+ * cached_tile: Index of the tile the view last read, or -1, so that reading neighbouring cells doesn't look up the
+ * version of their tile again.
+ * cached_values: Values of that tile in the epoch of the view, or NULL if it held none.
+ */
+struct SheetView {
+    _Atomic uint64_t epoch;
+    int num_rows;
+    int num_cols;
+    int tile_cols;
+    int cached_tile;
+    const TileValues* cached_values;
+};
+
+/*
+ * Struct to represent the views of the spreadsheet and the versions of tiles kept for them.
+ * slots: Views which can be opened.
+ * epoch: Epoch of the last view opened, or 0 if none has been. Values written from now on start in the next epoch.
+ * newest_epoch: Epoch of the last view opened if it might still be open, otherwise 0, in which case no tile needs to be
+ * copied before it is written to.
+ * oldest_retired: Version of any tile which was replaced first and hasn't been freed yet, or NULL.
+ * newest_retired: Version of any tile which was replaced last, or NULL.
+ * num_versions: Number of versions which haven't been freed yet.
+ */
+typedef struct {
+    SheetView slots[MAX_SHEET_VIEWS];
+    uint64_t epoch;
+    uint64_t newest_epoch;
+    TileVersion* oldest_retired;
+    TileVersion* newest_retired;
+    size_t num_versions;
+} ViewRegistry;
+
+static ViewRegistry views;
+
+#ifdef MODEL_STATS
+/*
+ * Struct to represent the counts and timings of the recalculations, which are only kept when the model is built with
+ * MODEL_STATS defined. The counts of what formulas do are atomic, since formulas are also evaluated by the workers.
+ * The rest are only written by the thread which edits the spreadsheet.
+ * num_recalculations: Recalculations so far.
+ * num_evaluations: Formulas evaluated.
+ * num_cell_reads: Cells read by the formulas evaluated, counting each cell of a range.
+ * num_stale_reads: Cells read by the formulas evaluated which were stale, so they were evaluated first. Each of them
+ * is also counted by num_cell_reads.
+ * num_circular: Cells found to be part of, or depend on, a circular dependency.
+ * total_nanoseconds: Time taken by every recalculation.
+ * max_nanoseconds: Time taken by the longest recalculation.
+ * histogram: Number of recalculations by the time they took, as for RecalcStats.
+ */
+typedef struct {
+    size_t num_recalculations;
+    atomic_size_t num_evaluations;
+    atomic_size_t num_cell_reads;
+    atomic_size_t num_stale_reads;
+    atomic_size_t num_circular;
+    uint64_t total_nanoseconds;
+    uint64_t max_nanoseconds;
+    size_t histogram[RECALC_HISTOGRAM_SIZE];
+} RecalcCounters;
+
+static RecalcCounters recalc_counters;
+
+//Adds to one of the counts of the recalculations.
+#define COUNT_RECALC_STAT(counter, amount) \
+    atomic_fetch_add_explicit(&recalc_counters.counter, (size_t) (amount), memory_order_relaxed)
+#else
+//Counts nothing, without evaluating the amount, since the model is built without MODEL_STATS.
+#define COUNT_RECALC_STAT(counter, amount) ((void) 0)
+#endif
+
+//Number of affected cells above which a recalculation is shared between the worker threads. Smaller recalculations
+//are done on the calling thread, since waking the workers would take longer than the recalculation itself.
+#define PARALLEL_THRESHOLD 4096
+//Maximum number of threads, including the calling thread, which recalculate cells.
+#define MAX_WORKERS 64
+//Number of cells each worker claims at a time while counting the inputs of the affected cells.
+#define COUNT_CHUNK 1024
+
+/*
+ * Struct to represent the queue of cells which are ready to be evaluated by a worker.
+ * The worker takes the cell it added most recently, so that it continues down the chain it just made ready, while
+ * idle workers steal the oldest cell.
+ * lock: Held while the queue is used, since other workers can steal from it.
+ * cells: Cells in the queue. The oldest cell is at index top, and the newest is just before index bottom.
+ * top: Index of the oldest cell.
+ * bottom: Index after the newest cell.
+ * capacity: Number of cells the array has room for.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    Cell** cells;
+    int top;
+    int bottom;
+    int capacity;
+} WorkQueue;
+
+/*
+ * Enum to represent the jobs the worker threads can be given.
+ * COUNT_JOB: Count how many affected inputs each affected cell has.
+ * EVALUATE_JOB: Evaluate the affected cells as they become ready.
+ * PARSE_JOB: Parse the chunks of a CSV file which is being loaded.
+ * LINK_JOB: Register the formulas loaded from a CSV file with the cells they reference.
+ */
+typedef enum {
+    COUNT_JOB,
+    EVALUATE_JOB,
+    PARSE_JOB,
+    LINK_JOB
+} WorkerJob;
+
+/*
+ * Struct to represent the threads which share large recalculations. The threads are only started the first time a
+ * recalculation is large enough to need them.
+ * num_workers: Number of workers, including the calling thread, which is worker 0.
+ * threads: Threads of the other workers.
+ * queues: Ready cells of each worker.
+ * lock: Held while a job is started or finished.
+ * job_started: Signalled when a new job is started.
+ * job_finished: Signalled when the last worker finishes the job.
+ * generation: Number of jobs started so far, so that workers can tell when a new one starts.
+ * job: Job which is currently being done.
+ * num_active: Number of workers which haven't finished the current job yet.
+ * next_chunk: Index of the next affected cell which hasn't been claimed while counting inputs, or of the next chunk of
+ * a CSV file which hasn't been claimed while parsing it.
+ * outstanding: Number of cells which are ready but haven't finished being evaluated.
+ * cells: Affected cells of the current recalculation.
+ * num_cells: Number of affected cells.
+ */
+typedef struct {
+    int num_workers;
+    pthread_t threads[MAX_WORKERS];
+    WorkQueue queues[MAX_WORKERS];
+    pthread_mutex_t lock;
+    pthread_cond_t job_started;
+    pthread_cond_t job_finished;
+    unsigned long generation;
+    WorkerJob job;
+    int num_active;
+    atomic_int next_chunk;
+    atomic_int outstanding;
+    Cell** cells;
+    int num_cells;
+} WorkerPool;
+
+static WorkerPool pool;
+
+/*
+ * Struct to hold the state of the parser while it compiles a formula. The parser keeps all of its state in this struct
+ * and never modifies the text, so several formulas can be parsed at the same time.
+ * The formula is parsed twice: once to measure how many instructions and operands it needs, and once to write them
+ * into a formula allocated at exactly that size.
+ * text: Text of the formula, starting with the '='.
+ * position: Next character to be parsed.
+ * formula: Formula the instructions and operands are written to, or NULL while the formula is being measured.
+ * num_instructions: Number of instructions compiled so far.
+ * num_constants: Number of constants compiled so far.
+ * num_references: Number of cell references compiled so far.
+ * num_ranges: Number of range functions compiled so far.
+ * depth: Number of values the instructions compiled so far leave on the stack.
+ * nesting: Number of brackets and unary operators the parser is currently inside.
+ * error: Character where the formula failed to parse, or NULL if no error has happened.
+ */
+typedef struct {
+    const char* text;
+    const char* position;
+    Formula* formula;
+    int num_instructions;
+    int num_constants;
+    int num_references;
+    int num_ranges;
+    int depth;
+    int nesting;
+    const char* error;
+} Parser;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Checks if memory is part of the snapshot the spreadsheet was loaded from, in which case it belongs to the snapshot
+ * and must not be freed.
+ * memory: Memory which is checked.
+ * return: 1 if the memory is in the snapshot, otherwise 0.
+ */
+int is_snapshot_memory(const void* memory) {
+    const unsigned char* bytes = memory;
+    return snapshot.data != NULL && bytes >= snapshot.data && bytes < snapshot.data + snapshot.size;
+}
+
+/*
+ * Maps the whole of a regular file into memory. The mapping is private and writable, so the memory can be changed
+ * without ever changing the file. On Windows, where files aren't mapped, the file is read into memory instead.
+ * path: Path of the file.
+ * size: Set to the size of the file.
+ * return: Contents of the file, which are released with 'unmap_file', or NULL if the file couldn't be opened, isn't a
+ * regular file, is empty, or couldn't be mapped.
+ */
+unsigned char* map_file(const char* path, size_t* size) {
+#ifdef _WIN32
+    FILE* file = fopen(path, "rb");
+    //Checks if the file could be opened.
+    if (file == NULL) {
+        return NULL;
+    }
+    long length = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    unsigned char* data = length > 0 ? malloc((size_t) length) : NULL;
+    //Checks if the memory allocation was successful, and the whole file could be read.
+    if (data == NULL || fseek(file, 0, SEEK_SET) != 0 || fread(data, 1, (size_t) length, file) != (size_t) length) {
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    *size = (size_t) length;
+    return data;
+#else
+    int descriptor = open(path, O_RDONLY);
+    //Checks if the file could be opened.
+    if (descriptor < 0) {
+        return NULL;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || !S_ISREG(status.st_mode) || status.st_size <= 0) {
+        close(descriptor);
+        return NULL;
+    }
+    void* data = mmap(NULL, (size_t) status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    //Checks if the file could be mapped.
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    *size = (size_t) status.st_size;
+    return data;
+#endif
+}
+
+/*
+ * Releases the contents of a file returned by 'map_file'.
+ * data: Contents of the file.
+ * size: Size of the file.
+ */
+void unmap_file(unsigned char* data, size_t size) {
+#ifdef _WIN32
+    (void) size;
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+/*
+ * Hashes a string, with the FNV-1a hash.
+ * text: String which is hashed.
+ * return: Hash of the string.
+ */
+unsigned int hash_string(const char* text) {
+    unsigned int hash = 2166136261u;
+    for (const unsigned char* c = (const unsigned char*) text; *c != '\0'; c++) {
+        hash = (hash ^ *c) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Adds a string of the pool to the bucket of the hash table for its hash.
+ * id: Id of the string.
+ */
+void link_string(unsigned int id) {
+    unsigned int* bucket = &string_pool.buckets[string_pool.strings[id].hash & (string_pool.num_buckets - 1)];
+    string_pool.strings[id].next = *bucket;
+    *bucket = id;
+}
+
+/*
+ * Grows the hash table of the string pool so that it has at least one bucket for each entry, moving every string to
+ * the bucket for its hash.
+ * return: 1 if the hash table has room for the entries, or 0 if it couldn't be grown.
+ */
+int grow_string_buckets() {
+    if (string_pool.num_strings <= string_pool.num_buckets) {
+        return 1;
+    }
+    unsigned int num_buckets = string_pool.num_buckets == 0 ? 64 : string_pool.num_buckets;
+    while (num_buckets < string_pool.num_strings) {
+        num_buckets *= 2;
+    }
+    unsigned int* buckets = calloc(num_buckets, sizeof(unsigned int));
+    //Checks if the memory allocation was successful.
+    if (buckets == NULL) {
+        return 0;
+    }
+    free(string_pool.buckets);
+    string_pool.buckets = buckets;
+    string_pool.num_buckets = num_buckets;
+    for (unsigned int id = 1; id < string_pool.num_strings; id++) {
+        if (string_pool.strings[id].text != NULL) {
+            link_string(id);
+        }
+    }
+    return 1;
+}
+
+/*
+ * Finds a string in the string pool, adding a copy of it if it isn't there yet, and counts another use of it.
+ * text: String which is interned.
+ * return: Id of the string, or 0 if the memory allocation failed.
+ */
+unsigned int intern_string(const char* text) {
+    unsigned int hash = hash_string(text);
+    //Checks if the pool already holds the string, in which case it is shared.
+    if (string_pool.num_buckets > 0) {
+        unsigned int id = string_pool.buckets[hash & (string_pool.num_buckets - 1)];
+        for (; id != 0; id = string_pool.strings[id].next) {
+            if (string_pool.strings[id].hash == hash && strcmp(string_pool.strings[id].text, text) == 0) {
+                string_pool.strings[id].references++;
+                return id;
+            }
+        }
+    }
+
+    //Copies the string, so that the pool owns it.
+    size_t length = strlen(text);
+    char* copy = arena_allocate(&arena, length + 1);
+    //Checks if the memory allocation was successful.
+    if (copy == NULL) {
+        return 0;
+    }
+    memcpy(copy, text, length + 1);
+    //Takes a free entry if there is one, otherwise adds an entry to the end. Id 0 is skipped, so that it can stand for
+    //no text.
+    unsigned int id = string_pool.free_id;
+    if (id != 0) {
+        string_pool.free_id = string_pool.strings[id].next;
+    } else {
+        if (string_pool.num_strings == 0) {
+            string_pool.num_strings = 1;
+        }
+        //Grows the entries if they are full.
+        if (string_pool.num_strings >= string_pool.capacity) {
+            unsigned int capacity = string_pool.capacity == 0 ? 64 : string_pool.capacity * 2;
+            PooledString* strings = realloc(string_pool.strings, capacity * sizeof(PooledString));
+            //Checks if the memory allocation was successful.
+            if (strings == NULL) {
+                arena_free(&arena, copy, length + 1);
+                return 0;
+            }
+            string_pool.strings = strings;
+            string_pool.capacity = capacity;
+        }
+        id = string_pool.num_strings++;
+    }
+    PooledString* string = &string_pool.strings[id];
+    string->text = copy;
+    string->hash = hash;
+    string->references = 1;
+    string->next = 0;
+    string_pool.num_used++;
+    //Adds the string to the hash table, which is rebuilt with more buckets instead if it has too few. A string which
+    //can't be added is still used, but isn't shared.
+    if (string_pool.num_strings <= string_pool.num_buckets) {
+        link_string(id);
+    } else {
+        grow_string_buckets();
+    }
+    return id;
+}
+
+/*
+ * Counts one less use of a string in the string pool, and frees it once nothing uses it.
+ * id: Id of the string, or 0 for no string.
+ */
+void release_string(unsigned int id) {
+    if (id == 0 || --string_pool.strings[id].references > 0) {
+        return;
+    }
+    PooledString* string = &string_pool.strings[id];
+    //Removes the string from its bucket of the hash table, if it was added to it.
+    if (string_pool.num_buckets > 0) {
+        unsigned int* link = &string_pool.buckets[string->hash & (string_pool.num_buckets - 1)];
+        while (*link != 0 && *link != id) {
+            link = &string_pool.strings[*link].next;
+        }
+        if (*link == id) {
+            *link = string->next;
+        }
+    }
+    //Strings which are still in the snapshot the spreadsheet was loaded from belong to the snapshot.
+    if (!is_snapshot_memory(string->text)) {
+        arena_free(&arena, string->text, strlen(string->text) + 1);
+    }
+    string->text = NULL;
+    string->next = string_pool.free_id;
+    string_pool.free_id = id;
+    string_pool.num_used--;
+}
+
+/*
+ * Retrieves a string from the string pool.
+ * id: Id of the string.
+ * return: The string, which is owned by the pool.
+ */
+const char* get_string(unsigned int id) {
+    return string_pool.strings[id].text;
+}
+
+/*
+ * Frees the string pool. The strings themselves are in the arena, so they are freed along with it.
+ */
+void free_string_pool() {
+    free(string_pool.strings);
+    free(string_pool.buckets);
+    memset(&string_pool, 0, sizeof(string_pool));
+}
+
+/*
+ * Finds the epoch of the oldest view of the spreadsheet which is still open.
+ * return: Epoch of the oldest open view, or UINT64_MAX if no view is open.
+ */
+uint64_t get_oldest_view_epoch() {
+    uint64_t oldest = UINT64_MAX;
+    for (int i = 0; i < MAX_SHEET_VIEWS; i++) {
+        //Acquires the reads made through a view before it was closed, so that its versions can be freed afterwards.
+        uint64_t epoch = atomic_load_explicit(&views.slots[i].epoch, memory_order_acquire);
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    return oldest;
+}
+
+/*
+ * Frees a version of the values of a tile, along with the values unless they belong to the snapshot.
+ * version: Version which is freed.
+ */
+void free_tile_version(TileVersion* version) {
+    if (!is_snapshot_memory(version->values)) {
+        free(version->values);
+    }
+    free(version);
+    views.num_versions--;
+}
+
+/*
+ * Frees the versions of tiles which no open view can read any more, in the order they were replaced. A version is only
+ * read by the views opened before it was replaced.
+ */
+void reclaim_tile_versions() {
+    uint64_t oldest = get_oldest_view_epoch();
+    while (views.oldest_retired != NULL && views.oldest_retired->last_epoch <= oldest) {
+        TileVersion* version = views.oldest_retired;
+        views.oldest_retired = version->next_retired;
+        //Versions are replaced in order, so this is the oldest version of its tile, and is unlinked from the newer one.
+        //No view still reads the link, since every view which could reach it was opened before the version's epoch.
+        if (version->newer == NULL) {
+            atomic_store_explicit(&sheet.versions[version->tile], NULL, memory_order_release);
+        } else {
+            version->newer->older = NULL;
+        }
+        free_tile_version(version);
+    }
+    if (views.oldest_retired == NULL) {
+        views.newest_retired = NULL;
+    }
+}
+
+/*
+ * Frees the versions of tiles kept for views which have been closed, and stops copying tiles once every view has been
+ * closed.
+ */
+void release_closed_views() {
+    reclaim_tile_versions();
+    if (get_oldest_view_epoch() == UINT64_MAX) {
+        views.newest_epoch = 0;
+    }
+}
+
+/*
+ * Frees every version of the values of tiles and closes every view, since the spreadsheet they view is being freed.
+ */
+void free_tile_versions() {
+    while (views.oldest_retired != NULL) {
+        TileVersion* version = views.oldest_retired;
+        views.oldest_retired = version->next_retired;
+        free_tile_version(version);
+    }
+    views.newest_retired = NULL;
+    for (int i = 0; i < MAX_SHEET_VIEWS; i++) {
+        atomic_store_explicit(&views.slots[i].epoch, 0, memory_order_relaxed);
+    }
+    views.newest_epoch = 0;
+}
+
+/*
+ * Retrieves the values of a tile so that they can be written to, allocating them if the tile has none. If an open view
+ * can read the current values, they are replaced by a copy first, and kept as a version of the tile until every view
+ * which can read them has been closed. Each tile is copied at most once per view, since the copy is only read by
+ * views opened after it.
+ * This is only called from the thread which edits the spreadsheet.
+ * index: Index of the tile.
+ * return: Pointer to the values, or NULL if the tile had none and the memory allocation failed. If only the copy
+ * couldn't be allocated, the current values are returned, and the open views may see the edits made to them.
+ */
+TileValues* get_tile_values_for_writing(int index) {
+    TileValues* values = sheet.values[index];
+    uint64_t first_epoch = atomic_load_explicit(&sheet.value_epochs[index], memory_order_relaxed);
+    if (views.newest_epoch != 0 && first_epoch <= views.newest_epoch) {
+        release_closed_views();
+    }
+    if (views.newest_epoch == 0 || first_epoch > views.newest_epoch) {
+        if (values == NULL) {
+            values = calloc(1, sizeof(TileValues));
+            sheet.values[index] = values;
+        }
+        return values;
+    }
+
+    TileValues* copy = values == NULL ? calloc(1, sizeof(TileValues)) : malloc(sizeof(TileValues));
+    TileVersion* version = malloc(sizeof(TileVersion));
+    //Checks if the memory allocation was successful. Otherwise the values are written in place, and are marked as
+    //newer than the open views so that the workers never try to copy them.
+    if (copy == NULL || version == NULL) {
+        free(copy);
+        free(version);
+        atomic_store_explicit(&sheet.value_epochs[index], views.epoch + 1, memory_order_relaxed);
+        return values;
+    }
+    if (values != NULL) {
+        memcpy(copy, values, sizeof(TileValues));
+    }
+    version->values = values;
+    version->first_epoch = first_epoch;
+    version->last_epoch = views.epoch + 1;
+    version->older = atomic_load_explicit(&sheet.versions[index], memory_order_relaxed);
+    version->newer = NULL;
+    version->next_retired = NULL;
+    version->tile = index;
+    if (version->older != NULL) {
+        version->older->newer = version;
+    }
+    if (views.newest_retired == NULL) {
+        views.oldest_retired = version;
+    } else {
+        views.newest_retired->next_retired = version;
+    }
+    views.newest_retired = version;
+    views.num_versions++;
+
+    //Publishes the version before the new values, so that a view which sees either the new epoch or the new values
+    //finds the version it reads.
+    atomic_store_explicit(&sheet.versions[index], version, memory_order_release);
+    atomic_store_explicit(&sheet.value_epochs[index], views.epoch + 1, memory_order_release);
+    atomic_store_explicit(&sheet.values[index], copy, memory_order_release);
+    return copy;
+}
+
+/*
+ * Retrieves the values a view reads for a tile, which are those the tile held in the epoch the view was opened in.
+ * This can be called from any thread while the view is open.
+ * view: View of the spreadsheet.
+ * index: Index of the tile.
+ * return: Pointer to the values, or NULL if the tile held none.
+ */
+const TileValues* get_view_tile_values(SheetView* view, int index) {
+    uint64_t epoch = atomic_load_explicit(&view->epoch, memory_order_relaxed);
+    //Reads the current values if they were held in the epoch of the view, checking that they weren't replaced in
+    //between, since the epoch is replaced before the values.
+    uint64_t first_epoch = atomic_load_explicit(&sheet.value_epochs[index], memory_order_acquire);
+    if (first_epoch <= epoch) {
+        TileValues* values = atomic_load_explicit(&sheet.values[index], memory_order_acquire);
+        if (atomic_load_explicit(&sheet.value_epochs[index], memory_order_acquire) == first_epoch) {
+            return values;
+        }
+    }
+    //Otherwise finds the newest version which was held in the epoch of the view.
+    TileVersion* version = atomic_load_explicit(&sheet.versions[index], memory_order_acquire);
+    while (version != NULL && version->first_epoch > epoch) {
+        version = version->older;
+    }
+    return version == NULL ? NULL : version->values;
+}
+
+/*
+ * Allocates a tile, with every cell starting as empty text without any dependents. The values of the tile are also
+ * allocated, unless they are already in a snapshot.
+ * index: Index of the tile.
+ * return: Pointer to the tile, or NULL if the memory allocation failed.
+ */
+Tile* allocate_tile(int index) {
+    Tile* tile = calloc(1, sizeof(Tile));
+    //Checks if the memory allocation was successful.
+    if (tile == NULL) {
+        return NULL;
+    }
+    if (sheet.values[index] == NULL) {
+        //Checks if the memory allocation was successful.
+        if (get_tile_values_for_writing(index) == NULL) {
+            free(tile);
+            return NULL;
+        }
+    }
+    //Records the position of each cell, so that it can be found from a pointer to the cell.
+    int first_row = (index / sheet.tile_cols) * TILE_ROWS;
+    int first_col = (index % sheet.tile_cols) * TILE_COLS;
+    for (int i = 0; i < TILE_ROWS; i++) {
+        for (int j = 0; j < TILE_COLS; j++) {
+            tile->cells[i][j].type = TEXT;
+            tile->cells[i][j].value.text = 0;
+            tile->cells[i][j].row = first_row + i;
+            tile->cells[i][j].col = first_col + j;
+        }
+    }
+    sheet.tiles[index] = tile;
+    sheet.num_tiles++;
+    return tile;
+}
+
+Tile* load_snapshot_tile(int index);
+
+/*
+ * Retrieves a tile of the spreadsheet without allocating it. A tile in the snapshot the spreadsheet was loaded from has
+ * its cells loaded the first time it is retrieved.
+ * index: Index of the tile.
+ * return: Pointer to the tile, or NULL if the tile has never been written to.
+ */
+Tile* get_tile(int index) {
+    Tile* tile = sheet.tiles[index];
+    if (tile == NULL && snapshot.data != NULL && snapshot.tiles[index].cells_offset != 0) {
+        tile = load_snapshot_tile(index);
+    }
+    return tile;
+}
+
+/*
+ * Retrieves a cell from the spreadsheet without allocating its tile.
+ * row: Row of the cell.
+ * col: Column of the cell.
+ * return: Pointer to the cell, or NULL if the cell is out of bounds or its tile has never been written to.
+ */
+Cell* get_cell(int row, int col) {
+    //Checks if the cell is out of bounds.
+    if (row < 0 || row >= sheet.num_rows || col < 0 || col >= sheet.num_cols) {
+        return NULL;
+    }
+    //Looks up the tile which contains the cell.
+    Tile* tile = get_tile((row / TILE_ROWS) * sheet.tile_cols + col / TILE_COLS);
+    if (tile == NULL) {
+        return NULL;
+    }
+    return &tile->cells[row % TILE_ROWS][col % TILE_COLS];
+}
+
+/*
+ * Retrieves a cell from the spreadsheet so that it can be written to, allocating its tile if necessary.
+ * row: Row of the cell.
+ * col: Column of the cell.
+ * return: Pointer to the cell, or NULL if the cell is out of bounds or the tile couldn't be allocated.
+ */
+Cell* get_cell_for_writing(int row, int col) {
+    //Checks if the cell is out of bounds.
+    if (row < 0 || row >= sheet.num_rows || col < 0 || col >= sheet.num_cols) {
+        return NULL;
+    }
+    //Looks up the tile which contains the cell, and allocates it if it has never been written to.
+    int index = (row / TILE_ROWS) * sheet.tile_cols + col / TILE_COLS;
+    Tile* tile = get_tile(index);
+    if (tile == NULL) {
+        tile = allocate_tile(index);
+        //Checks if the memory allocation was successful.
+        if (tile == NULL) {
+            return NULL;
+        }
+    }
+    return &tile->cells[row % TILE_ROWS][col % TILE_COLS];
+}
+
+/*
+ * Finds the index of the tile which contains a cell.
+ * cell: Cell whose tile is found.
+ * return: Index of the tile.
+ */
+int get_cell_tile_index(Cell* cell) {
+    return (cell->row / TILE_ROWS) * sheet.tile_cols + cell->col / TILE_COLS;
+}
+
+/*
+ * Retrieves the values of the tile which contains a cell.
+ * cell: Cell whose tile values are retrieved.
+ * return: Pointer to the values.
+ */
+TileValues* get_cell_values(Cell* cell) {
+    return sheet.values[get_cell_tile_index(cell)];
+}
+
+/*
+ * Stores the value of a cell in the columns of its tile.
+ * cell: Cell whose value is stored.
+ * kind: Kind of value the cell holds.
+ * number: Numeric value of the cell, or the CellError formulas reading it get if the kind is VALUE_ERROR. It is only
+ * used for those two kinds.
+ */
+void set_column_value(Cell* cell, ValueKind kind, double number) {
+    //Only looks for open views if any might be open, since edits are otherwise made in place.
+    TileValues* values = views.newest_epoch == 0 ? get_cell_values(cell) :
+                         get_tile_values_for_writing(get_cell_tile_index(cell));
+    values->kinds[cell->col % TILE_COLS][cell->row % TILE_ROWS] = (unsigned char) kind;
+    values->numbers[cell->col % TILE_COLS][cell->row % TILE_ROWS] =
+            kind == VALUE_NUMBER || kind == VALUE_ERROR ? number : 0.0;
+}
+
+/*
+ * Retrieves the kind of value stored for a cell in the columns of its tile.
+ * cell: Cell whose kind of value is retrieved.
+ * return: Kind of value the cell holds.
+ */
+ValueKind get_column_kind(Cell* cell) {
+    return (ValueKind) get_cell_values(cell)->kinds[cell->col % TILE_COLS][cell->row % TILE_ROWS];
+}
+
+/*
+ * Retrieves the numeric value stored for a cell in the columns of its tile.
+ * cell: Cell whose numeric value is retrieved.
+ * return: Numeric value of the cell, or 0 if it doesn't hold a number.
+ */
+double get_column_number(Cell* cell) {
+    return get_cell_values(cell)->numbers[cell->col % TILE_COLS][cell->row % TILE_ROWS];
+}
+
+/*
+ * Resolves the position of a cell to where its value is stored in the tile columns.
+ * row: Row of the cell.
+ * col: Column of the cell.
+ * return: Reference to the cell.
+ */
+CellReference make_cell_reference(int row, int col) {
+    CellReference reference;
+    reference.tile = (row / TILE_ROWS) * sheet.tile_cols + col / TILE_COLS;
+    reference.slot = (col % TILE_COLS) * TILE_ROWS + row % TILE_ROWS;
+    return reference;
+}
+
+/*
+ * Determines the position of a referenced cell.
+ * reference: Reference to the cell.
+ * row: Set to the row of the cell.
+ * col: Set to the column of the cell.
+ */
+void get_reference_position(CellReference reference, int* row, int* col) {
+    *row = (reference.tile / sheet.tile_cols) * TILE_ROWS + reference.slot % TILE_ROWS;
+    *col = (reference.tile % sheet.tile_cols) * TILE_COLS + reference.slot / TILE_ROWS;
+}
+
+/*
+ * Retrieves a referenced cell.
+ * reference: Reference to the cell.
+ * return: Pointer to the cell, or NULL if its tile has never been written to.
+ */
+Cell* get_reference_cell(CellReference reference) {
+    Tile* tile = get_tile(reference.tile);
+    if (tile == NULL) {
+        return NULL;
+    }
+    return &tile->cells[reference.slot % TILE_ROWS][reference.slot / TILE_ROWS];
+}
+
+/*
+ * Reads a cell reference from the start of a string, and determines the row and column of the cell.
+ * text: String starting with the reference. ie, A1, B2, AA10, etc.
+ * row: Set to the row of the cell.
+ * col: Set to the column of the cell.
+ * return: Pointer to the first character after the reference, or NULL if there isn't a valid reference within the
+ * spreadsheet.
+ */
+const char* scan_cell_reference(const char* text, int* row, int* col) {
+    //Checks if the first character of the reference is an uppercase letter.
+    if (text == NULL || text[0] < 'A' || text[0] > 'Z') {
+        return NULL;
+    }
+    //Determines the column index from the letters of the reference, where A is 1, Z is 26 and AA is 27.
+    //The letters are all read even once the column is out of bounds, so that the whole reference is skipped.
+    long column = 0;
+    const char* letter = text;
+    while (*letter >= 'A' && *letter <= 'Z') {
+        if (column <= sheet.num_cols) {
+            column = column * 26 + (*letter - 'A' + 1);
+        }
+        letter++;
+    }
+
+    //Determines the row index from the digits following the letters.
+    long row_number = 0;
+    const char* digit = letter;
+    while (*digit >= '0' && *digit <= '9') {
+        if (row_number <= sheet.num_rows) {
+            row_number = row_number * 10 + (*digit - '0');
+        }
+        digit++;
+    }
+    //Checks if there are no digits or if the row or column is out of bounds.
+    if (digit == letter || row_number < 1 || row_number > sheet.num_rows || column > sheet.num_cols) {
+        return NULL;
+    }
+
+    //Subtract 1 because row and column numbers start from 1 but indices start from 0
+    *row = (int) row_number - 1;
+    *col = (int) column - 1;
+    return digit;
+}
+
+/*
+ * Determines the row and column of a cell from its reference.
+ * reference: Reference of the cell. ie, A1, B2, AA10, etc.
+ * row: Set to the row of the cell.
+ * col: Set to the column of the cell.
+ * return: 1 if the reference is valid and within the spreadsheet, otherwise 0.
+ */
+int parse_cell_reference(const char* reference, int* row, int* col) {
+    const char* end = scan_cell_reference(reference, row, col);
+    //Checks that nothing follows the reference.
+    return end != NULL && *end == '\0';
+}
+
+/*
+ * Retrieve a cell from the spreadsheet by its reference.
+ * reference: Reference of the cell. ie, A1, B2, AA10, etc.
+ * Return: Pointer to the cell.
+ */
+Cell* get_cell_by_reference(char* reference) {
+    int row;
+    int col;
+    if (!parse_cell_reference(reference, &row, &col)) {
+        return NULL;
+    }
+
+    //Returns a pointer to the cell.
+    return get_cell_for_writing(row, col);
+}
+
+/*
+ * Writes the reference of a position in the spreadsheet into a buffer, without allocating any memory.
+ * row: Row of the position.
+ * col: Column of the position.
+ * reference: Buffer with room for MAX_REFERENCE_LENGTH characters and a null terminator.
+ * Return: Length of the reference, not counting the null terminator.
+ */
+int write_position_reference(int row, int col, char* reference) {
+    //Writes the column letters backwards, where A is 1, Z is 26 and AA is 27.
+    char letters[8];
+    int num_letters = 0;
+    for (int column = col + 1; column > 0; column = (column - 1) / 26) {
+        letters[num_letters++] = (char) ('A' + (column - 1) % 26);
+    }
+    //Writes the digits of the row number backwards.
+    char digits[10];
+    int num_digits = 0;
+    for (unsigned int number = (unsigned int) row + 1; number > 0; number /= 10) {
+        digits[num_digits++] = (char) ('0' + number % 10);
+    }
+
+    //Adds the column and row to the reference in the right order.
+    int length = 0;
+    for (int i = num_letters - 1; i >= 0; i--) {
+        reference[length++] = letters[i];
+    }
+    for (int i = num_digits - 1; i >= 0; i--) {
+        reference[length++] = digits[i];
+    }
+    reference[length] = '\0';
+    return length;
+}
+
+/*
+ * Creates the reference of a position in the spreadsheet.
+ * row: Row of the position.
+ * col: Column of the position.
+ * Return: String containing the reference. ie, A1, B2, AA10, etc.
+ */
+char* get_position_reference(int row, int col) {
+    char buffer[MAX_REFERENCE_LENGTH + 1];
+    int length = write_position_reference(row, col, buffer);
+
+    //Creates string to store reference, with room for the reference and a null terminator.
+    char* reference = malloc(length + 1);
+    //Checks if the reference is NULL.
+    if (reference == NULL) {
+        return NULL;
+    }
+    memcpy(reference, buffer, length + 1);
+
+    //Returns string containing the cell reference
+    return reference;
+}
+
+/*
+ * Retrieve a cell from the spreadsheet by its row and column.
+ * cell: cell which will be found
+ * Return: Pointer to the cell.
+ */
+char* get_cell_reference(Cell* cell) {
+    return get_position_reference(cell->row, cell->col);
+}
+
+/*
+ * Determines the row and column of a cell in the spreadsheet.
+ * cell: Cell whose position is determined.
+ * row: Set to the row of the cell.
+ * col: Set to the column of the cell.
+ */
+void get_cell_position(Cell* cell, ROW* row, COL* col) {
+    *row = cell->row;
+    *col = cell->col;
+}
+
+/*
+ * Grows the scratch arrays used while recalculating so that they have room for at least one more cell.
+ * size: Number of cells currently in the arrays.
+ * return: 1 if the arrays have room for another cell, otherwise 0.
+ */
+int ensure_recalc_capacity(int size) {
+    if (size < recalc_capacity) {
+        return 1;
+    }
+    int capacity = recalc_capacity == 0 ? 64 : recalc_capacity * 2;
+    Cell** cells = realloc(recalc_cells, capacity * sizeof(Cell*));
+    if (cells == NULL) {
+        return 0;
+    }
+    recalc_cells = cells;
+    Cell** ready = realloc(recalc_ready, capacity * sizeof(Cell*));
+    if (ready == NULL) {
+        return 0;
+    }
+    recalc_ready = ready;
+    recalc_capacity = capacity;
+    return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Retrieves the cell references of a formula, which are stored after its constants.
+ */
+CellReference* get_formula_references(Formula* formula) {
+    return (CellReference*) (formula->constants + formula->num_constants);
+}
+
+/*
+ * Retrieves the range functions of a formula, which are stored after its cell references.
+ */
+RangeFunction* get_formula_ranges(Formula* formula) {
+    return (RangeFunction*) (get_formula_references(formula) + formula->num_references);
+}
+
+/*
+ * Retrieves the instructions of a formula, which are stored after its range functions.
+ */
+unsigned char* get_formula_code(Formula* formula) {
+    return (unsigned char*) (get_formula_ranges(formula) + formula->num_ranges);
+}
+
+/*
+ * Retrieves the text of a formula, which is stored after its instructions.
+ */
+char* get_formula_text(Formula* formula) {
+    return (char*) (get_formula_code(formula) + formula->num_instructions);
+}
+
+/*
+ * Determines how many bytes a formula was allocated with.
+ * formula: Formula whose size is determined.
+ * return: Size of the formula, including its operands, instructions and text.
+ */
+size_t get_formula_size(Formula* formula) {
+    return (size_t) (get_formula_text(formula) - (char*) formula) + formula->text_length + 1;
+}
+
+/*
+ * Counts the cells a formula reads, counting each cell of its ranges.
+ * formula: Formula whose cells are counted, or NULL.
+ * return: Number of cells read by the formula.
+ */
+size_t get_formula_fan_in(Formula* formula) {
+    if (formula == NULL) {
+        return 0;
+    }
+    size_t count = (size_t) formula->num_references;
+    RangeFunction* ranges = get_formula_ranges(formula);
+    for (int i = 0; i < formula->num_ranges; i++) {
+        Range* range = &ranges[i].range;
+        count += (size_t) (range->last_row - range->first_row + 1) * (range->last_col - range->first_col + 1);
+    }
+    return count;
+}
+
+/*
+ * Records that the formula failed to parse. Only the first error is kept, since it is the one closest to the cause.
+ * parser: Parser of the formula.
+ * position: Character where the error was found.
+ * return: Always 0, so that it can be returned by the function which found the error.
+ */
+int parse_error(Parser* parser, const char* position) {
+    if (parser->error == NULL) {
+        parser->error = position;
+    }
+    return 0;
+}
+
+/*
+ * Skips the spaces between the tokens of a formula, and returns the next character.
+ * parser: Parser of the formula.
+ * return: Next character which isn't a space.
+ */
+char peek_token(Parser* parser) {
+    while (*parser->position == ' ') {
+        parser->position++;
+    }
+    return *parser->position;
+}
+
+/*
+ * Adds an instruction to the formula being compiled.
+ * parser: Parser of the formula.
+ * instruction: Instruction which is added.
+ * return: 1 if the instruction was added, or 0 if it would make the stack too deep.
+ */
+int emit_instruction(Parser* parser, Instruction instruction) {
+    //Tracks how many values are left on the stack, since the evaluator has room for a fixed number of them.
+    if (instruction == PUSH_CONSTANT || instruction == LOAD_CELL || instruction == AGGREGATE) {
+        parser->depth++;
+    } else if (instruction != NEGATE) {
+        parser->depth--;
+    }
+    if (parser->depth > MAX_STACK_DEPTH) {
+        return parse_error(parser, parser->position);
+    }
+    //Only writes the instruction once the formula has been allocated.
+    if (parser->formula != NULL) {
+        get_formula_code(parser->formula)[parser->num_instructions] = (unsigned char) instruction;
+    }
+    parser->num_instructions++;
+    return 1;
+}
+
+/*
+ * Adds an instruction which pushes a constant to the formula being compiled.
+ * parser: Parser of the formula.
+ * constant: Constant which is pushed.
+ * return: 1 if the instruction was added, otherwise 0.
+ */
+int emit_constant(Parser* parser, double constant) {
+    if (parser->formula != NULL) {
+        parser->formula->constants[parser->num_constants] = constant;
+    }
+    parser->num_constants++;
+    return emit_instruction(parser, PUSH_CONSTANT);
+}
+
+/*
+ * Adds an instruction which pushes the value of a cell to the formula being compiled.
+ * parser: Parser of the formula.
+ * row: Row of the cell.
+ * col: Column of the cell.
+ * return: 1 if the instruction was added, otherwise 0.
+ */
+int emit_cell_reference(Parser* parser, int row, int col) {
+    if (parser->formula != NULL) {
+        get_formula_references(parser->formula)[parser->num_references] = make_cell_reference(row, col);
+    }
+    parser->num_references++;
+    return emit_instruction(parser, LOAD_CELL);
+}
+
+/*
+ * Adds an instruction which applies an aggregate function to a range of cells to the formula being compiled.
+ * parser: Parser of the formula.
+ * function: Aggregate function which is applied.
+ * range: Range of cells the function is applied to.
+ * return: 1 if the instruction was added, otherwise 0.
+ */
+int emit_range_function(Parser* parser, AggregateFunction function, Range range) {
+    if (parser->formula != NULL) {
+        RangeFunction* term = &get_formula_ranges(parser->formula)[parser->num_ranges];
+        term->function = function;
+        term->range = range;
+    }
+    parser->num_ranges++;
+    return emit_instruction(parser, AGGREGATE);
+}
+
+int parse_expression(Parser* parser);
+
+/*
+ * Parses the arguments of an aggregate function, which are a range of cells in brackets, and compiles the function.
+ * ie, (A1:A10) or (B2).
+ * parser: Parser of the formula, positioned at the opening bracket.
+ * function: Aggregate function which is applied to the range.
+ * return: 1 if the arguments were parsed successfully, otherwise 0.
+ */
+int parse_range_arguments(Parser* parser, AggregateFunction function) {
+    //Skips the opening bracket.
+    parser->position++;
+
+    //Reads the first cell of the range.
+    int first_row, first_col;
+    peek_token(parser);
+    const char* end = scan_cell_reference(parser->position, &first_row, &first_col);
+    if (end == NULL) {
+        return parse_error(parser, parser->position);
+    }
+    parser->position = end;
+
+    //Reads the last cell of the range. A single cell is treated as a range containing only that cell.
+    int last_row = first_row, last_col = first_col;
+    if (peek_token(parser) == ':') {
+        parser->position++;
+        peek_token(parser);
+        end = scan_cell_reference(parser->position, &last_row, &last_col);
+        if (end == NULL) {
+            return parse_error(parser, parser->position);
+        }
+        parser->position = end;
+    }
+    if (peek_token(parser) != ')') {
+        return parse_error(parser, parser->position);
+    }
+    parser->position++;
+
+    //Orders the corners of the range, so that ranges such as B10:A1 work too.
+    Range range;
+    range.first_row = first_row < last_row ? first_row : last_row;
+    range.last_row = first_row < last_row ? last_row : first_row;
+    range.first_col = first_col < last_col ? first_col : last_col;
+    range.last_col = first_col < last_col ? last_col : first_col;
+    return emit_range_function(parser, function, range);
+}
+
+/*
+ * Parses a single operand, which is a number, a cell reference, a function call or an expression in brackets.
+ * ie, 1.4, A1, SUM(A1:A10) or (A1+2).
+ * parser: Parser of the formula.
+ * return: 1 if the operand was parsed successfully, otherwise 0.
+ */
+int parse_operand(Parser* parser) {
+    char next = peek_token(parser);
+    const char* start = parser->position;
+
+    //Checks if the operand is an expression in brackets.
+    if (next == '(') {
+        parser->position++;
+        if (!parse_expression(parser)) {
+            return 0;
+        }
+        if (peek_token(parser) != ')') {
+            return parse_error(parser, parser->position);
+        }
+        parser->position++;
+        return 1;
+    }
+
+    //Checks if the operand is a number.
+    if ((next >= '0' && next <= '9') || next == '.') {
+        char* end;
+        double number = parse_number(start, &end);
+        if (end == start) {
+            return parse_error(parser, start);
+        }
+        parser->position = end;
+        return emit_constant(parser, number);
+    }
+
+    //Checks if the operand is a cell reference or a function, which both start with a name in capitals.
+    if (next >= 'A' && next <= 'Z') {
+        const char* name_end = start;
+        while (*name_end >= 'A' && *name_end <= 'Z') {
+            name_end++;
+        }
+        //A name followed by a bracket is a function call.
+        if (*name_end == '(') {
+            //Looks up the function by its name.
+            size_t length = (size_t) (name_end - start);
+            for (int i = NO_FUNCTION + 1; i < NUM_FUNCTIONS; i++) {
+                if (strlen(function_names[i]) == length && strncmp(start, function_names[i], length) == 0) {
+                    parser->position = name_end;
+                    return parse_range_arguments(parser, (AggregateFunction) i);
+                }
+            }
+            return parse_error(parser, start);
+        }
+        //Otherwise the operand is a cell reference.
+        int row, col;
+        const char* end = scan_cell_reference(start, &row, &col);
+        if (end == NULL) {
+            return parse_error(parser, start);
+        }
+        parser->position = end;
+        return emit_cell_reference(parser, row, col);
+    }
+
+    //Anything else can't start an operand.
+    return parse_error(parser, start);
+}
+
+/*
+ * Parses an operand with any number of signs in front of it. ie, -A1 or --2.
+ * parser: Parser of the formula.
+ * return: 1 if the operand was parsed successfully, otherwise 0.
+ */
+int parse_unary(Parser* parser) {
+    //Limits how deeply the parser recurses, so that a formula can't overflow the stack of the program.
+    if (parser->nesting >= MAX_NESTING_DEPTH) {
+        return parse_error(parser, parser->position);
+    }
+    parser->nesting++;
+
+    int parsed;
+    char next = peek_token(parser);
+    //Checks if the operand is negated.
+    if (next == '-') {
+        parser->position++;
+        parsed = parse_unary(parser) && emit_instruction(parser, NEGATE);
+    }
+        //A plus sign leaves the operand unchanged.
+    else if (next == '+') {
+        parser->position++;
+        parsed = parse_unary(parser);
+    } else {
+        parsed = parse_operand(parser);
+    }
+
+    parser->nesting--;
+    return parsed;
+}
+
+/*
+ * Parses operands which are multiplied or divided together. ie, A1*2/B1.
+ * parser: Parser of the formula.
+ * return: 1 if the operands were parsed successfully, otherwise 0.
+ */
+int parse_product(Parser* parser) {
+    if (!parse_unary(parser)) {
+        return 0;
+    }
+    //Parses each following operand, applying the operations from left to right.
+    char next = peek_token(parser);
+    while (next == '*' || next == '/') {
+        parser->position++;
+        if (!parse_unary(parser) || !emit_instruction(parser, next == '*' ? MULTIPLY : DIVIDE)) {
+            return 0;
+        }
+        next = peek_token(parser);
+    }
+    return 1;
+}
+
+/*
+ * Parses products which are added or subtracted together. ie, A1+2*B1-C1.
+ * parser: Parser of the formula.
+ * return: 1 if the expression was parsed successfully, otherwise 0.
+ */
+int parse_expression(Parser* parser) {
+    if (!parse_product(parser)) {
+        return 0;
+    }
+    //Parses each following product, applying the operations from left to right.
+    char next = peek_token(parser);
+    while (next == '+' || next == '-') {
+        parser->position++;
+        if (!parse_product(parser) || !emit_instruction(parser, next == '+' ? ADD : SUBTRACT)) {
+            return 0;
+        }
+        next = peek_token(parser);
+    }
+    return 1;
+}
+
+/*
+ * Parses the text of a formula, and compiles it into the formula of the parser if it has one.
+ * parser: Parser of the formula, which is reset before parsing.
+ * return: 1 if the formula was parsed successfully, otherwise 0.
+ */
+int parse_formula(Parser* parser) {
+    //Starts after the '=' with an empty program.
+    parser->position = parser->text + 1;
+    parser->num_instructions = 0;
+    parser->num_constants = 0;
+    parser->num_references = 0;
+    parser->num_ranges = 0;
+    parser->depth = 0;
+    parser->nesting = 0;
+    parser->error = NULL;
+
+    if (!parse_expression(parser)) {
+        return 0;
+    }
+    //Checks that the whole formula has been parsed.
+    if (peek_token(parser) != '\0') {
+        return parse_error(parser, parser->position);
+    }
+    return 1;
+}
+
+/*
+ * Struct to represent text written in front of an operand when a formula is converted to text.
+ * text: Sign, operator or brackets which are written. ie, -, )*( or (.
+ * next: Index of the next text written in front of the same operand, or -1 if there is none.
+ */
+typedef struct {
+    char text[4];
+    int next;
+} FormulaAffix;
+
+/*
+ * Struct to represent what is written around an operand when a formula is converted to text.
+ * first_affix: Index of the first text written in front of the operand, or -1 if there is none.
+ * num_closing: Number of closing brackets written after the operand.
+ */
+typedef struct {
+    int first_affix;
+    int num_closing;
+} OperandAffixes;
+
+/*
+ * Writes a single operand of a formula, which is a constant, a cell reference or a function applied to a range.
+ * instruction: Instruction which pushes the operand.
+ * constants: Next constant of the formula, which is moved along if the operand is a constant.
+ * references: Next cell reference of the formula, which is moved along if the operand is a cell reference.
+ * ranges: Next range function of the formula, which is moved along if the operand is a range function.
+ * text: Buffer with room for MAX_OPERAND_LENGTH characters and a null terminator.
+ * return: Length of the operand.
+ */
+size_t write_formula_operand(Instruction instruction, const double** constants, const CellReference** references,
+                             const RangeFunction** ranges, char* text) {
+    //If the operand is a cell reference, it writes the cell reference.
+    if (instruction == LOAD_CELL) {
+        int row, col;
+        get_reference_position(*(*references)++, &row, &col);
+        return (size_t) write_position_reference(row, col, text);
+    }
+        //If the operand applies a function to a range, it writes the function and the range.
+    else if (instruction == AGGREGATE) {
+        const RangeFunction* term = (*ranges)++;
+        size_t length = strlen(function_names[term->function]);
+        memcpy(text, function_names[term->function], length);
+        text[length++] = '(';
+        length += write_position_reference(term->range.first_row, term->range.first_col, text + length);
+        //The last cell of the range is only written if the range contains more than one cell.
+        if (term->range.last_row != term->range.first_row || term->range.last_col != term->range.first_col) {
+            text[length++] = ':';
+            length += write_position_reference(term->range.last_row, term->range.last_col, text + length);
+        }
+        text[length++] = ')';
+        text[length] = '\0';
+        return length;
+    }
+    //Otherwise it writes the constant, which reads back as exactly the same constant.
+    return format_number(*(*constants)++, text, NUMBER_MAX_LENGTH);
+}
+
+/*
+ * Writes the text of a compiled formula.
+ * The operands are written in the order the evaluator takes them, which is the order they appear in the text. Each
+ * sign, operator and opening bracket is written in front of the first operand of the values it applies to, and each
+ * closing bracket after the last one, so the instructions are walked once to find what goes around each operand and
+ * then the operands are written from left to right. Brackets are only added where they are needed to keep the same
+ * order of operations.
+ * formula: Formula which parsed successfully.
+ * text: Buffer with room for MAX_OPERAND_LENGTH characters for each instruction, and two more for the '=' and the null
+ * terminator.
+ * return: Length of the text, not counting the null terminator, or 0 if the memory allocation failed.
+ */
+size_t write_formula_text(Formula* formula, char* text) {
+    //What is written around each operand is kept on the stack, unless the formula is too large for it.
+    int num_operands = formula->num_constants + formula->num_references + formula->num_ranges;
+    OperandAffixes local_operands[FORMULA_AFFIX_BUFFER_SIZE];
+    FormulaAffix local_affixes[2 * FORMULA_AFFIX_BUFFER_SIZE];
+    OperandAffixes* operands = local_operands;
+    FormulaAffix* affixes = local_affixes;
+    if (formula->num_instructions > FORMULA_AFFIX_BUFFER_SIZE) {
+        operands = malloc(num_operands * sizeof(OperandAffixes) +
+                          2 * (size_t) formula->num_instructions * sizeof(FormulaAffix));
+        //Checks if the memory allocation was successful.
+        if (operands == NULL) {
+            return 0;
+        }
+        affixes = (FormulaAffix*) (operands + num_operands);
+    }
+
+    //Index of the first operand of each value on the stack, and how tightly its outermost operator binds.
+    //Operands bind tightest, then negation, then multiplication and division, then addition and subtraction.
+    int firsts[MAX_STACK_DEPTH];
+    int precedences[MAX_STACK_DEPTH];
+    int depth = 0;
+    int operand = 0;
+    int num_affixes = 0;
+
+    //Walks the instructions, taking the values in the same order as the evaluator does.
+    const unsigned char* code = get_formula_code(formula);
+    for (int i = 0; i < formula->num_instructions; i++) {
+        Instruction instruction = (Instruction) code[i];
+        int target;
+        char affix[4];
+
+        //If the instruction pushes an operand, it starts a new value. The operand itself is written later.
+        if (instruction == PUSH_CONSTANT || instruction == LOAD_CELL || instruction == AGGREGATE) {
+            firsts[depth] = operand;
+            precedences[depth] = 4;
+            depth++;
+            operands[operand].first_affix = -1;
+            operands[operand].num_closing = 0;
+            operand++;
+            continue;
+        }
+            //If the instruction negates a value, it writes a minus sign in front of it, with brackets if it needs them.
+        else if (instruction == NEGATE) {
+            int top = depth - 1;
+            int bracketed = precedences[top] < 3;
+            strcpy(affix, bracketed ? "-(" : "-");
+            target = firsts[top];
+            precedences[top] = 3;
+            if (bracketed) {
+                operands[operand - 1].num_closing++;
+            }
+        }
+            //If the instruction combines two values, it writes the operator in front of the right value.
+        else {
+            int left = depth - 2;
+            int right = depth - 1;
+            int precedence = instruction == ADD || instruction == SUBTRACT ? 1 : 2;
+            char symbol = instruction == ADD ? '+' : instruction == SUBTRACT ? '-' : instruction == MULTIPLY ? '*' : '/';
+            //The left value only needs brackets if it binds less tightly than the operator, and the right value needs
+            //them if it binds no more tightly than the operator, since operators of the same precedence are applied
+            //from left to right.
+            int left_bracketed = precedences[left] < precedence;
+            int right_bracketed = precedences[right] <= precedence;
+            int affix_length = 0;
+            if (left_bracketed) {
+                affix[affix_length++] = ')';
+            }
+            affix[affix_length++] = symbol;
+            if (right_bracketed) {
+                affix[affix_length++] = '(';
+                operands[operand - 1].num_closing++;
+            }
+            affix[affix_length] = '\0';
+            target = firsts[right];
+            //The opening bracket of the left value goes in front of it, after anything already written there.
+            if (left_bracketed) {
+                strcpy(affixes[num_affixes].text, "(");
+                affixes[num_affixes].next = operands[firsts[left]].first_affix;
+                operands[firsts[left]].first_affix = num_affixes++;
+            }
+            precedences[left] = precedence;
+            depth--;
+        }
+
+        //Adds the sign or operator in front of the first operand of the value. Text added later is written first,
+        //since it applies to a larger part of the formula.
+        strcpy(affixes[num_affixes].text, affix);
+        affixes[num_affixes].next = operands[target].first_affix;
+        operands[target].first_affix = num_affixes++;
+    }
+
+    //Writes the operands from left to right, with everything which goes around each of them.
+    text[0] = '=';
+    size_t length = 1;
+    operand = 0;
+    const double* constants = formula->constants;
+    const CellReference* references = get_formula_references(formula);
+    const RangeFunction* ranges = get_formula_ranges(formula);
+    for (int i = 0; i < formula->num_instructions; i++) {
+        Instruction instruction = (Instruction) code[i];
+        if (instruction != PUSH_CONSTANT && instruction != LOAD_CELL && instruction != AGGREGATE) {
+            continue;
+        }
+        for (int affix = operands[operand].first_affix; affix >= 0; affix = affixes[affix].next) {
+            for (const char* c = affixes[affix].text; *c != '\0'; c++) {
+                text[length++] = *c;
+            }
+        }
+        length += write_formula_operand(instruction, &constants, &references, &ranges, text + length);
+        for (int closing = 0; closing < operands[operand].num_closing; closing++) {
+            text[length++] = ')';
+        }
+        operand++;
+    }
+    text[length] = '\0';
+
+    if (operands != local_operands) {
+        free(operands);
+    }
+    return length;
+}
+
+/*
+ * Compiles a string into a formula allocated from an arena, without counting it, along with the text it is edited as.
+ * If the string can't be parsed, a formula recording where the error is and the text of the formula is returned
+ * instead. Nothing but the arena is
+ * changed, so several threads can compile formulas at the same time into arenas of their own.
+ * text: String to be compiled, starting with '='. The string isn't modified.
+ * formula_arena: Arena the formula is allocated from.
+ * return: Pointer to the formula, or NULL if the memory allocation failed.
+ */
+Formula* compile_formula(const char* text, Arena* formula_arena) {
+    //Measures the formula without writing anything.
+    Parser parser;
+    parser.text = text;
+    parser.formula = NULL;
+
+    Formula* formula;
+    if (parse_formula(&parser)) {
+        //Allocates the formula with exactly enough room for its operands and instructions.
+        size_t size = sizeof(Formula) + parser.num_constants * sizeof(double) +
+                      parser.num_references * sizeof(CellReference) + parser.num_ranges * sizeof(RangeFunction) +
+                      parser.num_instructions;
+        formula = arena_allocate(formula_arena, size);
+        //Checks if the memory allocation was successful.
+        if (formula == NULL) {
+            return NULL;
+        }
+        formula->num_instructions = parser.num_instructions;
+        formula->num_constants = parser.num_constants;
+        formula->num_references = parser.num_references;
+        formula->num_ranges = parser.num_ranges;
+        formula->error_offset = -1;
+        formula->text_length = 0;
+
+        //Parses the formula again, this time writing the instructions and operands into the formula.
+        parser.formula = formula;
+        parse_formula(&parser);
+
+        //Writes the text of the formula on the stack, or into a temporary string if it is too long for it, and then
+        //moves it after the instructions, where it usually fits in the same block.
+        char local_text[FORMULA_TEXT_BUFFER_SIZE];
+        size_t capacity = 2 + (size_t) formula->num_instructions * MAX_OPERAND_LENGTH;
+        char* formula_text = capacity <= sizeof(local_text) ? local_text : malloc(capacity);
+        size_t text_length = formula_text != NULL ? write_formula_text(formula, formula_text) : 0;
+        Formula* resized = text_length > 0 ? arena_reallocate(formula_arena, formula, size, size + text_length + 1) : NULL;
+        //Checks if the memory allocations were successful.
+        if (resized == NULL) {
+            arena_free(formula_arena, formula, size);
+        } else {
+            formula = resized;
+            formula->text_length = (int) text_length;
+            memcpy(get_formula_text(formula), formula_text, text_length + 1);
+        }
+        if (formula_text != local_text) {
+            free(formula_text);
+        }
+        if (resized == NULL) {
+            return NULL;
+        }
+    } else {
+        //Allocates an empty formula with room for its text.
+        size_t length = strlen(text);
+        formula = arena_allocate(formula_arena, sizeof(Formula) + length + 1);
+        //Checks if the memory allocation was successful.
+        if (formula == NULL) {
+            return NULL;
+        }
+        formula->num_instructions = 0;
+        formula->num_constants = 0;
+        formula->num_references = 0;
+        formula->num_ranges = 0;
+        formula->error_offset = (int) (parser.error - text);
+        formula->text_length = (int) length;
+        memcpy(get_formula_text(formula), text, length + 1);
+    }
+
+    //Returns the formula.
+    return formula;
+}
+
+/*
+ * Converts a string to a formula. If the string can't be parsed, a formula recording where the error is and the text
+ * of the formula is returned instead.
+ * text: String to be converted, starting with '='. The string isn't modified.
+ * return: Pointer to the formula, or NULL if the memory allocation failed.
+ */
+Formula* string_to_formula(const char* text) {
+    Formula* formula = compile_formula(text, &arena);
+    if (formula != NULL) {
+        sheet.num_formulas++;
+    }
+    return formula;
+}
+
+/*
+ * Converts the error cached in the tile columns for a cell back into the error.
+ * number: Number cached for a cell holding an error.
+ * return: Error the number stands for, or NON_NUMERIC_VALUE if it doesn't stand for one, which is only the case in a
+ * damaged snapshot.
+ */
+CellError get_cached_error(double number) {
+    return number > NO_ERROR && number < NUM_CELL_ERRORS ? (CellError) number : NON_NUMERIC_VALUE;
+}
+
+/*
+ * Reads the value of a referenced cell for use in a formula. Formulas must already have been evaluated, so that their
+ * cached result is stored in the tile columns.
+ * reference: Reference to the cell.
+ * value: Set to the value of the cell, if it holds a number.
+ * return: NO_ERROR if the cell holds a number, the error of the cell if it has one, or NON_NUMERIC_VALUE otherwise.
+ */
+CellError get_reference_value(CellReference reference, double* value) {
+    TileValues* values = sheet.values[reference.tile];
+    //Checks if the tile has never been written to, in which case the cell is empty.
+    if (values == NULL) {
+        return NON_NUMERIC_VALUE;
+    }
+    ValueKind kind = (ValueKind) (&values->kinds[0][0])[reference.slot];
+    //Reads the number or cached result of the cell, or the error which is cached in place of the result.
+    if (kind == VALUE_NUMBER) {
+        *value = (&values->numbers[0][0])[reference.slot];
+        return NO_ERROR;
+    }
+    return kind == VALUE_ERROR ? get_cached_error((&values->numbers[0][0])[reference.slot]) : NON_NUMERIC_VALUE;
+}
+
+/*
+ * Finds the error of the cells with an error in part of a column of a tile.
+ * values: Values of the tile containing the cells.
+ * col: Column of the cells within the tile.
+ * first_row: First row of the cells within the tile.
+ * count: Number of cells.
+ * return: CIRCULAR_DEPENDENCY if any of the errors is a circular dependency, so that every cell of a cycle reports it,
+ * or otherwise the error of the first cell with one.
+ */
+CellError get_range_error(TileValues* values, int col, int first_row, int count) {
+    CellError error = NO_ERROR;
+    for (int i = first_row; i < first_row + count; i++) {
+        if (values->kinds[col][i] == VALUE_ERROR) {
+            CellError cell_error = get_cached_error(values->numbers[col][i]);
+            if (cell_error == CIRCULAR_DEPENDENCY) {
+                return cell_error;
+            }
+            if (error == NO_ERROR) {
+                error = cell_error;
+            }
+        }
+    }
+    return error;
+}
+
+/*
+ * Applies an aggregate function to its range of cells.
+ * The range is read one column of one tile at a time, where the numbers are contiguous, so that the work is done by
+ * the vectorized kernels. Tiles which haven't been allocated are empty, and are skipped.
+ * term: Function and range.
+ * result: Set to the result of the function, if there is no error.
+ * return: NO_ERROR, the error of a cell in the range as for get_range_error over the whole range, or DIVISION_BY_ZERO
+ * if there are no numbers to average.
+ */
+CellError evaluate_range(RangeFunction* term, double* result) {
+    CellError error = NO_ERROR;
+    double sum = 0.0;
+    double smallest = INFINITY;
+    double largest = -INFINITY;
+    size_t count = 0;
+
+    for (int col = term->range.first_col; col <= term->range.last_col; col++) {
+        for (int first_row = term->range.first_row; first_row <= term->range.last_row;
+             first_row = first_row - first_row % TILE_ROWS + TILE_ROWS) {
+            //Determines the part of the range which is in the tile containing the first row.
+            int last_row = first_row - first_row % TILE_ROWS + TILE_ROWS - 1;
+            if (last_row > term->range.last_row) {
+                last_row = term->range.last_row;
+            }
+            TileValues* values = sheet.values[(first_row / TILE_ROWS) * sheet.tile_cols + col / TILE_COLS];
+            if (values == NULL) {
+                continue;
+            }
+            int tile_col = col % TILE_COLS;
+            int tile_row = first_row % TILE_ROWS;
+            int length = last_row - first_row + 1;
+            const double* numbers = &values->numbers[tile_col][tile_row];
+            const unsigned char* kinds = &values->kinds[tile_col][tile_row];
+
+            //Checks if any of the cells have an error, which is passed on to the result. The rest of the range is
+            //still read in case it depends on a circular dependency, which is reported instead.
+            if (count_kinds(kinds, length, VALUE_ERROR) > 0) {
+                CellError cell_error = get_range_error(values, tile_col, tile_row, length);
+                if (cell_error == CIRCULAR_DEPENDENCY) {
+                    return cell_error;
+                }
+                if (error == NO_ERROR) {
+                    error = cell_error;
+                }
+                continue;
+            }
+
+            //Non-numeric cells hold 0, so they can be included in the sum.
+            if (term->function == SUM_FUNCTION || term->function == AVERAGE_FUNCTION) {
+                sum += sum_numbers(numbers, length);
+            } else if (term->function == MIN_FUNCTION) {
+                smallest = min_numbers(numbers, kinds, length, VALUE_NUMBER, smallest);
+            } else {
+                largest = max_numbers(numbers, kinds, length, VALUE_NUMBER, largest);
+            }
+            if (term->function != SUM_FUNCTION) {
+                count += count_kinds(kinds, length, VALUE_NUMBER);
+            }
+        }
+    }
+
+    if (error != NO_ERROR) {
+        return error;
+    }
+    if (term->function == SUM_FUNCTION) {
+        *result = sum;
+    } else if (term->function == AVERAGE_FUNCTION) {
+        if (count == 0) {
+            return DIVISION_BY_ZERO;
+        }
+        *result = sum / (double) count;
+    } else if (term->function == MIN_FUNCTION) {
+        //A range without any numbers has a minimum of 0.
+        *result = count == 0 ? 0.0 : smallest;
+    } else {
+        //A range without any numbers has a maximum of 0.
+        *result = count == 0 ? 0.0 : largest;
+    }
+    return NO_ERROR;
+}
+
+/*
+ * Replaces the error found while evaluating a formula with CIRCULAR_DEPENDENCY if any cell the formula reads is part
+ * of, or depends on, a circular dependency, so that every formula depending on a cycle reports it, whichever error it
+ * found first.
+ * formula: Formula which was being evaluated.
+ * error: Error which was found, which is replaced.
+ * return: Always 0, so that it can be returned as the result of the formula.
+ */
+double find_circular_input(Formula* formula, CellError* error) {
+    if (*error == CIRCULAR_DEPENDENCY) {
+        return 0.0;
+    }
+    double value;
+    CellReference* references = get_formula_references(formula);
+    for (int i = 0; i < formula->num_references; i++) {
+        if (get_reference_value(references[i], &value) == CIRCULAR_DEPENDENCY) {
+            *error = CIRCULAR_DEPENDENCY;
+            return 0.0;
+        }
+    }
+    RangeFunction* ranges = get_formula_ranges(formula);
+    for (int i = 0; i < formula->num_ranges; i++) {
+        if (evaluate_range(&ranges[i], &value) == CIRCULAR_DEPENDENCY) {
+            *error = CIRCULAR_DEPENDENCY;
+            return 0.0;
+        }
+    }
+    return 0.0;
+}
+
+/*
+ * Evaluates a formula and determines the answer, by running its instructions on a stack of numbers.
+ * The formulas referenced by the formula must already have been evaluated, so their cached results are used. The
+ * first error found stops the evaluation, and is the error of the formula, unless the formula depends on a circular
+ * dependency, which is reported instead.
+ * formula: Formula to be evaluated.
+ * error: Set to the error of the formula, or NO_ERROR.
+ * return: Result of the formula, or 0 if it has an error.
+ */
+double evaluate_formula(Formula* formula, CellError* error) {
+    //Checks if the formula failed to parse, in which case it has no numeric value.
+    if (formula == NULL || formula->error_offset >= 0) {
+        *error = PARSE_ERROR;
+        return 0.0;
+    }
+
+    //The compiler ensures the formula never needs more than this many values on the stack.
+    double stack[MAX_STACK_DEPTH];
+    int depth = 0;
+    const unsigned char* code = get_formula_code(formula);
+    const double* constants = formula->constants;
+    const CellReference* references = get_formula_references(formula);
+    RangeFunction* ranges = get_formula_ranges(formula);
+
+    //Runs each instruction in turn.
+    for (int i = 0; i < formula->num_instructions; i++) {
+        double value;
+        switch ((Instruction) code[i]) {
+            case PUSH_CONSTANT:
+                stack[depth++] = *constants++;
+                break;
+            case LOAD_CELL:
+                //Reads the number, or the cached result if the cell contains a formula. If the cell doesn't hold a
+                //number, its error is passed on so that it is reported by this formula too.
+                *error = get_reference_value(*references++, &value);
+                if (*error != NO_ERROR) {
+                    return find_circular_input(formula, error);
+                }
+                stack[depth++] = value;
+                break;
+            case AGGREGATE:
+                //Passes on any error in the cells of the range in the same way.
+                *error = evaluate_range(ranges++, &value);
+                if (*error != NO_ERROR) {
+                    return find_circular_input(formula, error);
+                }
+                stack[depth++] = value;
+                break;
+            case ADD:
+                depth--;
+                stack[depth - 1] += stack[depth];
+                break;
+            case SUBTRACT:
+                depth--;
+                stack[depth - 1] -= stack[depth];
+                break;
+            case MULTIPLY:
+                depth--;
+                stack[depth - 1] *= stack[depth];
+                break;
+            case DIVIDE:
+                depth--;
+                if (stack[depth] == 0.0) {
+                    *error = DIVISION_BY_ZERO;
+                    return find_circular_input(formula, error);
+                }
+                stack[depth - 1] /= stack[depth];
+                break;
+            case NEGATE:
+                stack[depth - 1] = -stack[depth - 1];
+                break;
+        }
+    }
+    //Returns the answer, which is the only value left on the stack. A formula without any terms is 0. Infinite answers
+    //are numbers like any other, while answers which aren't numbers at all are errors.
+    double result = depth == 0 ? 0.0 : stack[0];
+    *error = isnan(result) ? INVALID_NUMBER : NO_ERROR;
+    return *error == NO_ERROR ? result : 0.0;
+}
+
+/*
+ * Evaluates the formula of a cell and caches the result. A formula which closes a circular dependency reads its own
+ * result, so it isn't evaluated, and has a circular dependency straight away.
+ * cell: Cell which contains the formula.
+ */
+void evaluate_cell(Cell* cell) {
+    CellError error = CIRCULAR_DEPENDENCY;
+    double result = 0.0;
+    if (!cell->closes_cycle) {
+        COUNT_RECALC_STAT(num_evaluations, 1);
+        COUNT_RECALC_STAT(num_cell_reads, get_formula_fan_in(cell->value.formula));
+        result = evaluate_formula(cell->value.formula, &error);
+    }
+    if (error == CIRCULAR_DEPENDENCY) {
+        COUNT_RECALC_STAT(num_circular, 1);
+    }
+    cell->error = error;
+    //Caches the result in the tile columns, where it is read by the formulas which depend on this cell, or otherwise
+    //the error those formulas get.
+    if (error == NO_ERROR) {
+        set_column_value(cell, VALUE_NUMBER, result);
+    } else {
+        set_column_value(cell, VALUE_ERROR, (double) (error == PARSE_ERROR ? NON_NUMERIC_VALUE : error));
+    }
+    cell->dirty = 0;
+}
+
+/*
+ * Converts a formula to a string.
+ * formula: Formula to be converted.
+ * return: String containing the formula.
+ */
+char* formula_to_string(Formula* formula) {
+    //Allocates memory for the string which will contain the formula and a null terminator.
+    char* text = malloc(formula->text_length + 1);
+
+    //Checks if the memory allocation was successful.
+    if (text == NULL) {
+        return NULL;
+    }
+    memcpy(text, get_formula_text(formula), formula->text_length + 1);
+
+    //Returns the string.
+    return text;
+}
+
+/*
+ * Frees the memory allocated for a formula.
+ * formula: Formula to be freed.
+ */
+void free_formula(Formula* formula) {
+    //Formulas which are still in the snapshot the spreadsheet was loaded from belong to the snapshot.
+    if (formula != NULL && !is_snapshot_memory(formula)) {
+        arena_free(&arena, formula, get_formula_size(formula));
+        sheet.num_formulas--;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Checks if a reference from a snapshot is to a cell within the tiles of the spreadsheet.
+ * reference: Reference which is checked.
+ * return: 1 if the reference is valid, otherwise 0.
+ */
+int is_valid_reference(CellReference reference) {
+    return reference.tile >= 0 && reference.tile < sheet.tile_rows * sheet.tile_cols && reference.slot >= 0 &&
+           reference.slot < TILE_ROWS * TILE_COLS;
+}
+
+/*
+ * Resolves the dependents a cell was loaded with from a snapshot into its dependents array, loading the tiles of the
+ * dependents. This is done the first time the dependents are needed, so that loading a cell doesn't load every cell
+ * which depends on it.
+ * cell: Cell whose dependents are resolved.
+ */
+void resolve_dependents(Cell* cell) {
+    if (cell->stored_dependents == NULL) {
+        return;
+    }
+    const CellReference* stored = cell->stored_dependents;
+    int count = cell->num_dependents;
+    cell->stored_dependents = NULL;
+    cell->num_dependents = 0;
+    cell->dependents = arena_allocate(&arena, count * sizeof(Cell*));
+    //Checks if the memory allocation was successful, otherwise the cell is left without dependents.
+    if (cell->dependents == NULL) {
+        return;
+    }
+    cell->dependents_capacity = count;
+    for (int i = 0; i < count; i++) {
+        Cell* dependent = is_valid_reference(stored[i]) ? get_reference_cell(stored[i]) : NULL;
+        if (dependent != NULL) {
+            cell->dependents[cell->num_dependents++] = dependent;
+        }
+    }
+}
+
+/*
+ * Finds the position of a bucket in the range dependents of a column. The levels below level h hold
+ * 2 * range_buckets - (2 * range_buckets >> h) buckets between them, since each level has half the buckets of the one
+ * below it.
+ * level: Level of the bucket.
+ * tile_row: Row of tiles which the bucket covers.
+ * return: Index of the bucket in the buckets of the column.
+ */
+int get_range_bucket_index(int level, int tile_row) {
+    return 2 * sheet.range_buckets - (2 * sheet.range_buckets >> level) + (tile_row >> level);
+}
+
+/*
+ * Finds the bucket of the range dependents of a column which a range belongs in, allocating the buckets of the column
+ * if it doesn't have any yet.
+ * column: Range dependents of the column.
+ * dependent: Cell which contains the formula, and the rows it aggregates.
+ * bucket_arena: Arena the buckets are allocated from.
+ * return: Bucket for the range, or NULL if the memory couldn't be allocated.
+ */
+RangeBucket* get_range_bucket(ColumnDependents* column, RangeDependent dependent, Arena* bucket_arena) {
+    if (column->buckets == NULL) {
+        size_t size = (size_t) (2 * sheet.range_buckets - 1) * sizeof(RangeBucket);
+        column->buckets = arena_allocate(bucket_arena, size);
+        //Checks if the memory allocation was successful.
+        if (column->buckets == NULL) {
+            return NULL;
+        }
+        memset(column->buckets, 0, size);
+    }
+    //Finds the lowest level with a single bucket covering both the first and the last row.
+    int first_tile_row = dependent.first_row / TILE_ROWS;
+    int last_tile_row = dependent.last_row / TILE_ROWS;
+    int level = 0;
+    while (first_tile_row >> level != last_tile_row >> level) {
+        level++;
+    }
+    return &column->buckets[get_range_bucket_index(level, first_tile_row)];
+}
+
+/*
+ * Adds a formula cell to the range dependents of a column, without resolving the dependents loaded from a snapshot.
+ * column: Range dependents of the column.
+ * dependent: Cell which contains the formula, and the rows it aggregates.
+ */
+void insert_range_dependent(ColumnDependents* column, RangeDependent dependent) {
+    RangeBucket* bucket = get_range_bucket(column, dependent, &arena);
+    //Checks if the memory allocation was successful.
+    if (bucket == NULL) {
+        return;
+    }
+    //Grows the dependents array of the bucket if it is full.
+    if (bucket->num_dependents == bucket->dependents_capacity) {
+        int capacity = bucket->dependents_capacity == 0 ? 4 : bucket->dependents_capacity * 2;
+        RangeDependent* dependents = arena_reallocate(&arena, bucket->dependents,
+                                                      bucket->dependents_capacity * sizeof(RangeDependent),
+                                                      capacity * sizeof(RangeDependent));
+        //Checks if the memory allocation was successful.
+        if (dependents == NULL) {
+            return;
+        }
+        bucket->dependents = dependents;
+        bucket->dependents_capacity = capacity;
+    }
+    //Adds the dependent to the end of the array.
+    bucket->dependents[bucket->num_dependents++] = dependent;
+    column->num_dependents++;
+}
+
+/*
+ * Resolves the range dependents a column was loaded with from a snapshot into its buckets, loading the tiles of the
+ * dependents.
+ * column: Range dependents of the column.
+ */
+void resolve_column_dependents(ColumnDependents* column) {
+    if (column->stored_dependents == NULL) {
+        return;
+    }
+    const StoredRangeDependent* stored = column->stored_dependents;
+    int count = column->num_stored_dependents;
+    column->stored_dependents = NULL;
+    column->num_stored_dependents = 0;
+    for (int i = 0; i < count; i++) {
+        //Skips any entry whose rows aren't in the spreadsheet, since it has no bucket.
+        if (stored[i].first_row < 0 || stored[i].first_row > stored[i].last_row ||
+            stored[i].last_row >= sheet.num_rows) {
+            continue;
+        }
+        Cell* cell = is_valid_reference(stored[i].cell) ? get_reference_cell(stored[i].cell) : NULL;
+        if (cell != NULL) {
+            RangeDependent dependent = {cell, stored[i].first_row, stored[i].last_row};
+            insert_range_dependent(column, dependent);
+        }
+    }
+}
+
+/*
+ * Adds a cell to the dependents of another cell.
+ * cell: Cell which is referenced by a formula.
+ * dependent: Cell which contains the formula.
+ */
+void add_dependent(Cell* cell, Cell* dependent) {
+    resolve_dependents(cell);
+    //Grows the dependents array if it is full.
+    if (cell->num_dependents == cell->dependents_capacity) {
+        int capacity = cell->dependents_capacity == 0 ? 4 : cell->dependents_capacity * 2;
+        Cell** dependents = arena_reallocate(&arena, cell->dependents, cell->dependents_capacity * sizeof(Cell*),
+                                             capacity * sizeof(Cell*));
+        //Checks if the memory allocation was successful.
+        if (dependents == NULL) {
+            return;
+        }
+        cell->dependents = dependents;
+        cell->dependents_capacity = capacity;
+    }
+    //Adds the dependent to the end of the array.
+    cell->dependents[cell->num_dependents++] = dependent;
+}
+
+/*
+ * Removes a cell from the dependents of another cell.
+ * cell: Cell which was referenced by a formula.
+ * dependent: Cell which contained the formula.
+ */
+void remove_dependent(Cell* cell, Cell* dependent) {
+    resolve_dependents(cell);
+    for (int i = 0; i < cell->num_dependents; i++) {
+        if (cell->dependents[i] == dependent) {
+            //Moves the last dependent into the freed slot, since the order of dependents doesn't matter.
+            cell->dependents[i] = cell->dependents[--cell->num_dependents];
+            return;
+        }
+    }
+}
+
+/*
+ * Adds a formula cell to the cells which aggregate part of a column.
+ * col: Column which is aggregated.
+ * dependent: Cell which contains the formula, and the rows it aggregates.
+ */
+void add_column_dependent(int col, RangeDependent dependent) {
+    ColumnDependents* column = &sheet.column_dependents[col];
+    resolve_column_dependents(column);
+    insert_range_dependent(column, dependent);
+}
+
+/*
+ * Removes a formula cell from the cells which aggregate part of a column.
+ * col: Column which was aggregated.
+ * dependent: Cell which contained the formula, and the rows it aggregated.
+ */
+void remove_column_dependent(int col, RangeDependent dependent) {
+    ColumnDependents* column = &sheet.column_dependents[col];
+    resolve_column_dependents(column);
+    //Checks if the column has any range dependents at all.
+    if (column->buckets == NULL) {
+        return;
+    }
+    RangeBucket* bucket = get_range_bucket(column, dependent, &arena);
+    for (int i = 0; i < bucket->num_dependents; i++) {
+        RangeDependent* entry = &bucket->dependents[i];
+        if (entry->cell == dependent.cell && entry->first_row == dependent.first_row &&
+            entry->last_row == dependent.last_row) {
+            //Moves the last dependent into the freed slot, since the order of dependents doesn't matter.
+            *entry = bucket->dependents[--bucket->num_dependents];
+            column->num_dependents--;
+            return;
+        }
+    }
+}
+
+/*
+ * Struct to represent an iteration over the dependents of a cell. This covers both the formulas which reference the
+ * cell directly and the formulas with a range which contains the cell.
+ * cell: Cell whose dependents are iterated over.
+ * index: Index of the next direct dependent.
+ * level: Level of the bucket of range dependents which is being searched.
+ * bucket_index: Index of the next entry in the bucket.
+ */
+typedef struct {
+    Cell* cell;
+    int index;
+    int level;
+    int bucket_index;
+} DependentIterator;
+
+/*
+ * Starts an iteration over the dependents of a cell.
+ * Dependents loaded from a snapshot are resolved first. A recalculation iterates over the dependents of every affected
+ * cell on the calling thread before sharing them between the workers, so the workers never need to resolve any.
+ * cell: Cell whose dependents are iterated over.
+ * return: Iterator positioned before the first dependent.
+ */
+DependentIterator iterate_dependents(Cell* cell) {
+    resolve_dependents(cell);
+    resolve_column_dependents(&sheet.column_dependents[cell->col]);
+    DependentIterator iterator = {cell, 0, 0, 0};
+    return iterator;
+}
+
+/*
+ * Retrieves the next dependent of an iteration.
+ * A formula with several terms referencing the cell is returned once for each term, so every iteration over the same
+ * cell returns the same dependents.
+ * iterator: Iteration over the dependents of a cell.
+ * return: Next dependent, or NULL once every dependent has been returned.
+ */
+Cell* next_dependent(DependentIterator* iterator) {
+    //Returns the formulas which reference the cell directly first.
+    if (iterator->index < iterator->cell->num_dependents) {
+        return iterator->cell->dependents[iterator->index++];
+    }
+    //Then the formulas with a range containing the cell, which are in the bucket covering the cell on each level.
+    ColumnDependents* column = &sheet.column_dependents[iterator->cell->col];
+    if (column->buckets == NULL) {
+        return NULL;
+    }
+    int row = iterator->cell->row;
+    while (iterator->level < sheet.range_levels) {
+        RangeBucket* bucket = &column->buckets[get_range_bucket_index(iterator->level, row / TILE_ROWS)];
+        while (iterator->bucket_index < bucket->num_dependents) {
+            RangeDependent* dependent = &bucket->dependents[iterator->bucket_index++];
+            if (dependent->first_row <= row && row <= dependent->last_row) {
+                return dependent->cell;
+            }
+        }
+        iterator->level++;
+        iterator->bucket_index = 0;
+    }
+    return NULL;
+}
+
+/*
+ * Checks if a cell reference of a formula references a cell that an earlier reference already references.
+ * formula: Formula containing the reference.
+ * index: Index of the reference in the formula.
+ * return: 1 if an earlier reference is to the same cell, otherwise 0.
+ */
+int is_repeated_reference(Formula* formula, int index) {
+    CellReference* references = get_formula_references(formula);
+    for (int i = 0; i < index; i++) {
+        if (references[i].tile == references[index].tile && references[i].slot == references[index].slot) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Grows the arrays used while searching the topological order so that they have room for at least one more cell.
+ * size: Number of cells currently in the array which is added to.
+ * return: 1 if the arrays have room for another cell, otherwise 0.
+ */
+int ensure_order_capacity(int size) {
+    if (size < topological_order.capacity) {
+        return 1;
+    }
+    int capacity = topological_order.capacity == 0 ? 64 : topological_order.capacity * 2;
+    Cell** backward = realloc(topological_order.backward, capacity * sizeof(Cell*));
+    if (backward == NULL) {
+        return 0;
+    }
+    topological_order.backward = backward;
+    Cell** forward = realloc(topological_order.forward, capacity * sizeof(Cell*));
+    if (forward == NULL) {
+        return 0;
+    }
+    topological_order.forward = forward;
+    //Has room for the positions of the cells of both arrays.
+    int64_t* positions = realloc(topological_order.positions, 2 * (size_t) capacity * sizeof(int64_t));
+    if (positions == NULL) {
+        return 0;
+    }
+    topological_order.positions = positions;
+    topological_order.capacity = capacity;
+    return 1;
+}
+
+/*
+ * Adds a cell read by a formula to the cells found by the search backwards, if it comes after the formula being
+ * installed in the topological order, and hasn't already been found.
+ * cell: Cell which is read, or NULL if its tile has never been written to.
+ * lowest: Position the cell must come after to be found.
+ * return: 1 unless the memory allocation failed.
+ */
+int add_backward_cell(Cell* cell, int64_t lowest) {
+    if (cell == NULL || cell->order == 0 || cell->order <= lowest || cell->order_mark == topological_order.pass) {
+        return 1;
+    }
+    if (!ensure_order_capacity(topological_order.num_backward)) {
+        return 0;
+    }
+    cell->order_mark = topological_order.pass;
+    topological_order.backward[topological_order.num_backward++] = cell;
+    return 1;
+}
+
+/*
+ * Adds the cells a formula reads to the cells found by the search backwards. Cells which are still in the snapshot the
+ * spreadsheet was loaded from are loaded, since they have a position in the order too.
+ * cell: Cell containing the formula. Nothing is added if it doesn't contain one.
+ * lowest: Position the cells must come after to be found.
+ * return: 1 unless the memory allocation failed.
+ */
+int add_backward_inputs(Cell* cell, int64_t lowest) {
+    Formula* formula = cell->value.formula;
+    if (cell->type != FORMULA || formula == NULL) {
+        return 1;
+    }
+    CellReference* references = get_formula_references(formula);
+    for (int i = 0; i < formula->num_references; i++) {
+        if (!add_backward_cell(get_reference_cell(references[i]), lowest)) {
+            return 0;
+        }
+    }
+    RangeFunction* ranges = get_formula_ranges(formula);
+    for (int i = 0; i < formula->num_ranges; i++) {
+        Range* range = &ranges[i].range;
+        //Goes through the range a tile at a time, so that the tiles which have never been written to are skipped.
+        for (int row = range->first_row; row <= range->last_row; row = (row / TILE_ROWS + 1) * TILE_ROWS) {
+            int last_row = (row / TILE_ROWS + 1) * TILE_ROWS - 1;
+            if (last_row > range->last_row) {
+                last_row = range->last_row;
+            }
+            for (int col = range->first_col; col <= range->last_col; col = (col / TILE_COLS + 1) * TILE_COLS) {
+                Tile* tile = get_tile((row / TILE_ROWS) * sheet.tile_cols + col / TILE_COLS);
+                if (tile == NULL) {
+                    continue;
+                }
+                int last_col = (col / TILE_COLS + 1) * TILE_COLS - 1;
+                if (last_col > range->last_col) {
+                    last_col = range->last_col;
+                }
+                for (int tile_row = row; tile_row <= last_row; tile_row++) {
+                    for (int tile_col = col; tile_col <= last_col; tile_col++) {
+                        if (!add_backward_cell(&tile->cells[tile_row % TILE_ROWS][tile_col % TILE_COLS], lowest)) {
+                            return 0;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * Searches forwards from a formula being installed through the formulas which depend on it, once the search backwards
+ * has found the cells it reads which come after it in the topological order and the cells those depend on. The search
+ * stops at the formulas which come after every cell it reads, since those can't lead back to them.
+ * cell: Cell containing the formula.
+ * highest: Latest position of the cells the formula reads.
+ * return: 1 if the search didn't reach any cell found backwards, or 0 if it did, in which case the formula closes a
+ * cycle, or if the memory allocation failed.
+ */
+int search_forward(Cell* cell, int64_t highest) {
+    unsigned int backward_pass = topological_order.pass;
+    unsigned int forward_pass = topological_order.pass + 1;
+    topological_order.num_forward = 0;
+    //Checks if the formula reads its own cell.
+    if (cell->order_mark == backward_pass || !ensure_order_capacity(0)) {
+        return 0;
+    }
+    cell->order_mark = forward_pass;
+    topological_order.forward[topological_order.num_forward++] = cell;
+    for (int i = 0; i < topological_order.num_forward; i++) {
+        DependentIterator iterator = iterate_dependents(topological_order.forward[i]);
+        Cell* dependent;
+        while ((dependent = next_dependent(&iterator)) != NULL) {
+            //The inputs of formulas which close a cycle, or which aren't in the order yet, are left out of the order.
+            if (dependent->order == 0 || dependent->closes_cycle || dependent->order_mark == forward_pass) {
+                continue;
+            }
+            if (dependent->order_mark == backward_pass) {
+                return 0;
+            }
+            if (dependent->order < highest) {
+                if (!ensure_order_capacity(topological_order.num_forward)) {
+                    return 0;
+                }
+                dependent->order_mark = forward_pass;
+                topological_order.forward[topological_order.num_forward++] = dependent;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * Compares two cells by their position in the topological order, for sorting them with qsort.
+ * first: Pointer to the first cell.
+ * second: Pointer to the second cell.
+ * return: Negative if the first cell comes first, positive if it comes second, or 0 if they are the same cell.
+ */
+int compare_cell_orders(const void* first, const void* second) {
+    int64_t first_order = (*(Cell* const*) first)->order;
+    int64_t second_order = (*(Cell* const*) second)->order;
+    return (first_order > second_order) - (first_order < second_order);
+}
+
+/*
+ * Compares two positions in the topological order, for sorting them with qsort.
+ * first: Pointer to the first position.
+ * second: Pointer to the second position.
+ * return: Negative if the first position is lower, positive if it is higher, or 0 if they are equal.
+ */
+int compare_positions(const void* first, const void* second) {
+    int64_t first_position = *(const int64_t*) first;
+    int64_t second_position = *(const int64_t*) second;
+    return (first_position > second_position) - (first_position < second_position);
+}
+
+/*
+ * Moves the cells found by the search backwards before the cells found by the search forwards, by sharing out the
+ * positions they all had between them. Each group keeps the order it had, and the positions of the other cells don't
+ * change, so every cell still comes before the formulas which read it.
+ */
+void reorder_cells() {
+    int num_backward = topological_order.num_backward;
+    int num_forward = topological_order.num_forward;
+    qsort(topological_order.backward, num_backward, sizeof(Cell*), compare_cell_orders);
+    qsort(topological_order.forward, num_forward, sizeof(Cell*), compare_cell_orders);
+    for (int i = 0; i < num_backward; i++) {
+        topological_order.positions[i] = topological_order.backward[i]->order;
+    }
+    for (int i = 0; i < num_forward; i++) {
+        topological_order.positions[num_backward + i] = topological_order.forward[i]->order;
+    }
+    qsort(topological_order.positions, num_backward + num_forward, sizeof(int64_t), compare_positions);
+    for (int i = 0; i < num_backward; i++) {
+        topological_order.backward[i]->order = topological_order.positions[i];
+    }
+    for (int i = 0; i < num_forward; i++) {
+        topological_order.forward[i]->order = topological_order.positions[num_backward + i];
+    }
+}
+
+/*
+ * Checks if a formula reads the cell containing it, directly or through a range.
+ * cell: Cell containing the formula.
+ * return: 1 if the formula reads its own cell, otherwise 0.
+ */
+int reads_own_cell(Cell* cell) {
+    Formula* formula = cell->value.formula;
+    if (formula == NULL) {
+        return 0;
+    }
+    CellReference own = make_cell_reference(cell->row, cell->col);
+    CellReference* references = get_formula_references(formula);
+    for (int i = 0; i < formula->num_references; i++) {
+        if (references[i].tile == own.tile && references[i].slot == own.slot) {
+            return 1;
+        }
+    }
+    RangeFunction* ranges = get_formula_ranges(formula);
+    for (int i = 0; i < formula->num_ranges; i++) {
+        Range* range = &ranges[i].range;
+        if (range->first_row <= cell->row && cell->row <= range->last_row && range->first_col <= cell->col &&
+            cell->col <= range->last_col) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Places a cell which has just been given a formula in the topological order after every cell its formula reads, and
+ * finds whether the formula closes a circular dependency, in which case it is marked as closing one and the cells it
+ * reads are left out of the order. A formula which closed a cycle is placed again in the same way to find whether it
+ * still does. If the memory for the searches can't be allocated, the formula is taken to close a cycle, which keeps
+ * the order valid, until it is placed again.
+ * cell: Cell containing the formula, which must already be registered with the cells it references.
+ */
+void insert_into_order(Cell* cell) {
+    if (cell->order == 0) {
+        //A cell which isn't in the order yet goes after every other cell if no formula in the order reads it, so only a
+        //formula reading its own cell can close a cycle. Otherwise it goes before every other cell, and is then moved
+        //after the cells its formula reads.
+        int is_read = 0;
+        DependentIterator iterator = iterate_dependents(cell);
+        Cell* dependent;
+        while (!is_read && (dependent = next_dependent(&iterator)) != NULL) {
+            is_read = dependent->order != 0 && !dependent->closes_cycle;
+        }
+        if (!is_read) {
+            cell->order = ++topological_order.highest;
+            cell->closes_cycle = reads_own_cell(cell);
+            return;
+        }
+        cell->order = --topological_order.lowest;
+    }
+
+    //Finds the cells the formula reads which come after it, including its own cell if it reads it, then every cell
+    //after it which those depend on.
+    topological_order.pass += 2;
+    topological_order.num_backward = 0;
+    int searched = add_backward_inputs(cell, cell->order - 1);
+    int64_t highest = cell->order;
+    for (int i = 0; i < topological_order.num_backward; i++) {
+        if (topological_order.backward[i]->order > highest) {
+            highest = topological_order.backward[i]->order;
+        }
+    }
+    for (int i = 0; searched && i < topological_order.num_backward; i++) {
+        Cell* input = topological_order.backward[i];
+        if (input != cell && !input->closes_cycle) {
+            searched = add_backward_inputs(input, cell->order);
+        }
+    }
+    if (searched && topological_order.num_backward == 0) {
+        cell->closes_cycle = 0;
+        return;
+    }
+
+    //The formula closes a cycle if any formula depending on it is found backwards too.
+    if (!searched || !search_forward(cell, highest)) {
+        cell->closes_cycle = 1;
+        return;
+    }
+    reorder_cells();
+    cell->closes_cycle = 0;
+}
+
+/*
+ * Registers a formula cell as a dependent of every cell its formula references, and places it in the topological
+ * order.
+ * cell: Cell which contains the formula.
+ */
+void add_dependencies(Cell* cell) {
+    Formula* formula = cell->value.formula;
+    //Checks if the formula failed to parse, in which case it references nothing.
+    if (formula == NULL) {
+        return;
+    }
+    CellReference* references = get_formula_references(formula);
+    for (int i = 0; i < formula->num_references; i++) {
+        //Each referenced cell only lists the formula cell once, even if it is referenced several times.
+        if (!is_repeated_reference(formula, i)) {
+            //Retrieves the cell, allocating its tile if this is the first time it is referenced.
+            int row, col;
+            get_reference_position(references[i], &row, &col);
+            Cell* referenced = get_cell_for_writing(row, col);
+            if (referenced != NULL) {
+                add_dependent(referenced, cell);
+            }
+        }
+    }
+    //A range is registered with each of its columns.
+    RangeFunction* ranges = get_formula_ranges(formula);
+    for (int i = 0; i < formula->num_ranges; i++) {
+        Range* range = &ranges[i].range;
+        RangeDependent dependent = {cell, range->first_row, range->last_row};
+        for (int col = range->first_col; col <= range->last_col; col++) {
+            add_column_dependent(col, dependent);
+        }
+    }
+    insert_into_order(cell);
+}
+
+/*
+ * Unregisters a formula cell from the dependents of every cell its formula references.
+ * cell: Cell which contains the formula.
+ */
+void remove_dependencies(Cell* cell) {
+    //The cell no longer reads anything, so it can't close a cycle.
+    cell->closes_cycle = 0;
+    Formula* formula = cell->value.formula;
+    //Checks if the formula failed to parse, in which case it references nothing.
+    if (formula == NULL) {
+        return;
+    }
+    CellReference* references = get_formula_references(formula);
+    for (int i = 0; i < formula->num_references; i++) {
+        if (!is_repeated_reference(formula, i)) {
+            Cell* referenced = get_reference_cell(references[i]);
+            //Checks if the tile of the cell was allocated when the dependency was added.
+            if (referenced != NULL) {
+                remove_dependent(referenced, cell);
+            }
+        }
+    }
+    //Each range removes the entries its columns were given when it was registered.
+    RangeFunction* ranges = get_formula_ranges(formula);
+    for (int i = 0; i < formula->num_ranges; i++) {
+        Range* range = &ranges[i].range;
+        RangeDependent dependent = {cell, range->first_row, range->last_row};
+        for (int col = range->first_col; col <= range->last_col; col++) {
+            remove_column_dependent(col, dependent);
+        }
+    }
+}
+
+void evaluate_on_demand(Cell* cell);
+
+/*
+ * Checks if a cell is shown by the interface.
+ * row: Row of the cell.
+ * col: Column of the cell.
+ * return: 1 if the cell is inside the viewport, otherwise 0.
+ */
+int is_visible(int row, int col) {
+    return row >= viewport.first_row && row < viewport.first_row + viewport.num_rows &&
+           col >= viewport.first_col && col < viewport.first_col + viewport.num_cols;
+}
+
+/*
+ * Displays the cached result or error of the formula of a cell, if it is visible.
+ * cell: Cell which contains the formula.
+ */
+void display_formula_result(Cell* cell) {
+    ROW row;
+    COL col;
+    get_cell_position(cell, &row, &col);
+    if (!is_visible(row, col)) {
+        return;
+    }
+    //Evaluates the formula first if its result is out of date, which displays it.
+    if (cell->stale) {
+        evaluate_on_demand(cell);
+        return;
+    }
+
+    //Checks if the formula conversion was unsuccessful due to invalid syntax.
+    if (cell->error == PARSE_ERROR) {
+        //Prints an error message to the user through the cell text, along with where the error is.
+        int offset = cell->value.formula != NULL ? cell->value.formula->error_offset : 0;
+        char message[CELL_DISPLAY_WIDTH + 1];
+        snprintf(message, sizeof(message), "#PARSE@%d", offset);
+        update_cell_display(row, col, message);
+    }
+        //Checks for any other error, which is displayed in place of the result.
+    else if (cell->error != NO_ERROR) {
+        update_cell_display(row, col, error_names[cell->error]);
+    } else {
+        //Converts the result to string.
+        char result_str[CELL_DISPLAY_WIDTH + 1];
+        format_number(get_column_number(cell), result_str, CELL_DISPLAY_WIDTH);
+        //Updates the cell display with the resulting string.
+        update_cell_display(row, col, result_str);
+    }
+}
+
+/*
+ * Adds a ready cell to the queue of a worker.
+ * queue: Queue of the worker.
+ * cell: Cell which is ready to be evaluated.
+ * return: 1 if the cell was added, or 0 if the queue couldn't be grown.
+ */
+int push_ready_cell(WorkQueue* queue, Cell* cell) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->bottom == queue->capacity) {
+        //Moves the cells back to the start of the array if the oldest ones have been taken, otherwise grows it.
+        if (queue->top > 0) {
+            memmove(queue->cells, queue->cells + queue->top, (queue->bottom - queue->top) * sizeof(Cell*));
+            queue->bottom -= queue->top;
+            queue->top = 0;
+        } else {
+            int capacity = queue->capacity == 0 ? 256 : queue->capacity * 2;
+            Cell** cells = realloc(queue->cells, capacity * sizeof(Cell*));
+            //Checks if the memory allocation was successful.
+            if (cells == NULL) {
+                pthread_mutex_unlock(&queue->lock);
+                return 0;
+            }
+            queue->cells = cells;
+            queue->capacity = capacity;
+        }
+    }
+    queue->cells[queue->bottom++] = cell;
+    pthread_mutex_unlock(&queue->lock);
+    return 1;
+}
+
+/*
+ * Takes a ready cell from a queue.
+ * queue: Queue the cell is taken from.
+ * newest: 1 to take the newest cell, which is done by the worker owning the queue, or 0 to take the oldest cell, which
+ * is done by workers stealing from it.
+ * return: Cell which was taken, or NULL if the queue is empty.
+ */
+Cell* take_ready_cell(WorkQueue* queue, int newest) {
+    Cell* cell = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->top < queue->bottom) {
+        cell = newest ? queue->cells[--queue->bottom] : queue->cells[queue->top++];
+        //Starts again from the beginning of the array once the queue is empty.
+        if (queue->top == queue->bottom) {
+            queue->top = 0;
+            queue->bottom = 0;
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return cell;
+}
+
+/*
+ * Evaluates a ready cell, and makes each of its dependents ready once all of their other inputs have been evaluated.
+ * The dependents which become ready are added to the queue of the worker.
+ * worker: Index of the worker evaluating the cell.
+ * cell: Cell which is ready to be evaluated.
+ */
+void evaluate_ready_cell(int worker, Cell* cell) {
+    if (cell->type == FORMULA) {
+        evaluate_cell(cell);
+    } else {
+        cell->dirty = 0;
+    }
+    DependentIterator iterator = iterate_dependents(cell);
+    Cell* dependent;
+    while ((dependent = next_dependent(&iterator)) != NULL) {
+        //Releases the result of this cell to whichever worker evaluates the dependent.
+        if (!dependent->closes_cycle &&
+            atomic_fetch_sub_explicit(&dependent->pending_inputs, 1, memory_order_acq_rel) == 1) {
+            //Counts the dependent as outstanding before this cell is finished, so that the count never drops to 0
+            //while there is still work to do.
+            atomic_fetch_add_explicit(&pool.outstanding, 1, memory_order_relaxed);
+            //Evaluates the dependent straight away if it can't be queued.
+            if (!push_ready_cell(&pool.queues[worker], dependent)) {
+                evaluate_ready_cell(worker, dependent);
+            }
+        }
+    }
+    atomic_fetch_sub_explicit(&pool.outstanding, 1, memory_order_acq_rel);
+}
+
+void parse_csv_chunks(int worker);
+void link_csv_formulas(int worker);
+
+/*
+ * Does a worker's share of the current job.
+ * worker: Index of the worker.
+ */
+void run_worker_job(int worker) {
+    if (pool.job == PARSE_JOB) {
+        parse_csv_chunks(worker);
+        return;
+    }
+    if (pool.job == LINK_JOB) {
+        link_csv_formulas(worker);
+        return;
+    }
+    if (pool.job == COUNT_JOB) {
+        //Claims chunks of the affected cells until they have all been counted.
+        int first;
+        while ((first = atomic_fetch_add_explicit(&pool.next_chunk, COUNT_CHUNK, memory_order_relaxed)) <
+               pool.num_cells) {
+            int last = first + COUNT_CHUNK < pool.num_cells ? first + COUNT_CHUNK : pool.num_cells;
+            for (int i = first; i < last; i++) {
+                DependentIterator iterator = iterate_dependents(pool.cells[i]);
+                Cell* dependent;
+                while ((dependent = next_dependent(&iterator)) != NULL) {
+                    if (!dependent->closes_cycle) {
+                        atomic_fetch_add_explicit(&dependent->pending_inputs, 1, memory_order_relaxed);
+                    }
+                }
+            }
+        }
+        return;
+    }
+
+    //Evaluates cells from this worker's queue, or steals them from the others, until every ready cell is done.
+    int victim = worker;
+    while (atomic_load_explicit(&pool.outstanding, memory_order_acquire) > 0) {
+        Cell* cell = take_ready_cell(&pool.queues[worker], 1);
+        for (int i = 1; cell == NULL && i < pool.num_workers; i++) {
+            victim = (victim + 1) % pool.num_workers;
+            if (victim != worker) {
+                cell = take_ready_cell(&pool.queues[victim], 0);
+            }
+        }
+        if (cell != NULL) {
+            evaluate_ready_cell(worker, cell);
+        } else {
+            //Lets the workers holding cells finish them.
+            sched_yield();
+        }
+    }
+}
+
+/*
+ * Runs a worker thread, which does its share of each job as it is started.
+ * argument: Index of the worker.
+ * return: Never returns.
+ */
+void* run_worker(void* argument) {
+    int worker = (int) (intptr_t) argument;
+    unsigned long generation = 0;
+    for (;;) {
+        //Waits for the next job.
+        pthread_mutex_lock(&pool.lock);
+        while (pool.generation == generation) {
+            pthread_cond_wait(&pool.job_started, &pool.lock);
+        }
+        generation = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_worker_job(worker);
+
+        //Lets the calling thread know once every worker has finished.
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.num_active == 0) {
+            pthread_cond_signal(&pool.job_finished);
+        }
+        pthread_mutex_unlock(&pool.lock);
+    }
+    return NULL;
+}
+
+/*
+ * Starts the worker threads, one for each processor unless the MODEL_THREADS environment variable sets how many
+ * workers to use.
+ * return: Number of workers, which is 1 if there is only one processor or no threads could be started.
+ */
+int start_workers() {
+    long processors = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+    processors = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    const char* threads = getenv("MODEL_THREADS");
+    if (threads != NULL && atol(threads) > 0) {
+        processors = atol(threads);
+    }
+    int num_workers = processors < 1 ? 1 : processors > MAX_WORKERS ? MAX_WORKERS : (int) processors;
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.job_started, NULL);
+    pthread_cond_init(&pool.job_finished, NULL);
+    pthread_mutex_init(&pool.queues[0].lock, NULL);
+    pool.num_workers = 1;
+    for (int i = 1; i < num_workers; i++) {
+        pthread_mutex_init(&pool.queues[i].lock, NULL);
+        if (pthread_create(&pool.threads[i], NULL, run_worker, (void*) (intptr_t) i) != 0) {
+            break;
+        }
+        pthread_detach(pool.threads[i]);
+        pool.num_workers++;
+    }
+    return pool.num_workers;
+}
+
+/*
+ * Runs a job on every worker, including the calling thread, and waits for them all to finish it.
+ * job: Job which is run.
+ */
+void run_job(WorkerJob job) {
+    pthread_mutex_lock(&pool.lock);
+    pool.job = job;
+    pool.num_active = pool.num_workers;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.job_started);
+    pthread_mutex_unlock(&pool.lock);
+
+    run_worker_job(0);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.num_active--;
+    while (pool.num_active > 0) {
+        pthread_cond_wait(&pool.job_finished, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/*
+ * Evaluates the affected cells of a recalculation with every worker. Each cell is given to a worker as soon as all of
+ * its affected inputs have been evaluated, so independent cells are evaluated at the same time.
+ * cells: Affected cells.
+ * num_cells: Number of affected cells.
+ * return: 1 if the cells were evaluated, or 0 if there is only one worker to do it.
+ */
+int evaluate_in_parallel(Cell** cells, int num_cells) {
+    if (pool.num_workers == 0 && start_workers() == 1) {
+        return 0;
+    }
+    if (pool.num_workers == 1) {
+        return 0;
+    }
+    //Copies the values of the tiles the formulas write to while a view might be open, since only this thread can keep
+    //versions of tiles for the views.
+    if (views.newest_epoch != 0) {
+        for (int i = 0; i < num_cells; i++) {
+            if (cells[i]->type == FORMULA) {
+                get_tile_values_for_writing(get_cell_tile_index(cells[i]));
+            }
+        }
+    }
+    pool.cells = cells;
+    pool.num_cells = num_cells;
+
+    //Counts the affected inputs of every cell.
+    atomic_store_explicit(&pool.next_chunk, 0, memory_order_relaxed);
+    run_job(COUNT_JOB);
+
+    //Shares the cells which don't depend on any other affected cell between the workers.
+    int num_ready = 0;
+    for (int i = 0; i < num_cells; i++) {
+        if (atomic_load_explicit(&cells[i]->pending_inputs, memory_order_relaxed) == 0 &&
+            push_ready_cell(&pool.queues[num_ready % pool.num_workers], cells[i])) {
+            num_ready++;
+        }
+    }
+    atomic_store_explicit(&pool.outstanding, num_ready, memory_order_relaxed);
+    run_job(EVALUATE_JOB);
+    return 1;
+}
+
+/*
+ * Displays the value of a cell which doesn't contain a formula, if it is visible.
+ * cell: Cell which is displayed.
+ */
+void display_cell(Cell* cell) {
+    ROW row;
+    COL col;
+    get_cell_position(cell, &row, &col);
+    if (!is_visible(row, col)) {
+        return;
+    }
+    if (cell->type == NUMBER) {
+        //Converts the number to a string.
+        char number[CELL_DISPLAY_WIDTH + 1];
+        format_number(get_column_number(cell), number, CELL_DISPLAY_WIDTH);
+        update_cell_display(row, col, number);
+    } else if (cell->type == TEXT && cell->value.text != 0) {
+        update_cell_display(row, col, get_string(cell->value.text));
+    } else if (cell->type == TEXT) {
+        update_cell_display(row, col, "");
+    }
+}
+
+/*
+ * Displays every cell inside the viewport from its cached value, without recalculating anything. The tiles of the
+ * cells are loaded if they are still in a snapshot.
+ */
+void display_viewport() {
+    //Only displays the part of the viewport which is inside the spreadsheet.
+    int first_row = viewport.first_row < 0 ? 0 : viewport.first_row;
+    int first_col = viewport.first_col < 0 ? 0 : viewport.first_col;
+    int last_row = viewport.first_row + viewport.num_rows;
+    int last_col = viewport.first_col + viewport.num_cols;
+    for (int row = first_row; row < last_row && row < sheet.num_rows; row++) {
+        for (int col = first_col; col < last_col && col < sheet.num_cols; col++) {
+            Cell* cell = get_cell(row, col);
+            if (cell == NULL) {
+                update_cell_display((ROW) row, (COL) col, "");
+            } else if (cell->type == FORMULA) {
+                display_formula_result(cell);
+            } else {
+                display_cell(cell);
+            }
+        }
+    }
+}
+
+#ifdef MODEL_STATS
+/*
+ * Reads the monotonic clock, for timing recalculations.
+ * return: Current time in nanoseconds.
+ */
+uint64_t get_nanoseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000 + (uint64_t) time.tv_nsec;
+}
+
+/*
+ * Records a recalculation which has just finished, along with how long it took.
+ * start: Time the recalculation started, from get_nanoseconds.
+ */
+void record_recalculation(uint64_t start) {
+    uint64_t duration = get_nanoseconds() - start;
+    recalc_counters.num_recalculations++;
+    recalc_counters.total_nanoseconds += duration;
+    if (duration > recalc_counters.max_nanoseconds) {
+        recalc_counters.max_nanoseconds = duration;
+    }
+    //Finds the first power of two microseconds the duration is under.
+    int bucket = 0;
+    for (uint64_t limit = 1000; bucket < RECALC_HISTOGRAM_SIZE - 1 && duration >= limit; limit *= 2) {
+        bucket++;
+    }
+    recalc_counters.histogram[bucket]++;
+}
+#endif
+
+/*
+ * Recalculates changed cells and every formula which directly or indirectly references them.
+ * The affected cells are found through their dependents, without visiting the rest of the spreadsheet, and marked
+ * dirty. They are then evaluated in topological order using Kahn's algorithm: a cell is only evaluated once every
+ * affected cell it depends on has been, so each cell is evaluated and displayed exactly once. The inputs of formulas
+ * which close a circular dependency aren't counted, so those formulas are ready straight away and every cell becomes
+ * ready, and the formulas depending on them get the circular dependency from their results.
+ * Large recalculations are shared between worker threads, which evaluate the cells as they become ready.
+ * changed: Cells which have been changed.
+ * num_changed: Number of changed cells.
+ */
+void recalculate_cells(Cell** changed, int num_changed) {
+#ifdef MODEL_STATS
+    uint64_t start = get_nanoseconds();
+#endif
+    int num_cells = 0;
+    int num_ready = 0;
+
+    //Starts a new pass, so that marks left by earlier passes count as unvisited.
+    recalc_pass++;
+    for (int i = 0; i < num_changed; i++) {
+        if (changed[i]->visit_mark != recalc_pass && ensure_recalc_capacity(num_cells)) {
+            changed[i]->visit_mark = recalc_pass;
+            recalc_cells[num_cells++] = changed[i];
+        }
+    }
+
+    //Finds every affected cell, using the list of cells found so far as the worklist.
+    for (int i = 0; i < num_cells; i++) {
+        //Marks the cached result as out of date, and resets the count of its affected inputs.
+        recalc_cells[i]->dirty = 1;
+        atomic_store_explicit(&recalc_cells[i]->pending_inputs, 0, memory_order_relaxed);
+        DependentIterator iterator = iterate_dependents(recalc_cells[i]);
+        Cell* dependent;
+        while ((dependent = next_dependent(&iterator)) != NULL) {
+            if (dependent->visit_mark != recalc_pass && ensure_recalc_capacity(num_cells)) {
+                dependent->visit_mark = recalc_pass;
+                recalc_cells[num_cells++] = dependent;
+            }
+        }
+    }
+
+    //Checks whether the formulas which closed a cycle still do, since the edit may have broken the cycle. Only the
+    //cells depending on an edit can be part of a cycle it broke.
+    for (int i = 0; i < num_cells; i++) {
+        if (recalc_cells[i]->closes_cycle) {
+            insert_into_order(recalc_cells[i]);
+        }
+    }
+
+    //Evaluates large recalculations on every worker. The results are displayed afterwards, from this thread.
+    if (num_cells >= PARALLEL_THRESHOLD && evaluate_in_parallel(recalc_cells, num_cells)) {
+        for (int i = 0; i < num_cells; i++) {
+            if (recalc_cells[i]->type == FORMULA) {
+                display_formula_result(recalc_cells[i]);
+            }
+        }
+    } else {
+        for (int i = 0; i < num_cells; i++) {
+            DependentIterator iterator = iterate_dependents(recalc_cells[i]);
+            Cell* dependent;
+            while ((dependent = next_dependent(&iterator)) != NULL) {
+                if (!dependent->closes_cycle) {
+                    atomic_fetch_add_explicit(&dependent->pending_inputs, 1, memory_order_relaxed);
+                }
+            }
+        }
+
+        //Starts with the cells which don't depend on any other affected cell.
+        for (int i = 0; i < num_cells; i++) {
+            if (atomic_load_explicit(&recalc_cells[i]->pending_inputs, memory_order_relaxed) == 0) {
+                recalc_ready[num_ready++] = recalc_cells[i];
+            }
+        }
+
+        //Evaluates the ready cells, which makes their dependents ready once all of their other inputs are done.
+        for (int i = 0; i < num_ready; i++) {
+            Cell* ready = recalc_ready[i];
+            if (ready->type == FORMULA) {
+                evaluate_cell(ready);
+                display_formula_result(ready);
+            } else {
+                ready->dirty = 0;
+            }
+            DependentIterator iterator = iterate_dependents(ready);
+            Cell* dependent;
+            while ((dependent = next_dependent(&iterator)) != NULL) {
+                if (!dependent->closes_cycle &&
+                    atomic_fetch_sub_explicit(&dependent->pending_inputs, 1, memory_order_relaxed) == 1) {
+                    recalc_ready[num_ready++] = dependent;
+                }
+            }
+        }
+    }
+#ifdef MODEL_STATS
+    record_recalculation(start);
+#endif
+}
+
+/*
+ * Recalculates a changed cell and every formula which directly or indirectly references it.
+ * cell: Cell which has been changed.
+ */
+void recalculate_dependents(Cell* cell) {
+    recalculate_cells(&cell, 1);
+}
+
+/*
+ * Adds a cell to the stale cells. The cells which have been evaluated since they were added are removed first if the
+ * array is full, so that it only grows when most of its cells are still stale.
+ * cell: Cell which has just been marked stale.
+ * return: 1 if the cell was added, or 0 if the memory allocation failed.
+ */
+int add_stale_cell(Cell* cell) {
+    if (num_stale_cells == stale_capacity) {
+        int num_kept = 0;
+        for (int i = 0; i < num_stale_cells; i++) {
+            if (stale_cells[i]->stale) {
+                stale_cells[num_kept++] = stale_cells[i];
+            }
+        }
+        num_stale_cells = num_kept;
+    }
+    if (num_stale_cells >= stale_capacity / 2 || stale_capacity == 0) {
+        int capacity = stale_capacity == 0 ? 64 : stale_capacity * 2;
+        Cell** cells = realloc(stale_cells, capacity * sizeof(Cell*));
+        //Checks if the memory allocation was successful.
+        if (cells == NULL) {
+            return num_stale_cells < stale_capacity;
+        }
+        stale_cells = cells;
+        stale_capacity = capacity;
+    }
+    stale_cells[num_stale_cells++] = cell;
+    return 1;
+}
+
+/*
+ * Marks the formulas affected by changed cells stale, in lazy evaluation mode, rather than recalculating them. The
+ * affected cells are found through their dependents in the same way as for a recalculation, except that the search
+ * stops at formulas which are already stale, since their dependents are already stale too. The affected formulas which
+ * are visible are then displayed, which evaluates them and the stale formulas they depend on.
+ * changed: Cells which have been changed.
+ * num_changed: Number of changed cells.
+ */
+void mark_stale(Cell** changed, int num_changed) {
+    int num_cells = 0;
+    recalc_pass++;
+    for (int i = 0; i < num_changed; i++) {
+        changed[i]->dirty = 0;
+        if (changed[i]->visit_mark != recalc_pass && ensure_recalc_capacity(num_cells)) {
+            changed[i]->visit_mark = recalc_pass;
+            recalc_cells[num_cells++] = changed[i];
+        }
+    }
+    for (int i = 0; i < num_cells; i++) {
+        DependentIterator iterator = iterate_dependents(recalc_cells[i]);
+        Cell* dependent;
+        while ((dependent = next_dependent(&iterator)) != NULL) {
+            if (!dependent->stale && dependent->visit_mark != recalc_pass && ensure_recalc_capacity(num_cells)) {
+                dependent->visit_mark = recalc_pass;
+                recalc_cells[num_cells++] = dependent;
+            }
+        }
+    }
+
+    //Marks the formulas stale. A formula which can't be remembered is evaluated straight away instead.
+    for (int i = 0; i < num_cells; i++) {
+        Cell* cell = recalc_cells[i];
+        if (cell->type == FORMULA && !cell->stale) {
+            cell->stale = 1;
+            if (!add_stale_cell(cell)) {
+                cell->stale = 0;
+                evaluate_cell(cell);
+                display_formula_result(cell);
+            }
+        }
+    }
+    //Displays the visible formulas, which can't be left stale. The scratch arrays are reused by each evaluation, so
+    //the cells are taken from the end of the stale cells instead.
+    for (int i = num_stale_cells - 1; i >= 0 && i >= num_stale_cells - num_cells; i--) {
+        if (stale_cells[i]->stale) {
+            display_formula_result(stale_cells[i]);
+        }
+    }
+}
+
+/*
+ * Adds a stale formula which another stale formula depends on to the cells evaluated on demand.
+ * cell: Cell which is read by the formula, or NULL if its tile has never been written to.
+ * num_cells: Number of cells found so far, which is updated.
+ * return: 1 if the cell is stale, even if it had already been found, otherwise 0.
+ */
+int add_stale_input(Cell* cell, int* num_cells) {
+    if (cell == NULL || !cell->stale) {
+        return 0;
+    }
+    if (cell->visit_mark != recalc_pass && ensure_recalc_capacity(*num_cells)) {
+        cell->visit_mark = recalc_pass;
+        recalc_cells[(*num_cells)++] = cell;
+    }
+    return 1;
+}
+
+/*
+ * Adds the stale formulas a stale formula reads to the cells evaluated on demand. Stale cells have always been visited
+ * through the dependents of a changed cell, so their tiles are already loaded and tiles which aren't loaded can be
+ * skipped.
+ * formula: Formula whose inputs are added.
+ * num_cells: Number of cells found so far, which is updated.
+ * return: Number of stale cells the formula reads, counted the same way as 'get_formula_fan_in' counts every cell it
+ * reads.
+ */
+size_t add_stale_inputs(Formula* formula, int* num_cells) {
+    size_t num_stale = 0;
+    CellReference* references = get_formula_references(formula);
+    for (int i = 0; i < formula->num_references; i++) {
+        Tile* tile = sheet.tiles[references[i].tile];
+        if (tile != NULL) {
+            num_stale += add_stale_input(&tile->cells[references[i].slot % TILE_ROWS][references[i].slot / TILE_ROWS],
+                                         num_cells);
+        }
+    }
+    RangeFunction* ranges = get_formula_ranges(formula);
+    for (int i = 0; i < formula->num_ranges; i++) {
+        Range* range = &ranges[i].range;
+        //Goes through the range a tile at a time, so that the tiles which aren't loaded are skipped.
+        for (int row = range->first_row; row <= range->last_row; row = (row / TILE_ROWS + 1) * TILE_ROWS) {
+            int last_row = (row / TILE_ROWS + 1) * TILE_ROWS - 1;
+            if (last_row > range->last_row) {
+                last_row = range->last_row;
+            }
+            for (int col = range->first_col; col <= range->last_col; col = (col / TILE_COLS + 1) * TILE_COLS) {
+                Tile* tile = sheet.tiles[(row / TILE_ROWS) * sheet.tile_cols + col / TILE_COLS];
+                if (tile == NULL) {
+                    continue;
+                }
+                int last_col = (col / TILE_COLS + 1) * TILE_COLS - 1;
+                if (last_col > range->last_col) {
+                    last_col = range->last_col;
+                }
+                for (int tile_row = row; tile_row <= last_row; tile_row++) {
+                    for (int tile_col = col; tile_col <= last_col; tile_col++) {
+                        num_stale += add_stale_input(&tile->cells[tile_row % TILE_ROWS][tile_col % TILE_COLS],
+                                                     num_cells);
+                    }
+                }
+            }
+        }
+    }
+    return num_stale;
+}
+
+/*
+ * Evaluates a stale formula whose result is needed, in lazy evaluation mode, along with every stale formula it
+ * directly or indirectly depends on. Those are found through the formulas themselves, since they are the inputs
+ * rather than the dependents, and then evaluated in topological order using Kahn's algorithm as for a recalculation.
+ * The formulas which are evaluated are displayed if they are visible.
+ * cell: Cell whose formula is evaluated. Nothing is done if it isn't stale.
+ */
+void evaluate_on_demand(Cell* cell) {
+    if (!cell->stale || !ensure_recalc_capacity(0)) {
+        return;
+    }
+#ifdef MODEL_STATS
+    uint64_t start = get_nanoseconds();
+#endif
+    int num_cells = 0;
+    int num_ready = 0;
+    recalc_pass++;
+    cell->visit_mark = recalc_pass;
+    recalc_cells[num_cells++] = cell;
+
+    //Finds the stale inputs of each stale formula found so far, counting the stale cells read by the formulas which are
+    //evaluated. Formulas which close a cycle aren't evaluated unless they no longer do.
+    size_t stale_reads = 0;
+    for (int i = 0; i < num_cells; i++) {
+        atomic_store_explicit(&recalc_cells[i]->pending_inputs, 0, memory_order_relaxed);
+        Formula* formula = recalc_cells[i]->value.formula;
+        if (formula == NULL) {
+            continue;
+        }
+        size_t num_stale = add_stale_inputs(formula, &num_cells);
+        if (!recalc_cells[i]->closes_cycle) {
+            stale_reads += num_stale;
+        }
+    }
+
+    //Checks whether the formulas which closed a cycle still do, as for a recalculation.
+    for (int i = 0; i < num_cells; i++) {
+        if (recalc_cells[i]->closes_cycle) {
+            insert_into_order(recalc_cells[i]);
+            if (!recalc_cells[i]->closes_cycle) {
+                stale_reads += add_stale_inputs(recalc_cells[i]->value.formula, &num_cells);
+            }
+        }
+    }
+
+    //Counts the inputs of each cell which are also being evaluated.
+    for (int i = 0; i < num_cells; i++) {
+        DependentIterator iterator = iterate_dependents(recalc_cells[i]);
+        Cell* dependent;
+        while ((dependent = next_dependent(&iterator)) != NULL) {
+            if (dependent->visit_mark == recalc_pass && !dependent->closes_cycle) {
+                atomic_fetch_add_explicit(&dependent->pending_inputs, 1, memory_order_relaxed);
+            }
+        }
+    }
+    for (int i = 0; i < num_cells; i++) {
+        if (atomic_load_explicit(&recalc_cells[i]->pending_inputs, memory_order_relaxed) == 0) {
+            recalc_ready[num_ready++] = recalc_cells[i];
+        }
+    }
+
+    //Evaluates the ready cells, which makes the cells depending on them ready once all of their other inputs are done.
+    for (int i = 0; i < num_ready; i++) {
+        Cell* ready = recalc_ready[i];
+        evaluate_cell(ready);
+        ready->stale = 0;
+        display_formula_result(ready);
+        DependentIterator iterator = iterate_dependents(ready);
+        Cell* dependent;
+        while ((dependent = next_dependent(&iterator)) != NULL) {
+            if (dependent->visit_mark == recalc_pass && !dependent->closes_cycle &&
+                atomic_fetch_sub_explicit(&dependent->pending_inputs, 1, memory_order_relaxed) == 1) {
+                recalc_ready[num_ready++] = dependent;
+            }
+        }
+    }
+    COUNT_RECALC_STAT(num_stale_reads, stale_reads);
+#ifdef MODEL_STATS
+    record_recalculation(start);
+#endif
+}
+
+/*
+ * Evaluates every stale formula, so that every cached result is up to date.
+ */
+void evaluate_stale_cells() {
+    for (int i = 0; i < num_stale_cells; i++) {
+        evaluate_on_demand(stale_cells[i]);
+    }
+    num_stale_cells = 0;
+}
+
+/*
+ * Handles a cell which has just been changed. Outside of a batch, the cell and its dependents are recalculated
+ * straight away. Inside a batch, the cell is remembered so that it can be recalculated and displayed once the batch
+ * ends.
+ * cell: Cell which has been changed.
+ */
+void cell_changed(Cell* cell) {
+    //Frees what was kept for views closed since the last edit.
+    if (views.newest_epoch != 0) {
+        release_closed_views();
+    }
+    if (batch_depth > 0) {
+        //Checks if the cell has already been edited in this batch.
+        if (cell->dirty) {
+            return;
+        }
+        //Grows the array of edited cells if it is full.
+        if (num_batch_cells == batch_capacity) {
+            int capacity = batch_capacity == 0 ? 64 : batch_capacity * 2;
+            Cell** cells = realloc(batch_cells, capacity * sizeof(Cell*));
+            //Checks if the memory allocation was successful, otherwise recalculates the cell straight away.
+            if (cells == NULL) {
+                display_cell(cell);
+                recalculate_dependents(cell);
+                return;
+            }
+            batch_cells = cells;
+            batch_capacity = capacity;
+        }
+        cell->dirty = 1;
+        batch_cells[num_batch_cells++] = cell;
+        return;
+    }
+    if (lazy_evaluation) {
+        mark_stale(&cell, 1);
+    } else {
+        recalculate_dependents(cell);
+    }
+}
+
+void set_lazy_evaluation(int enabled) {
+    //Brings every result up to date before going back to recalculating them straight away.
+    if (!enabled) {
+        evaluate_stale_cells();
+    }
+    lazy_evaluation = enabled != 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void free_sheet();
+
+/*
+ * Initializes the spreadsheet with the given size. No tiles are allocated until cells are written to. A spreadsheet
+ * which was already initialized is freed first.
+ * num_rows: Number of rows in the spreadsheet.
+ * num_cols: Number of columns in the spreadsheet.
+ */
+void model_init(int num_rows, int num_cols) {
+    if (sheet.tiles != NULL) {
+        free_sheet();
+    }
+    sheet.num_rows = num_rows;
+    sheet.num_cols = num_cols;
+    //Rounds up, so that the last tiles cover any rows and columns left over.
+    sheet.tile_rows = (num_rows + TILE_ROWS - 1) / TILE_ROWS;
+    sheet.tile_cols = (num_cols + TILE_COLS - 1) / TILE_COLS;
+    sheet.tiles = calloc((size_t) sheet.tile_rows * sheet.tile_cols, sizeof(Tile*));
+    sheet.values = calloc((size_t) sheet.tile_rows * sheet.tile_cols, sizeof(*sheet.values));
+    sheet.value_epochs = calloc((size_t) sheet.tile_rows * sheet.tile_cols, sizeof(*sheet.value_epochs));
+    sheet.versions = calloc((size_t) sheet.tile_rows * sheet.tile_cols, sizeof(*sheet.versions));
+    sheet.column_dependents = calloc(num_cols, sizeof(ColumnDependents));
+    //Adds levels of range buckets until a single bucket covers every row of tiles.
+    sheet.range_buckets = 1;
+    sheet.range_levels = 1;
+    while (sheet.range_buckets < sheet.tile_rows) {
+        sheet.range_buckets *= 2;
+        sheet.range_levels++;
+    }
+    //Checks if the memory allocation was successful, otherwise leaves an empty spreadsheet.
+    if (sheet.tiles == NULL || sheet.values == NULL || sheet.value_epochs == NULL || sheet.versions == NULL ||
+        sheet.column_dependents == NULL) {
+        sheet.num_rows = 0;
+        sheet.num_cols = 0;
+        sheet.tile_rows = 0;
+        sheet.tile_cols = 0;
+    }
+}
+
+/*
+ * Frees every cell of the spreadsheet and the snapshot it was loaded from, leaving a spreadsheet without any rows or
+ * columns until it is initialized again. The formulas, dependents and text of the cells are all in the arena, so only
+ * the tiles are freed one by one. Any views of the spreadsheet are closed.
+ */
+void free_sheet() {
+    free_tile_versions();
+    for (int i = 0; i < sheet.tile_rows * sheet.tile_cols; i++) {
+        free(sheet.tiles[i]);
+        if (!is_snapshot_memory(sheet.values[i])) {
+            free(sheet.values[i]);
+        }
+    }
+    free(sheet.tiles);
+    free(sheet.values);
+    free(sheet.value_epochs);
+    free(sheet.versions);
+    free(sheet.column_dependents);
+    memset(&sheet, 0, sizeof(sheet));
+    free_string_pool();
+    //Frees the formulas, dependents arrays and strings all at once.
+    arena_reset(&arena);
+
+    //Unmaps the snapshot once nothing uses it.
+    if (snapshot.data != NULL) {
+        unmap_file(snapshot.data, snapshot.size);
+    }
+    memset(&snapshot, 0, sizeof(snapshot));
+    num_batch_cells = 0;
+    num_stale_cells = 0;
+    topological_order.lowest = 0;
+    topological_order.highest = 0;
+
+    //The contents held by the journal have been freed along with the arena and the string pool.
+    journal.first = 0;
+    journal.position = 0;
+    journal.count = 0;
+    journal.num_bytes = 0;
+    journal.discarding = 0;
+}
+
+void get_memory_stats(MemoryStats* stats) {
+    stats->num_tiles = sheet.num_tiles;
+    stats->num_formulas = sheet.num_formulas;
+    stats->num_strings = string_pool.num_used;
+    stats->num_blocks = arena.num_blocks;
+    stats->num_bytes = arena.num_bytes;
+    stats->num_allocations = arena.num_allocations;
+    stats->num_journal_bytes = journal.num_bytes;
+    stats->num_tile_versions = views.num_versions;
+}
+
+void model_reset() {
+    //Replaces the spreadsheet with an empty one of the same size.
+    int num_rows = sheet.num_rows;
+    int num_cols = sheet.num_cols;
+    free_sheet();
+    model_init(num_rows, num_cols);
+
+    //Clears the cells shown by the interface.
+    display_viewport();
+}
+
+void set_viewport(int first_row, int first_col, int num_rows, int num_cols) {
+    viewport.first_row = first_row;
+    viewport.first_col = first_col;
+    viewport.num_rows = num_rows;
+    viewport.num_cols = num_cols;
+    display_viewport();
+}
+
+
+/*
+ * Releases the contents of a cell before they are replaced, so that nothing the cell held is leaked. Numbers hold
+ * nothing, so replacing a number with another number doesn't allocate or free anything.
+ * cell: Cell whose contents are released. Its type and value are left for the caller to replace.
+ */
+void release_cell_contents(Cell* cell) {
+    //Checks if the cell contains a formula.
+    if (cell->type == FORMULA) {
+        //Stops the cells referenced by the formula from recalculating this cell.
+        remove_dependencies(cell);
+        //Frees the memory allocated for the formula.
+        free_formula(cell->value.formula);
+        cell->value.formula = NULL;
+        cell->stale = 0;
+    }
+        //Checks if the cell contains a string and isn't already empty.
+    else if (cell->type == TEXT) {
+        //Releases the cell text string, which is freed once no other cell holds the same text.
+        release_string(cell->value.text);
+        cell->value.text = 0;
+    }
+}
+
+/*
+ * Determines how much memory a journal entry holds, including its formula or text.
+ * entry: Entry which is measured.
+ * return: Number of bytes held by the entry.
+ */
+size_t get_journal_entry_size(JournalEntry* entry) {
+    size_t size = sizeof(JournalEntry);
+    if (entry->type == FORMULA && entry->payload.formula != NULL) {
+        size += get_formula_size(entry->payload.formula);
+    } else if (entry->type == TEXT && entry->payload.text != 0) {
+        size += strlen(get_string(entry->payload.text)) + 1;
+    }
+    return size;
+}
+
+/*
+ * Forgets some edits of the journal, releasing the contents they hold.
+ * first: Index of the first edit which is forgotten.
+ * last: Index after the last edit which is forgotten.
+ */
+void forget_journal_edits(size_t first, size_t last) {
+    for (size_t i = first; i < last; i++) {
+        JournalEntry* entry = &journal.entries[i];
+        journal.num_bytes -= get_journal_entry_size(entry);
+        if (entry->type == FORMULA) {
+            free_formula(entry->payload.formula);
+        } else if (entry->type == TEXT && entry->payload.text != 0) {
+            release_string(entry->payload.text);
+        }
+    }
+}
+
+/*
+ * Forgets the oldest groups of edits until the journal fits in its budget. If the edits being recorded don't fit on
+ * their own, they are forgotten too, along with the rest of their batch.
+ */
+void trim_journal() {
+    while (journal.num_bytes > journal.budget && journal.first < journal.count) {
+        //Finds the end of the oldest group.
+        size_t end = journal.first + 1;
+        while (end < journal.count && !journal.entries[end].starts_group) {
+            end++;
+        }
+        //Stops recording the rest of the batch if the group is the one being recorded.
+        if (end == journal.count && batch_depth > 0) {
+            journal.discarding = 1;
+        }
+        forget_journal_edits(journal.first, end);
+        journal.first = end;
+    }
+    if (journal.first == journal.count) {
+        journal.first = 0;
+        journal.position = 0;
+        journal.count = 0;
+    }
+        //Moves the kept edits to the start of the array once most of it has been forgotten.
+    else if (journal.first > journal.count / 2) {
+        memmove(journal.entries, journal.entries + journal.first,
+                (journal.count - journal.first) * sizeof(JournalEntry));
+        journal.position -= journal.first;
+        journal.count -= journal.first;
+        journal.first = 0;
+    }
+}
+
+/*
+ * Moves the contents of a cell into a journal entry, leaving the cell empty. The cell stops depending on the cells its
+ * formula references.
+ * cell: Cell whose contents are moved.
+ * entry: Entry the contents are moved to.
+ */
+void detach_cell_contents(Cell* cell, JournalEntry* entry) {
+    entry->type = (unsigned char) cell->type;
+    if (cell->type == FORMULA) {
+        remove_dependencies(cell);
+        entry->payload.formula = cell->value.formula;
+        cell->stale = 0;
+    } else if (cell->type == NUMBER) {
+        entry->payload.number = get_column_number(cell);
+    } else {
+        entry->payload.text = cell->value.text;
+    }
+    cell->type = TEXT;
+    cell->value.text = 0;
+}
+
+/*
+ * Records an edit of a cell in the journal, if one is kept, before the cell is changed. The contents of the cell are
+ * moved into the journal, so that releasing them afterwards does nothing. Any edits which had been undone can no
+ * longer be redone.
+ * cell: Cell which is about to be changed.
+ */
+void record_cell_edit(Cell* cell) {
+    if (journal.budget == 0) {
+        return;
+    }
+    //Each batch is a single group of edits, and every other edit is a group of its own.
+    int starts_group = batch_depth == 0 || journal.new_group;
+    journal.new_group = 0;
+    if (starts_group) {
+        journal.discarding = 0;
+    }
+    if (journal.discarding) {
+        return;
+    }
+    forget_journal_edits(journal.position, journal.count);
+    journal.count = journal.position;
+
+    //Grows the array of edits if it is full.
+    if (journal.count == journal.capacity) {
+        size_t capacity = journal.capacity == 0 ? 64 : journal.capacity * 2;
+        JournalEntry* entries = realloc(journal.entries, capacity * sizeof(JournalEntry));
+        //Checks if the memory allocation was successful, otherwise the journal is forgotten along with the rest of
+        //the batch, since only part of it could be undone.
+        if (entries == NULL) {
+            forget_journal_edits(journal.first, journal.count);
+            journal.first = 0;
+            journal.position = 0;
+            journal.count = 0;
+            journal.discarding = batch_depth > 0;
+            return;
+        }
+        journal.entries = entries;
+        journal.capacity = capacity;
+    }
+
+    JournalEntry* entry = &journal.entries[journal.count++];
+    entry->row = cell->row;
+    entry->col = cell->col;
+    entry->starts_group = (unsigned char) starts_group;
+    detach_cell_contents(cell, entry);
+    journal.num_bytes += get_journal_entry_size(entry);
+    journal.position = journal.count;
+    trim_journal();
+}
+
+/*
+ * Swaps the contents of a cell with those held by a journal entry, which undoes the edit of the entry or redoes it.
+ * The cell is recalculated and displayed as if it had been edited.
+ * entry: Entry whose contents are swapped into its cell.
+ */
+void swap_journal_entry(JournalEntry* entry) {
+    Cell* cell = get_cell_for_writing(entry->row, entry->col);
+    //Checks if the tile of the cell couldn't be allocated, in which case the entry is left as it is.
+    if (cell == NULL) {
+        return;
+    }
+    JournalEntry swapped = *entry;
+    detach_cell_contents(cell, &swapped);
+
+    //Installs the contents of the entry into the cell.
+    cell->type = (CellType) entry->type;
+    if (entry->type == FORMULA) {
+        cell->value.formula = entry->payload.formula;
+        add_dependencies(cell);
+    } else if (entry->type == NUMBER) {
+        set_column_value(cell, VALUE_NUMBER, entry->payload.number);
+    } else {
+        cell->value.text = entry->payload.text;
+        set_column_value(cell, entry->payload.text != 0 ? VALUE_TEXT : VALUE_EMPTY, 0.0);
+    }
+    journal.num_bytes += get_journal_entry_size(&swapped) - get_journal_entry_size(entry);
+    *entry = swapped;
+    cell_changed(cell);
+}
+
+/*
+ * Sets the contents of a cell from the text entered for it, without taking ownership of the text.
+ * cell: Cell which is changed.
+ * text: Text entered for the cell.
+ */
+void set_cell_contents(Cell* cell, const char* text) {
+    ROW row;
+    COL col;
+    get_cell_position(cell, &row, &col);
+
+    //Moves the old contents of the cell into the journal, or releases them, before the new contents are installed.
+    record_cell_edit(cell);
+    release_cell_contents(cell);
+
+    //Checks if the user is attempting to create a formula.
+    if (text[0] == '=') {
+        //Changes the cell type to FORMULA.
+        cell->type = FORMULA;
+        //Converts the string to a formula.
+        cell->value.formula = string_to_formula(text);
+        //Makes the cells referenced by the formula recalculate this cell when they change.
+        //The formula is evaluated and displayed along with its dependents once the cell has been changed.
+        add_dependencies(cell);
+    }
+        //Tries converting the input text to a number.
+    else {
+        char* end;
+        double number = parse_number(text, &end);
+
+        //Checks if the conversion to a number was successful.
+        if (end != text) {
+            //Changes the cell type to NUMBER.
+            cell->type = NUMBER;
+            //Stores the number in the tile columns.
+            set_column_value(cell, VALUE_NUMBER, number);
+            //Updates the cell display with the number, unless it is displayed once the batch of edits ends.
+            if (batch_depth == 0 && is_visible(row, col)) {
+                update_cell_display(row, col, text);
+            }
+        }
+            //If the conversion failed, then the input text is a string
+        else {
+            //Changes the cell type to TEXT.
+            cell->type = TEXT;
+            //Sets the cell value to the string, which is shared with any other cell holding the same text.
+            cell->value.text = intern_string(text);
+            set_column_value(cell, VALUE_TEXT, 0.0);
+            //Updates the cell display with the string, unless it is displayed once the batch of edits ends.
+            if (batch_depth == 0 && is_visible(row, col)) {
+                update_cell_display(row, col, text);
+            }
+        }
+    }
+    //Recalculates the changed cell if it contains a formula, and the formulas which depend on it.
+    cell_changed(cell);
+}
+
+/*
+ * Sets the value of a cell based on user input.
+ * text: String which contains the user input.
+ */
+void set_cell_value(ROW row, COL col, char *text) {
+    //Retrieves the cell, allocating its tile if this is the first time it is written to.
+    Cell* cell = get_cell_for_writing(row, col);
+    //Checks if the cell is out of bounds or couldn't be allocated.
+    if (cell != NULL) {
+        set_cell_contents(cell, text);
+    }
+    //Frees the string containing the user input.
+    free(text);
+}
+
+/*
+ * Clears the value of a cell.
+ * row: Row of the cell which is going to be cleared.
+ * col: Column of the cell which is going to be cleared.
+ */
+void clear_cell(ROW row, COL col) {
+    // TODO: implement this.
+    Cell* cell = get_cell(row, col);
+    //Checks if the cell has never been written to, in which case it is already empty.
+    if (cell == NULL) {
+        if (batch_depth == 0 && is_visible(row, col)) {
+            update_cell_display(row, col, "");
+        }
+        return;
+    }
+
+    record_cell_edit(cell);
+    release_cell_contents(cell);
+
+    //Sets the cell type to TEXT.
+    cell->type = TEXT;
+    //Sets the cell value to no text.
+    cell->value.text = 0;
+    set_column_value(cell, VALUE_EMPTY, 0.0);
+
+    //Updates the cell display with an empty string, unless it is displayed once the batch of edits ends.
+    if (batch_depth == 0 && is_visible(row, col)) {
+        update_cell_display(row, col, "");
+    }
+
+    //Recalculates the formulas which depend on the cleared cell.
+    cell_changed(cell);
+}
+
+/*
+ * Starts a batch of edits, which are recalculated and displayed together once the batch ends.
+ */
+void begin_batch(void) {
+    //The edits of the batch are undone together.
+    if (batch_depth == 0) {
+        journal.new_group = 1;
+    }
+    batch_depth++;
+}
+
+/*
+ * Ends a batch of edits. The edited cells which don't contain a formula are displayed, and then every edited cell and
+ * the formulas which depend on them are recalculated in a single pass, which displays each affected formula.
+ */
+void end_batch(void) {
+    //Checks if the batch is nested inside another one, which finishes it instead.
+    if (batch_depth == 0 || --batch_depth > 0) {
+        return;
+    }
+    for (int i = 0; i < num_batch_cells; i++) {
+        display_cell(batch_cells[i]);
+    }
+    if (lazy_evaluation) {
+        mark_stale(batch_cells, num_batch_cells);
+    } else {
+        recalculate_cells(batch_cells, num_batch_cells);
+    }
+    num_batch_cells = 0;
+}
+
+/*
+ * Applies several edits as a single batch.
+ * edits: Edits which are applied, in order. An edit without text clears the cell.
+ * count: Number of edits.
+ */
+void set_cells_batch(const CellEdit *edits, size_t count) {
+    begin_batch();
+    for (size_t i = 0; i < count; i++) {
+        if (edits[i].text == NULL) {
+            clear_cell(edits[i].row, edits[i].col);
+        } else {
+            set_cell_value(edits[i].row, edits[i].col, edits[i].text);
+        }
+    }
+    end_batch();
+}
+
+int undo(void) {
+    //Checks if a batch is in progress, or there is nothing to undo.
+    if (batch_depth > 0 || journal.position == journal.first) {
+        return 0;
+    }
+    //Undoes the edits of the last group from the newest to the oldest, as a single batch.
+    begin_batch();
+    do {
+        journal.position--;
+        swap_journal_entry(&journal.entries[journal.position]);
+    } while (!journal.entries[journal.position].starts_group);
+    end_batch();
+    return 1;
+}
+
+int redo(void) {
+    //Checks if a batch is in progress, or there is nothing to redo.
+    if (batch_depth > 0 || journal.position == journal.count) {
+        return 0;
+    }
+    //Redoes the edits of the next group from the oldest to the newest, as a single batch.
+    begin_batch();
+    do {
+        swap_journal_entry(&journal.entries[journal.position]);
+        journal.position++;
+    } while (journal.position < journal.count && !journal.entries[journal.position].starts_group);
+    end_batch();
+    return 1;
+}
+
+void set_journal_budget(size_t num_bytes) {
+    //Forgets every edit, so that the journal starts again within its new budget.
+    forget_journal_edits(journal.first, journal.count);
+    journal.first = 0;
+    journal.position = 0;
+    journal.count = 0;
+    journal.discarding = 0;
+    journal.budget = num_bytes;
+}
+
+/*
+ * Copies text into a buffer, cutting it short if it doesn't fit.
+ * buffer: Buffer the text is copied to, with room for 'capacity' characters.
+ * capacity: Size of the buffer, including the null terminator. Nothing is written if it is 0.
+ * text: Text which is copied.
+ * length: Length of the text.
+ */
+void copy_text_into(char* buffer, size_t capacity, const char* text, size_t length) {
+    if (capacity == 0) {
+        return;
+    }
+    size_t copied = length < capacity ? length : capacity - 1;
+    memcpy(buffer, text, copied);
+    buffer[copied] = '\0';
+}
+
+/*
+ * Writes a textual version of a cell for editing into a buffer, without allocating any memory.
+ * row: Row of the cell which is going to be retrieved.
+ * col: Column of the cell which is going to be retrieved.
+ * buffer: Buffer the text is written to, with room for 'capacity' characters.
+ * capacity: Size of the buffer, including the null terminator.
+ * return: Length of the whole text, not counting the null terminator.
+ */
+size_t get_textual_value_into(ROW row, COL col, char *buffer, size_t capacity) {
+    //Retrieves the cell, which is NULL if it has never been written to.
+    Cell* cell = get_cell(row, col);
+
+    char number[NUMBER_MAX_LENGTH + 1];
+    const char* text = "";
+    size_t length = 0;
+    //Checks if the cell contains a formula, whose text is kept with it.
+    if (cell != NULL && cell->type == FORMULA) {
+        if (cell->value.formula != NULL) {
+            text = get_formula_text(cell->value.formula);
+            length = (size_t) cell->value.formula->text_length;
+        }
+    }
+        //Checks if the cell contains a number.
+    else if (cell != NULL && cell->type == NUMBER) {
+        //Writes the number with every digit needed to read it back as the same number.
+        length = format_number(get_column_number(cell), number, NUMBER_MAX_LENGTH);
+        text = number;
+    }
+        //Checks if the cell contains a string, otherwise it is empty.
+    else if (cell != NULL && cell->value.text != 0) {
+        text = get_string(cell->value.text);
+        length = strlen(text);
+    }
+    copy_text_into(buffer, capacity, text, length);
+
+    //Returns the length of the text, so that the caller can find out if it was cut short.
+    return length;
+}
+
+/*
+ * Creates a textual version of a cell for editing.
+ * row: Row of the cell which is going to be retrieved.
+ * col: Column of the cell which is going to be retrieved.
+ * return: String which contains the cell value.
+ */
+char *get_textual_value(ROW row, COL col) {
+    //Writes the text onto the stack first, since it is usually short, and then copies it with exactly its length.
+    char local[TEXTUAL_VALUE_BUFFER_SIZE];
+    size_t length = get_textual_value_into(row, col, local, sizeof(local));
+
+    //Creates a string which will contain the cell value.
+    char *textual_value = malloc(length + 1);
+    //Checks if the memory allocation was successful.
+    if (textual_value == NULL) {
+        return NULL;
+    }
+    if (length < sizeof(local)) {
+        memcpy(textual_value, local, length + 1);
+    } else {
+        get_textual_value_into(row, col, textual_value, length + 1);
+    }
+    return textual_value;
+}
+
+SheetView *open_sheet_view(void) {
+    //Checks if a batch is in progress, since the cells it has edited haven't been recalculated yet.
+    if (batch_depth > 0) {
+        return NULL;
+    }
+    //Brings every result up to date, so that the view doesn't see any formula which is out of date.
+    evaluate_stale_cells();
+    release_closed_views();
+    for (int i = 0; i < MAX_SHEET_VIEWS; i++) {
+        SheetView* view = &views.slots[i];
+        if (atomic_load_explicit(&view->epoch, memory_order_acquire) == 0) {
+            //Starts a new epoch, so that every value written from now on is written to a copy of its tile.
+            views.epoch++;
+            views.newest_epoch = views.epoch;
+            view->num_rows = sheet.num_rows;
+            view->num_cols = sheet.num_cols;
+            view->tile_cols = sheet.tile_cols;
+            view->cached_tile = -1;
+            view->cached_values = NULL;
+            atomic_store_explicit(&view->epoch, views.epoch, memory_order_relaxed);
+            return view;
+        }
+    }
+    return NULL;
+}
+
+ViewValueKind get_view_value(SheetView *view, int row, int col, double *number) {
+    *number = 0.0;
+    //Checks if the cell is out of bounds.
+    if (row < 0 || row >= view->num_rows || col < 0 || col >= view->num_cols) {
+        return VIEW_EMPTY;
+    }
+    int index = (row / TILE_ROWS) * view->tile_cols + col / TILE_COLS;
+    if (index != view->cached_tile) {
+        view->cached_values = get_view_tile_values(view, index);
+        view->cached_tile = index;
+    }
+    if (view->cached_values == NULL) {
+        return VIEW_EMPTY;
+    }
+    ValueKind kind = (ValueKind) view->cached_values->kinds[col % TILE_COLS][row % TILE_ROWS];
+    if (kind == VALUE_NUMBER) {
+        *number = view->cached_values->numbers[col % TILE_COLS][row % TILE_ROWS];
+        return VIEW_NUMBER;
+    }
+    return kind == VALUE_TEXT ? VIEW_TEXT : kind == VALUE_ERROR ? VIEW_ERROR : VIEW_EMPTY;
+}
+
+void close_sheet_view(SheetView *view) {
+    //Releases the reads made through the view to the thread which frees the versions it read.
+    if (view != NULL) {
+        atomic_store_explicit(&view->epoch, 0, memory_order_release);
+    }
+}
+
+void get_recalc_stats(RecalcStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+#ifdef MODEL_STATS
+    stats->enabled = 1;
+    stats->num_recalculations = recalc_counters.num_recalculations;
+    stats->num_evaluations = atomic_load_explicit(&recalc_counters.num_evaluations, memory_order_relaxed);
+    stats->num_cell_reads = atomic_load_explicit(&recalc_counters.num_cell_reads, memory_order_relaxed);
+    stats->num_stale_reads = atomic_load_explicit(&recalc_counters.num_stale_reads, memory_order_relaxed);
+    stats->num_circular = atomic_load_explicit(&recalc_counters.num_circular, memory_order_relaxed);
+    stats->total_seconds = (double) recalc_counters.total_nanoseconds / 1e9;
+    stats->max_seconds = (double) recalc_counters.max_nanoseconds / 1e9;
+    memcpy(stats->histogram, recalc_counters.histogram, sizeof(stats->histogram));
+#endif
+}
+
+void reset_recalc_stats(void) {
+#ifdef MODEL_STATS
+    memset(&recalc_counters, 0, sizeof(recalc_counters));
+#endif
+}
+
+/*
+ * Adds a cell to the cells read by the most formulas, if it is read by more than the last of them.
+ * stats: Graph metrics being measured.
+ * cell: Cell which is read by formulas.
+ * count: Number of times formulas read the cell.
+ */
+void add_hottest_cell(GraphStats* stats, Cell* cell, size_t count) {
+    if (stats->num_hottest == GRAPH_STATS_HOTTEST && stats->hottest[GRAPH_STATS_HOTTEST - 1].count >= count) {
+        return;
+    }
+    //Moves the cells read fewer times down to make room, dropping the last one if the list is full.
+    int i = stats->num_hottest < GRAPH_STATS_HOTTEST ? stats->num_hottest++ : GRAPH_STATS_HOTTEST - 1;
+    while (i > 0 && stats->hottest[i - 1].count < count) {
+        stats->hottest[i] = stats->hottest[i - 1];
+        i--;
+    }
+    stats->hottest[i].row = cell->row;
+    stats->hottest[i].col = cell->col;
+    stats->hottest[i].count = count;
+}
+
+void get_graph_stats(GraphStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    int num_cells = 0;
+    int num_ready = 0;
+    recalc_pass++;
+
+    //Finds every formula and every cell read by a formula, loading any tiles which are still in a snapshot.
+    for (int i = 0; i < sheet.tile_rows * sheet.tile_cols; i++) {
+        Tile* tile = get_tile(i);
+        if (tile == NULL) {
+            continue;
+        }
+        for (int row = 0; row < TILE_ROWS; row++) {
+            for (int col = 0; col < TILE_COLS; col++) {
+                Cell* cell = &tile->cells[row][col];
+                //Skips the cells of the last tiles which are past the edge of the spreadsheet.
+                if (cell->row >= sheet.num_rows || cell->col >= sheet.num_cols) {
+                    continue;
+                }
+                size_t count = 0;
+                DependentIterator iterator = iterate_dependents(cell);
+                while (next_dependent(&iterator) != NULL) {
+                    count++;
+                }
+                if (cell->type != FORMULA && count == 0) {
+                    continue;
+                }
+                if (count > 0) {
+                    add_hottest_cell(stats, cell, count);
+                }
+                if (cell->type == FORMULA && get_formula_fan_in(cell->value.formula) > stats->max_fan_in.count) {
+                    stats->max_fan_in.row = cell->row;
+                    stats->max_fan_in.col = cell->col;
+                    stats->max_fan_in.count = get_formula_fan_in(cell->value.formula);
+                }
+                if (ensure_recalc_capacity(num_cells)) {
+                    cell->visit_mark = recalc_pass;
+                    atomic_store_explicit(&cell->pending_inputs, 0, memory_order_relaxed);
+                    recalc_cells[num_cells++] = cell;
+                }
+            }
+        }
+    }
+
+    //Measures the longest chain by going through the cells in topological order, a layer at a time, where each layer
+    //holds the cells whose inputs are all in the layers before it. Cells in a circular dependency are never reached.
+    for (int i = 0; i < num_cells; i++) {
+        DependentIterator iterator = iterate_dependents(recalc_cells[i]);
+        Cell* dependent;
+        while ((dependent = next_dependent(&iterator)) != NULL) {
+            if (dependent->visit_mark == recalc_pass) {
+                atomic_fetch_add_explicit(&dependent->pending_inputs, 1, memory_order_relaxed);
+            }
+        }
+    }
+    for (int i = 0; i < num_cells; i++) {
+        if (atomic_load_explicit(&recalc_cells[i]->pending_inputs, memory_order_relaxed) == 0) {
+            recalc_ready[num_ready++] = recalc_cells[i];
+        }
+    }
+    int layer_end = 0;
+    for (int i = 0; i < num_ready; i++) {
+        if (i == layer_end) {
+            stats->max_depth++;
+            layer_end = num_ready;
+        }
+        DependentIterator iterator = iterate_dependents(recalc_ready[i]);
+        Cell* dependent;
+        while ((dependent = next_dependent(&iterator)) != NULL) {
+            if (dependent->visit_mark == recalc_pass &&
+                atomic_fetch_sub_explicit(&dependent->pending_inputs, 1, memory_order_relaxed) == 1) {
+                recalc_ready[num_ready++] = dependent;
+            }
+        }
+    }
+}
+
+int save_model_stats(const char *path) {
+    FILE* file = fopen(path, "w");
+    //Checks if the file could be opened.
+    if (file == NULL) {
+        return -1;
+    }
+    RecalcStats recalc;
+    get_recalc_stats(&recalc);
+    if (recalc.enabled) {
+        fprintf(file, "Recalculations: %zu, taking %.6f s in total and %.6f s at most\n", recalc.num_recalculations,
+                recalc.total_seconds, recalc.max_seconds);
+        fprintf(file, "Formulas evaluated: %zu\n", recalc.num_evaluations);
+        fprintf(file, "Cells read by formulas: %zu, of which %zu were cached and %zu stale\n", recalc.num_cell_reads,
+                recalc.num_cell_reads - recalc.num_stale_reads, recalc.num_stale_reads);
+        fprintf(file, "Cells in circular dependencies: %zu\n", recalc.num_circular);
+        fprintf(file, "Recalculations taking under:\n");
+        for (int i = 0; i < RECALC_HISTOGRAM_SIZE; i++) {
+            if (recalc.histogram[i] == 0) {
+                continue;
+            }
+            if (i == RECALC_HISTOGRAM_SIZE - 1) {
+                fprintf(file, "  longer: %zu\n", recalc.histogram[i]);
+            } else {
+                fprintf(file, "  %llu us: %zu\n", 1ULL << i, recalc.histogram[i]);
+            }
+        }
+    } else {
+        fprintf(file, "Recalculations aren't counted, since the model was built without MODEL_STATS\n");
+    }
+
+    MemoryStats memory;
+    get_memory_stats(&memory);
+    fprintf(file, "Tiles: %zu, of which %zu copies kept for views\n", memory.num_tiles, memory.num_tile_versions);
+    fprintf(file, "Formulas: %zu, strings: %zu\n", memory.num_formulas, memory.num_strings);
+    fprintf(file, "Blocks: %zu holding %zu bytes, after %zu allocations\n", memory.num_blocks, memory.num_bytes,
+            memory.num_allocations);
+    fprintf(file, "Journal: %zu bytes\n", memory.num_journal_bytes);
+
+    GraphStats graph;
+    get_graph_stats(&graph);
+    char reference[MAX_REFERENCE_LENGTH + 1];
+    fprintf(file, "Longest chain of cells read by formulas: %d\n", graph.max_depth);
+    if (graph.max_fan_in.count > 0) {
+        write_position_reference(graph.max_fan_in.row, graph.max_fan_in.col, reference);
+        fprintf(file, "Formula reading the most cells: %s, reading %zu\n", reference, graph.max_fan_in.count);
+    }
+    fprintf(file, "Cells read by the most formulas:\n");
+    for (int i = 0; i < graph.num_hottest; i++) {
+        write_position_reference(graph.hottest[i].row, graph.hottest[i].col, reference);
+        fprintf(file, "  %s: %zu\n", reference, graph.hottest[i].count);
+    }
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Size of the buffer files are written through.
+#define CSV_BUFFER_SIZE 65536
+//Smallest share of a CSV file worth giving a worker of its own. Smaller files are parsed on the calling thread.
+#define CSV_CHUNK_SIZE (256 * 1024)
+//Size of the windows of whole rows a CSV file is loaded through, so that only the fields of one window are held at a
+//time. A window only grows past this to hold a row which is longer.
+#define CSV_WINDOW_SIZE (8 * 1024 * 1024)
+//Number of chunks a CSV file is split into for each worker, so that workers which finish their chunks early can take
+//over the remaining ones.
+#define CHUNKS_PER_WORKER 4
+
+/*
+ * Enum to represent what a field of a CSV file holds once it is parsed.
+ * CSV_EMPTY: The field is empty, which clears its cell.
+ * CSV_NUMBER: The field is a number.
+ * CSV_TEXT: The field is text.
+ * CSV_FORMULA: The field is a formula, which has been compiled.
+ */
+typedef enum {
+    CSV_EMPTY,
+    CSV_NUMBER,
+    CSV_TEXT,
+    CSV_FORMULA
+} CsvFieldKind;
+
+/*
+ * Struct to represent a field of a CSV file once it has been parsed, until it is stored in its cell.
+ * row: Row of the cell.
+ * col: Column of the cell.
+ * kind: What the field holds.
+ * number: Number in the field, if it is a number.
+ * text: Text of the field, which is kept in the window of the file it was parsed from, if it is text.
+ * formula: Formula compiled from the field, if it is a formula. This is NULL if the memory allocation failed.
+ */
+typedef struct {
+    int row;
+    int col;
+    CsvFieldKind kind;
+    union {
+        double number;
+        const char* text;
+        Formula* formula;
+    } value;
+} CsvField;
+
+/*
+ * Struct to represent a chunk of a CSV file, a run of whole rows which is parsed by a single worker.
+ * start: First character of the chunk.
+ * end: Character after the last character of the chunk.
+ * first_row: Row of the first line of the chunk.
+ * fields: Fields parsed from the chunk, in the order they appear in the file.
+ * num_fields: Number of fields in the array.
+ * capacity: Number of fields the array has room for.
+ * num_rows: Number of rows in the chunk, counting a last row without a new line.
+ * failed: Set if a memory allocation failed while the chunk was parsed.
+ */
+typedef struct {
+    char* start;
+    char* end;
+    int first_row;
+    CsvField* fields;
+    size_t num_fields;
+    size_t capacity;
+    int num_rows;
+    int failed;
+} CsvChunk;
+
+/*
+ * Struct to represent a block which was replaced while the formulas of a CSV file were registered with the cells they
+ * reference. The workers can't free the blocks they replace, since a block may belong to the arena of another thread,
+ * so the blocks are freed once every arena has been merged into the arena of the spreadsheet.
+ * memory: Block which was replaced.
+ * size: Size the block was allocated with.
+ */
+typedef struct {
+    void* memory;
+    size_t size;
+} RetiredBlock;
+
+/*
+ * Struct to hold the state of a CSV file while it is loaded, which is shared with the workers.
+ * chunks: Chunks the file is split into.
+ * num_chunks: Number of chunks.
+ * formula_cells: Cells which have been given a formula from the file, which hasn't been registered with the cells it
+ * references yet.
+ * num_formula_cells: Number of cells in the array.
+ * formula_capacity: Number of cells the array has room for.
+ * arenas: Arena of each worker, which the formulas and dependents arrays it allocates come from until the arenas are
+ * merged into the arena of the spreadsheet.
+ * retired: Blocks each worker has replaced.
+ * num_retired: Number of blocks each worker has replaced.
+ * retired_capacity: Number of blocks the array of each worker has room for.
+ */
+typedef struct {
+    CsvChunk* chunks;
+    int num_chunks;
+    Cell** formula_cells;
+    int num_formula_cells;
+    int formula_capacity;
+    Arena arenas[MAX_WORKERS];
+    RetiredBlock* retired[MAX_WORKERS];
+    int num_retired[MAX_WORKERS];
+    int retired_capacity[MAX_WORKERS];
+} CsvLoad;
+
+static CsvLoad csv_load;
+
+/*
+ * Finds the end of the last whole row in part of a CSV file which starts at the beginning of a row. Quotes are tracked
+ * the same way as while parsing, so that a new line inside quotes never ends a row.
+ * buffer: Characters of the file.
+ * size: Number of characters.
+ * return: Number of characters up to and including the new line ending the last whole row, or 0 if there isn't one.
+ */
+size_t find_csv_rows_end(const char* buffer, size_t size) {
+    size_t end = 0;
+    int quoted = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (buffer[i] == '"') {
+            quoted = !quoted;
+        } else if (buffer[i] == '\n' && !quoted) {
+            end = i + 1;
+        }
+    }
+    return end;
+}
+
+/*
+ * Splits a window of a CSV file into chunks of roughly equal size, each of which starts at the beginning of a row.
+ * Quotes are tracked the same way as while parsing, so that a new line inside quotes never starts a chunk.
+ * buffer: Characters of the window.
+ * size: Number of characters in the window.
+ * first_row: Row of the first line of the window.
+ * num_chunks: Number of chunks the window is split into at most, which the chunks array has room for.
+ * return: Number of chunks.
+ */
+int split_csv_window(char* buffer, size_t size, int first_row, int num_chunks) {
+    size_t share = size / num_chunks;
+    int count = 0;
+    int row = first_row;
+    int quoted = 0;
+    csv_load.chunks[0].start = buffer;
+    csv_load.chunks[0].first_row = first_row;
+    for (size_t i = 0; i < size && count + 1 < num_chunks; i++) {
+        if (buffer[i] == '"') {
+            quoted = !quoted;
+        } else if (buffer[i] == '\n' && !quoted) {
+            row++;
+            //Starts the next chunk after the first row which reaches the share of the current one.
+            if (i + 1 >= (count + 1) * share) {
+                csv_load.chunks[count].end = buffer + i + 1;
+                count++;
+                csv_load.chunks[count].start = buffer + i + 1;
+                csv_load.chunks[count].first_row = row;
+            }
+        }
+    }
+    csv_load.chunks[count].end = buffer + size;
+    return count + 1;
+}
+
+/*
+ * Parses a field of a CSV file, and adds it to the fields of its chunk. Fields outside the spreadsheet are skipped,
+ * since their cells can't be written to.
+ * worker: Index of the worker parsing the field, whose arena the formula is compiled into.
+ * chunk: Chunk which contains the field.
+ * text: Characters of the field, which are followed by at least one more character to hold the null terminator.
+ * length: Number of characters in the field.
+ * row: Row of the cell.
+ * col: Column of the cell.
+ * return: 1 if the field was added, or 0 if the array of fields couldn't be grown.
+ */
+int parse_csv_field(int worker, CsvChunk* chunk, char* text, size_t length, int row, int col) {
+    if (row >= sheet.num_rows || col >= sheet.num_cols) {
+        return 1;
+    }
+    //Grows the array of fields if it is full.
+    if (chunk->num_fields == chunk->capacity) {
+        size_t capacity = chunk->capacity == 0 ? 256 : chunk->capacity * 2;
+        CsvField* fields = realloc(chunk->fields, capacity * sizeof(CsvField));
+        //Checks if the memory allocation was successful.
+        if (fields == NULL) {
+            return 0;
+        }
+        chunk->fields = fields;
+        chunk->capacity = capacity;
+    }
+    CsvField* field = &chunk->fields[chunk->num_fields++];
+    field->row = row;
+    field->col = col;
+    field->kind = CSV_EMPTY;
+    if (length == 0) {
+        return 1;
+    }
+    //The field is parsed in place, the same way as text typed into a cell.
+    text[length] = '\0';
+    if (text[0] == '=') {
+        field->kind = CSV_FORMULA;
+        field->value.formula = compile_formula(text, &csv_load.arenas[worker]);
+        return 1;
+    }
+    char* end;
+    double number = parse_number(text, &end);
+    if (end != text) {
+        field->kind = CSV_NUMBER;
+        field->value.number = number;
+    } else {
+        field->kind = CSV_TEXT;
+        field->value.text = text;
+    }
+    return 1;
+}
+
+/*
+ * Parses the fields of a chunk of a CSV file. Quotes are removed and doubled quotes are replaced with single ones in
+ * place, which never makes a field longer, so each field ends up as a string in the buffer of the file.
+ * worker: Index of the worker parsing the chunk.
+ * chunk: Chunk which is parsed.
+ */
+void parse_csv_chunk(int worker, CsvChunk* chunk) {
+    char* field = chunk->start;
+    char* out = field;
+    int row = chunk->first_row;
+    int col = 0;
+    //Whether the parser is inside quotes, and whether the last character closed them.
+    int quoted = 0;
+    int closed_quote = 0;
+    for (char* position = chunk->start; position < chunk->end && !chunk->failed; position++) {
+        char c = *position;
+        //Inside quotes, everything but a quote is part of the field.
+        if (quoted) {
+            if (c == '"') {
+                quoted = 0;
+                closed_quote = 1;
+            } else {
+                *out++ = c;
+            }
+            continue;
+        }
+        if (c == '"') {
+            //Two quotes in a row inside quotes stand for a single quote.
+            if (closed_quote) {
+                *out++ = '"';
+            }
+            quoted = 1;
+            closed_quote = 0;
+            continue;
+        }
+        closed_quote = 0;
+        //Commas separate the fields of a row, and new lines separate the rows.
+        if (c == ',' || c == '\n') {
+            chunk->failed = !parse_csv_field(worker, chunk, field, (size_t) (out - field), row, col);
+            field = position + 1;
+            out = field;
+            if (c == ',') {
+                col++;
+            } else {
+                row++;
+                col = 0;
+            }
+        } else if (c != '\r') {
+            *out++ = c;
+        }
+    }
+    //Parses the last row if the file doesn't end with a new line.
+    if (!chunk->failed && (col > 0 || out > field)) {
+        chunk->failed = !parse_csv_field(worker, chunk, field, (size_t) (out - field), row, col);
+        row++;
+    }
+    chunk->num_rows = row - chunk->first_row;
+}
+
+/*
+ * Parses the chunks of a CSV file, claiming one chunk at a time until they have all been parsed.
+ * worker: Index of the worker.
+ */
+void parse_csv_chunks(int worker) {
+    int index;
+    while ((index = atomic_fetch_add_explicit(&pool.next_chunk, 1, memory_order_relaxed)) < csv_load.num_chunks) {
+        parse_csv_chunk(worker, &csv_load.chunks[index]);
+    }
+}
+
+/*
+ * Stores the parsed fields of a chunk of a CSV file in their cells. Formulas are installed without registering them
+ * with the cells they reference, which is done for every formula of the file at once.
+ * chunk: Chunk whose fields are stored.
+ */
+void store_csv_fields(CsvChunk* chunk) {
+    for (size_t i = 0; i < chunk->num_fields; i++) {
+        CsvField* field = &chunk->fields[i];
+        if (field->kind == CSV_EMPTY) {
+            //Only clears cells which have been written to, so that empty fields don't allocate any tiles.
+            Cell* cell = get_cell(field->row, field->col);
+            if (cell != NULL && get_column_kind(cell) != VALUE_EMPTY) {
+                clear_cell((ROW) field->row, (COL) field->col);
+            }
+            continue;
+        }
+        Cell* cell = get_cell_for_writing(field->row, field->col);
+        //Checks if the tile couldn't be allocated, in which case the field is dropped.
+        if (cell == NULL) {
+            if (field->kind == CSV_FORMULA && field->value.formula != NULL) {
+                arena_free(&arena, field->value.formula, get_formula_size(field->value.formula));
+            }
+            continue;
+        }
+        record_cell_edit(cell);
+        release_cell_contents(cell);
+        if (field->kind == CSV_NUMBER) {
+            cell->type = NUMBER;
+            set_column_value(cell, VALUE_NUMBER, field->value.number);
+        } else if (field->kind == CSV_TEXT) {
+            cell->type = TEXT;
+            cell->value.text = intern_string(field->value.text);
+            set_column_value(cell, VALUE_TEXT, 0.0);
+        } else {
+            cell->type = FORMULA;
+            cell->value.formula = field->value.formula;
+            if (cell->value.formula != NULL) {
+                sheet.num_formulas++;
+                //Grows the array of formula cells if it is full, otherwise registers the formula straight away.
+                if (csv_load.num_formula_cells == csv_load.formula_capacity) {
+                    int capacity = csv_load.formula_capacity == 0 ? 256 : csv_load.formula_capacity * 2;
+                    Cell** cells = realloc(csv_load.formula_cells, capacity * sizeof(Cell*));
+                    if (cells != NULL) {
+                        csv_load.formula_cells = cells;
+                        csv_load.formula_capacity = capacity;
+                    }
+                }
+                if (csv_load.num_formula_cells < csv_load.formula_capacity) {
+                    //Takes the cell out of the topological order until its formula is registered.
+                    cell->order = 0;
+                    csv_load.formula_cells[csv_load.num_formula_cells++] = cell;
+                } else {
+                    add_dependencies(cell);
+                }
+            }
+        }
+        cell_changed(cell);
+    }
+}
+
+/*
+ * Grows an array for a worker while it registers formulas, allocating the new array from the arena of the worker. The
+ * old array is retired rather than freed.
+ * worker: Index of the worker.
+ * memory: Array which is grown, or NULL if there isn't one yet.
+ * old_size: Size the array was allocated with.
+ * new_size: Size the array is grown to.
+ * return: Grown array, or NULL, leaving the array unchanged, if the memory couldn't be allocated.
  */
-typedef struct {
-    Cell* cell;
-    double constant;
-} Terms;
+void* grow_csv_array(int worker, void* memory, size_t old_size, size_t new_size) {
+    void* grown = arena_allocate(&csv_load.arenas[worker], new_size);
+    //Checks if the memory allocation was successful.
+    if (grown == NULL || memory == NULL) {
+        return grown;
+    }
+    memcpy(grown, memory, old_size);
+    //Grows the array of retired blocks if it is full. If it can't be grown, the old array is kept until the
+    //spreadsheet is reset.
+    if (csv_load.num_retired[worker] == csv_load.retired_capacity[worker]) {
+        int capacity = csv_load.retired_capacity[worker] == 0 ? 256 : csv_load.retired_capacity[worker] * 2;
+        RetiredBlock* retired = realloc(csv_load.retired[worker], capacity * sizeof(RetiredBlock));
+        if (retired == NULL) {
+            return grown;
+        }
+        csv_load.retired[worker] = retired;
+        csv_load.retired_capacity[worker] = capacity;
+    }
+    RetiredBlock block = {memory, old_size};
+    csv_load.retired[worker][csv_load.num_retired[worker]++] = block;
+    return grown;
+}
 
 /*
- * Struct to represent a formula.
- * Terms: Array of terms in the formula.
- * num_terms: Number of terms in the formula.
+ * Registers the formulas loaded from a CSV file with the cells they reference which belong to a worker. Each tile and
+ * each column belongs to a single worker, so no two workers ever change the dependents of the same cell or column.
+ * worker: Index of the worker.
  */
-typedef struct {
-    Terms terms[MAX_TERMS];
-    int num_terms;
-} Formula;
+void link_csv_formulas(int worker) {
+    for (int i = 0; i < csv_load.num_formula_cells; i++) {
+        Cell* cell = csv_load.formula_cells[i];
+        Formula* formula = cell->value.formula;
+        CellReference* references = get_formula_references(formula);
+        for (int j = 0; j < formula->num_references; j++) {
+            int row, col;
+            get_reference_position(references[j], &row, &col);
+            //The tiles of the referenced cells have already been allocated, so the cell is only looked up.
+            Cell* referenced = get_cell(row, col);
+            if (referenced == NULL || (row / TILE_ROWS + col / TILE_COLS) % pool.num_workers != worker ||
+                is_repeated_reference(formula, j)) {
+                continue;
+            }
+            //Grows the dependents array if it is full.
+            if (referenced->num_dependents == referenced->dependents_capacity) {
+                int capacity = referenced->dependents_capacity == 0 ? 4 : referenced->dependents_capacity * 2;
+                Cell** dependents = grow_csv_array(worker, referenced->dependents,
+                                                   referenced->dependents_capacity * sizeof(Cell*),
+                                                   capacity * sizeof(Cell*));
+                //Checks if the memory allocation was successful.
+                if (dependents == NULL) {
+                    continue;
+                }
+                referenced->dependents = dependents;
+                referenced->dependents_capacity = capacity;
+            }
+            referenced->dependents[referenced->num_dependents++] = cell;
+        }
+        RangeFunction* ranges = get_formula_ranges(formula);
+        for (int j = 0; j < formula->num_ranges; j++) {
+            Range* range = &ranges[j].range;
+            RangeDependent dependent = {cell, range->first_row, range->last_row};
+            for (int col = range->first_col; col <= range->last_col; col++) {
+                ColumnDependents* column = &sheet.column_dependents[col];
+                if (col % pool.num_workers != worker) {
+                    continue;
+                }
+                RangeBucket* bucket = get_range_bucket(column, dependent, &csv_load.arenas[worker]);
+                //Checks if the memory allocation was successful.
+                if (bucket == NULL) {
+                    continue;
+                }
+                //Grows the dependents array of the bucket if it is full.
+                if (bucket->num_dependents == bucket->dependents_capacity) {
+                    int capacity = bucket->dependents_capacity == 0 ? 4 : bucket->dependents_capacity * 2;
+                    RangeDependent* dependents = grow_csv_array(worker, bucket->dependents,
+                                                                bucket->dependents_capacity * sizeof(RangeDependent),
+                                                                capacity * sizeof(RangeDependent));
+                    //Checks if the memory allocation was successful.
+                    if (dependents == NULL) {
+                        continue;
+                    }
+                    bucket->dependents = dependents;
+                    bucket->dependents_capacity = capacity;
+                }
+                bucket->dependents[bucket->num_dependents++] = dependent;
+                column->num_dependents++;
+            }
+        }
+    }
+}
 
 /*
- * Union to represent the value of a cell.
- * text: Text of the cell.
- * number: Number of cell.
- * formula: Formula of cell.
+ * Moves the formulas and arrays allocated by each worker into the arena of the spreadsheet, and frees the blocks they
+ * retired.
  */
-typedef union {
-    char* text;
-    double number;
-    Formula* formula;
-} CellValue;
+void merge_csv_arenas() {
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        arena_merge(&arena, &csv_load.arenas[i]);
+        for (int j = 0; j < csv_load.num_retired[i]; j++) {
+            arena_free(&arena, csv_load.retired[i][j].memory, csv_load.retired[i][j].size);
+        }
+        csv_load.num_retired[i] = 0;
+    }
+}
 
 /*
- * Enum to represent the evaluation state of a cell. Used to determine circular dependencies.
- * EVALUATING: Cell is currently being evaluated.
- * EVALUATED: Cell has been evaluated.
+ * Registers the formulas loaded from a CSV file with the cells they reference. Large files share the work between the
+ * workers, once the tiles of every referenced cell have been allocated. A spreadsheet loaded from a snapshot is done
+ * on the calling thread, since registering a formula can load the tiles of cells from the snapshot.
  */
-typedef enum {
-    NOT_EVALUATED,
-    EVALUATING,
-    EVALUATED
-} EvaluationState;
+void link_csv_file() {
+    if (csv_load.num_formula_cells >= PARALLEL_THRESHOLD && snapshot.data == NULL && pool.num_workers == 0) {
+        start_workers();
+    }
+    if (csv_load.num_formula_cells < PARALLEL_THRESHOLD || snapshot.data != NULL || pool.num_workers <= 1) {
+        for (int i = 0; i < csv_load.num_formula_cells; i++) {
+            add_dependencies(csv_load.formula_cells[i]);
+        }
+        csv_load.num_formula_cells = 0;
+        return;
+    }
+    //Allocates the tiles of the referenced cells, which can't be done by several threads at once.
+    for (int i = 0; i < csv_load.num_formula_cells; i++) {
+        Formula* formula = csv_load.formula_cells[i]->value.formula;
+        CellReference* references = get_formula_references(formula);
+        for (int j = 0; j < formula->num_references; j++) {
+            int row, col;
+            get_reference_position(references[j], &row, &col);
+            get_cell_for_writing(row, col);
+        }
+    }
+    run_job(LINK_JOB);
+    merge_csv_arenas();
+    //Places the formulas in the topological order one at a time, which can't be shared between threads. Each one is
+    //only ordered against the formulas placed before it.
+    for (int i = 0; i < csv_load.num_formula_cells; i++) {
+        insert_into_order(csv_load.formula_cells[i]);
+    }
+    csv_load.num_formula_cells = 0;
+}
 
 /*
- * Struct to represent a cell in the spreadsheet.
- * type: Type of cell. ie, text, number, formula.
- * value: Value of cell. ie, text, number, formula.
- * EvalState: Evaluation state of cell. ie, evaluating or evaluated.
+ * Loads a window of a CSV file, which holds whole rows, into the spreadsheet. Windows which are large enough are split
+ * into chunks of whole rows, which are parsed by the workers at the same time, compiling the formulas into arenas of
+ * their own. The parsed fields are then stored in their cells in order, and freed.
+ * buffer: Characters of the window, which are followed by room for one more character. The fields are parsed in place.
+ * size: Number of characters in the window.
+ * first_row: Row of the first line of the window.
+ * num_rows: Set to the number of rows in the window.
+ * return: 1 if the window was loaded, or 0 if a memory allocation failed.
  */
-struct Cell {
-    CellType type;
-    CellValue value;
-    EvaluationState state;
-};
+int load_csv_window(char* buffer, size_t size, int first_row, int* num_rows) {
+    //Splits windows which are large enough between the workers.
+    int num_chunks = 1;
+    if (size >= 2 * CSV_CHUNK_SIZE) {
+        if (pool.num_workers == 0) {
+            start_workers();
+        }
+        num_chunks = pool.num_workers * CHUNKS_PER_WORKER;
+        if ((size_t) num_chunks > size / CSV_CHUNK_SIZE) {
+            num_chunks = (int) (size / CSV_CHUNK_SIZE);
+        }
+        if (pool.num_workers == 1) {
+            num_chunks = 1;
+        }
+    }
+    csv_load.chunks = calloc(num_chunks, sizeof(CsvChunk));
+    //Checks if the memory allocation was successful.
+    if (csv_load.chunks == NULL) {
+        *num_rows = 0;
+        return 0;
+    }
+    csv_load.num_chunks = split_csv_window(buffer, size, first_row, num_chunks);
+    if (csv_load.num_chunks > 1) {
+        atomic_store_explicit(&pool.next_chunk, 0, memory_order_relaxed);
+        run_job(PARSE_JOB);
+    } else {
+        parse_csv_chunk(0, &csv_load.chunks[0]);
+    }
+    merge_csv_arenas();
+
+    int failed = 0;
+    *num_rows = 0;
+    for (int i = 0; i < csv_load.num_chunks; i++) {
+        store_csv_fields(&csv_load.chunks[i]);
+        *num_rows += csv_load.chunks[i].num_rows;
+        failed = failed || csv_load.chunks[i].failed;
+        free(csv_load.chunks[i].fields);
+    }
+    free(csv_load.chunks);
+    csv_load.chunks = NULL;
+    csv_load.num_chunks = 0;
+    return !failed;
+}
 
 /*
- * 2D array of cells to represent the spreadsheet.
- * Cell is a struct which contains the type, value, and evaluation state of the cell.
- * NUM_ROWS: Number of rows in the spreadsheet.
- * NUM_COLS: Number of columns in the spreadsheet.
+ * Loads a CSV file which is mapped into memory, one window at a time. The fields are parsed where they are in the
+ * mapping, and the pages of each window are released once it has been loaded, since parsing the fields in place makes
+ * private copies of them.
+ * data: Contents of the file, mapped by 'map_file'.
+ * size: Size of the file.
+ * num_rows: Set to the number of rows read.
+ * return: 1 if the file was loaded, or 0 if a memory allocation failed.
  */
-Cell spreadsheet[NUM_ROWS][NUM_COLS];
-
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int load_mapped_csv(char* data, size_t size, int* num_rows) {
+    *num_rows = 0;
+    size_t position = 0;
+    while (position < size) {
+        size_t length = size - position < CSV_WINDOW_SIZE ? size - position : CSV_WINDOW_SIZE;
+        size_t end;
+        //Grows the window until it holds a whole row, unless the rest of the file is a last row without a new line.
+        while ((end = find_csv_rows_end(data + position, length)) == 0 && position + length < size) {
+            length = size - position < 2 * length ? size - position : 2 * length;
+        }
+        int rows;
+        int loaded;
+        if (end == 0) {
+            //Copies a last row without a new line, since there may not be room in the mapping for its null terminator.
+            char* row = malloc(length + 1);
+            //Checks if the memory allocation was successful.
+            if (row == NULL) {
+                return 0;
+            }
+            memcpy(row, data + position, length);
+            loaded = load_csv_window(row, length, *num_rows, &rows);
+            free(row);
+            end = length;
+        } else {
+            loaded = load_csv_window(data + position, end, *num_rows, &rows);
+#if !defined(_WIN32) && defined(MADV_DONTNEED)
+            //Releases the pages of the window. Any which are used again read the file, and the characters of the rest
+            //of the file were never changed.
+            size_t page = (size_t) sysconf(_SC_PAGESIZE);
+            size_t first = position / page * page;
+            madvise(data + first, position + end - first, MADV_DONTNEED);
+#endif
+        }
+        *num_rows += rows;
+        if (!loaded) {
+            return 0;
+        }
+        position += end;
+    }
+    return 1;
+}
 
 /*
- * Retrieve a cell from the spreadsheet by its reference.
- * reference: Reference of the cell. ie, A1, B2, etc.
- * Return: Pointer to the cell.
+ * Loads a CSV file which can't be mapped into memory, such as a pipe, by reading one window at a time into a buffer.
+ * The rows left over at the end of each window are moved to the start of the buffer before the next one is read.
+ * file: File which is read.
+ * num_rows: Set to the number of rows read.
+ * return: 1 if the file was loaded, or 0 if it couldn't be read or a memory allocation failed.
  */
-Cell* get_cell_by_reference(char* reference) {
-    //Checks if the reference is NULL or if the length of the reference is less than 2.
-    if (reference == NULL || strlen(reference) < 2) {
-        return NULL;
+int load_streamed_csv(FILE* file, int* num_rows) {
+    *num_rows = 0;
+    size_t capacity = CSV_WINDOW_SIZE;
+    //Leaves room for the null terminator of the last field.
+    char* buffer = malloc(capacity + 1);
+    //Checks if the memory allocation was successful.
+    if (buffer == NULL) {
+        return 0;
+    }
+    size_t length = 0;
+    int loaded = 1;
+    while (loaded) {
+        length += fread(buffer + length, 1, capacity - length, file);
+        //The buffer is only left with room once the whole file has been read.
+        int finished = length < capacity;
+        size_t end = finished ? length : find_csv_rows_end(buffer, length);
+        if (end == 0 && !finished) {
+            //Grows the buffer to hold a row which is longer than it.
+            char* grown = realloc(buffer, 2 * capacity + 1);
+            //Checks if the memory allocation was successful.
+            if (grown == NULL) {
+                loaded = 0;
+                break;
+            }
+            buffer = grown;
+            capacity *= 2;
+            continue;
+        }
+        if (end > 0) {
+            int rows;
+            loaded = load_csv_window(buffer, end, *num_rows, &rows);
+            *num_rows += rows;
+        }
+        if (finished) {
+            break;
+        }
+        memmove(buffer, buffer + end, length - end);
+        length -= end;
     }
+    free(buffer);
+    return loaded && !ferror(file);
+}
 
-    //Checks if the first character of the reference is a letter.
-    if (reference[0] >= 'a' && reference[0] <= 'z') {
-        return NULL;
+/*
+ * Loads a CSV file into the spreadsheet.
+ * Regular files are mapped into memory, and other files are read through a buffer. Either way the file is loaded one
+ * window of whole rows at a time, so that the memory used doesn't depend on the size of the file. The formulas are
+ * registered with the cells they reference all at once, and the cells are set as a single batch so that the formulas
+ * are only evaluated once the whole file has been loaded.
+ * path: Path of the file.
+ * return: Number of rows read, or -1 if the file couldn't be read.
+ */
+int load_csv(const char* path) {
+    size_t size = 0;
+    //Windows reads files which could be mapped into memory, so they are always read through a buffer there.
+#ifdef _WIN32
+    unsigned char* data = NULL;
+#else
+    unsigned char* data = map_file(path, &size);
+#endif
+    FILE* file = NULL;
+    if (data == NULL) {
+        file = fopen(path, "rb");
+        //Checks if the file could be opened.
+        if (file == NULL) {
+            return -1;
+        }
     }
-    //Determines the column index by subtracting 'A' from the first character of the reference.
-    COL column = reference[0] - 'A';
 
-    //Determines the row index by converting the string to an integer.
-    char* end;
-    long row = strtol(reference + 1, &end, 10);
-    //Checks if row conversion was unsuccessful or if the row is out of bounds.
-    if (*end != '\0' || row < 1 || row > NUM_ROWS) {
-        return NULL;
+    int rows;
+    begin_batch();
+    int loaded = data != NULL ? load_mapped_csv((char*) data, size, &rows) : load_streamed_csv(file, &rows);
+    link_csv_file();
+    end_batch();
+
+    if (data != NULL) {
+        unmap_file(data, size);
+    } else {
+        fclose(file);
     }
+    return loaded ? rows : -1;
+}
 
-    //Subtract 1 because row numbers start from 1 but array indices start from 0
-    row -= 1;
+/*
+ * Writes text as a field of a CSV file, in quotes if it contains any characters which would otherwise end the field.
+ * file: File which is written to.
+ * text: Text of the field.
+ */
+void write_csv_text(FILE* file, const char* text) {
+    //Checks if the text can be written as it is.
+    if (strpbrk(text, ",\"\r\n") == NULL) {
+        fputs(text, file);
+        return;
+    }
+    //Writes the text in quotes, with each quote doubled.
+    fputc('"', file);
+    for (const char* c = text; *c != '\0'; c++) {
+        if (*c == '"') {
+            fputc('"', file);
+        }
+        fputc(*c, file);
+    }
+    fputc('"', file);
+}
 
-    //Returns a pointer to the cell.
-    return &spreadsheet[row][column];
+/*
+ * Writes a cell as a field of a CSV file. Formulas are written rather than their results, so that loading the file
+ * gives the same spreadsheet.
+ * file: File which is written to.
+ * cell: Cell which is written, or NULL if it has never been written to.
+ */
+void write_csv_cell(FILE* file, Cell* cell) {
+    if (cell == NULL) {
+        return;
+    }
+    if (cell->type == FORMULA) {
+        if (cell->value.formula != NULL) {
+            write_csv_text(file, get_formula_text(cell->value.formula));
+        }
+    } else if (cell->type == NUMBER) {
+        //Writes the shortest text which reads back as exactly the same number.
+        char number[NUMBER_MAX_LENGTH + 1];
+        format_number(get_column_number(cell), number, NUMBER_MAX_LENGTH);
+        fputs(number, file);
+    } else if (cell->value.text != 0) {
+        write_csv_text(file, get_string(cell->value.text));
+    }
 }
 
 /*
- * Retrieve a cell from the spreadsheet by its row and column.
- * cell: cell which will be found
- * Return: Pointer to the cell.
+ * Saves the spreadsheet to a CSV file. Only the rows and columns up to the last one containing a value are written.
+ * path: Path of the file.
+ * return: Number of rows written, or -1 if the file couldn't be written.
  */
-char* get_cell_reference(Cell* cell) {
-    //Determines the row and column of the cell.
-    int row = (cell - &spreadsheet[0][0]) / NUM_COLS;
-    int col = (cell - &spreadsheet[0][0]) % NUM_COLS;
+int save_csv(const char* path) {
+    FILE* file = fopen(path, "wb");
+    //Checks if the file could be opened.
+    if (file == NULL) {
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, CSV_BUFFER_SIZE);
 
-    //Creates string to store reference
-    char* reference = malloc(4 * sizeof(char));
-    //Checks if the reference is NULL.
-    if (reference == NULL) {
-        return NULL;
+    //Finds the last row and column containing a value, looking only at the tiles which have been allocated. A stale
+    //formula doesn't have a value yet in lazy evaluation, so formulas are found from the cells of the tile. Tiles still
+    //in a snapshot have no stale formulas, since the snapshot holds every result.
+    int last_row = -1;
+    int last_col = -1;
+    for (int tile_row = 0; tile_row < sheet.tile_rows; tile_row++) {
+        for (int tile_col = 0; tile_col < sheet.tile_cols; tile_col++) {
+            TileValues* values = sheet.values[tile_row * sheet.tile_cols + tile_col];
+            Tile* tile = sheet.tiles[tile_row * sheet.tile_cols + tile_col];
+            if (values == NULL) {
+                continue;
+            }
+            for (int col = 0; col < TILE_COLS; col++) {
+                for (int row = 0; row < TILE_ROWS; row++) {
+                    if (values->kinds[col][row] != VALUE_EMPTY ||
+                        (tile != NULL && tile->cells[row][col].type == FORMULA)) {
+                        int sheet_row = tile_row * TILE_ROWS + row;
+                        int sheet_col = tile_col * TILE_COLS + col;
+                        last_row = sheet_row > last_row ? sheet_row : last_row;
+                        last_col = sheet_col > last_col ? sheet_col : last_col;
+                    }
+                }
+            }
+        }
     }
 
-    //Adds the column and row to the reference.
-    sprintf(reference, "%c%d", col + 'A', row + 1);
+    //Writes each row, with a field for every column.
+    for (int row = 0; row <= last_row; row++) {
+        for (int col = 0; col <= last_col; col++) {
+            if (col > 0) {
+                fputc(',', file);
+            }
+            write_csv_cell(file, get_cell(row, col));
+        }
+        fputc('\n', file);
+    }
 
-    //Returns string containing the cell reference
-    return reference;
+    int failed = ferror(file);
+    if (fclose(file) != 0) {
+        failed = 1;
+    }
+    return failed ? -1 : last_row + 1;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+//Identifies a file as a snapshot, followed by the version of its layout.
+#define SNAPSHOT_MAGIC "XLSNAPSH"
+#define SNAPSHOT_VERSION 5
+
+/*
+ * Struct to hold the state of a snapshot while it is written. Everything is written at offsets which are a multiple of
+ * 8, so that it can be used where it is once the snapshot is mapped into memory.
+ * file: File the snapshot is written to.
+ * offset: Offset the next data is written at.
+ * failed: Set if any of the data couldn't be written.
+ */
+typedef struct {
+    FILE* file;
+    uint64_t offset;
+    int failed;
+} SnapshotWriter;
+
 /*
- * Converts a string to a formula.
- * text: String to be converted.
- * return: Pointer to the formula.
+ * Writes data to the end of a snapshot, padded to a multiple of 8 bytes.
+ * writer: Snapshot which is being written.
+ * data: Data which is written.
+ * size: Number of bytes of data.
+ * return: Offset the data was written at.
  */
-Formula* string_to_formula(char* text) {
-    //Creates a formula struct and sets the size of formula to 0.
-    Formula* formula = malloc(sizeof(Formula));
-    formula->num_terms = 0;
+uint64_t write_snapshot_data(SnapshotWriter* writer, const void* data, size_t size) {
+    static const unsigned char padding[8] = {0};
+    uint64_t offset = writer->offset;
+    size_t padding_size = (8 - size % 8) % 8;
+    if (fwrite(data, 1, size, writer->file) != size ||
+        fwrite(padding, 1, padding_size, writer->file) != padding_size) {
+        writer->failed = 1;
+    }
+    writer->offset += size + padding_size;
+    return offset;
+}
 
-    //Splits the string between the '+' term to get the terms of the formula.
-    char* split_term = strtok(text + 1, "+");
-    while (split_term != NULL) {
-        Terms term;
+/*
+ * Writes a tile to a snapshot: the contents and dependents of its cells, then a record for each cell pointing to them,
+ * then the values of the tile as they are.
+ * writer: Snapshot which is being written.
+ * index: Index of the tile.
+ * entry: Set to where the tile is stored in the snapshot.
+ */
+void write_snapshot_tile(SnapshotWriter* writer, int index, SnapshotTile* entry) {
+    entry->values_offset = 0;
+    entry->cells_offset = 0;
+    Tile* tile = get_tile(index);
+    //Checks if the tile has never been written to, in which case it isn't stored.
+    if (tile == NULL) {
+        return;
+    }
 
-        char* end;
-        //Tries to convert the term into a number.
-        double number = strtod(split_term, &end);
+    SnapshotCell records[TILE_COLS * TILE_ROWS];
+    memset(records, 0, sizeof(records));
+    for (int col = 0; col < TILE_COLS; col++) {
+        for (int row = 0; row < TILE_ROWS; row++) {
+            Cell* cell = &tile->cells[row][col];
+            SnapshotCell* record = &records[col * TILE_ROWS + row];
+            record->type = (uint8_t) cell->type;
+            record->error = (uint8_t) cell->error;
+            record->closes_cycle = (uint8_t) cell->closes_cycle;
+            record->order = cell->order;
+            //Formulas are stored compiled, exactly as they are in memory.
+            if (cell->type == FORMULA && cell->value.formula != NULL) {
+                record->value = write_snapshot_data(writer, cell->value.formula,
+                                                           get_formula_size(cell->value.formula));
+            } else if (cell->type == TEXT) {
+                //The text is stored once in the string table, however many cells hold it.
+                record->value = cell->value.text;
+            }
 
-        //If the conversion to a number is successful, then the term is a constant.
-        if (end != split_term) {
-            term.constant = number;
-            term.cell = NULL;
-        }
-        //If the conversion to a number is unsuccessful, then the term is a cell reference and then cell is retrieved.
-        else {
-            term.cell = get_cell_by_reference(split_term);
-            if (term.cell == NULL) {
-                free(formula);
-                return NULL;
+            //Dependents are stored as references, so that they don't depend on where the cells are in memory.
+            //References are 8 bytes, so each one follows straight after the one before it.
+            record->num_dependents = (uint32_t) cell->num_dependents;
+            if (cell->num_dependents > 0 && cell->stored_dependents != NULL) {
+                record->dependents_offset = write_snapshot_data(writer, cell->stored_dependents,
+                                                                cell->num_dependents * sizeof(CellReference));
+            } else if (cell->num_dependents > 0) {
+                for (int i = 0; i < cell->num_dependents; i++) {
+                    CellReference reference = make_cell_reference(cell->dependents[i]->row, cell->dependents[i]->col);
+                    uint64_t offset = write_snapshot_data(writer, &reference, sizeof(reference));
+                    if (i == 0) {
+                        record->dependents_offset = offset;
+                    }
+                }
             }
         }
-        //Adds the term to the formula array.
-        formula->terms[formula->num_terms++] = term;
-        split_term = strtok(NULL, "+");
     }
-    //Returns the formula.
-    return formula;
+    entry->cells_offset = write_snapshot_data(writer, records, sizeof(records));
+    entry->values_offset = write_snapshot_data(writer, sheet.values[index], sizeof(TileValues));
 }
 
 /*
- * Evaluates a formula and determines the answer.
- * formula: Formula to be evaluated.
- * return: Result of the formula.
- */
-double evaluate_formula(Formula* formula) {
-    //Initializes the answer to 0.
-    double answer = 0.0;
-
-    //Iterates over each term in the formula.
-    for (int i = 0; i < formula->num_terms; i++) {
-        //Retrieves the term from the formula array which stores terms.
-        Terms term = formula->terms[i];
-
-        //Checks if the term is a cell reference
-        if (term.cell != NULL) {
-            //Checks if the cell is currently being evaluated. If true, then a circular dependency has been detected.
-            if (term.cell->state == EVALUATING) {
-                //Returns NAN as a error code to report a circular dependency has occurred.
-                return NAN;
-            }
-            //If the cell contains a formula, it sets the cell's state to evaluating and recursively evaluates the formula.
-            else if (term.cell->type == FORMULA) {
-                term.cell->state = EVALUATING;
-                double formula_result = evaluate_formula(term.cell->value.formula);
-                //Checks if an error has occurred while evaluating the formula in the cell.
-                if (isinf(formula_result)) {
-                    //Returns INFINITY as an error code to report that the cell contains a non-numeric value.
-                    return INFINITY;
-                }
-                //Adds the result of the formula within the cell to the answer.
-                answer += formula_result;
-                //Changes the state of the cell to "evaluated".
-                term.cell->state = EVALUATED;
-            }
-            //If the cell contains a number, it sets the cell's state to evaluating and adds the number to the answer.
-            else if (term.cell->type == NUMBER) {
-                term.cell->state = EVALUATING;
-                //Adds the number to the answer
-                answer += term.cell->value.number;
-                //Changes the state of the cell to "evaluated".
-                term.cell->state = EVALUATED;
-            } else {
-                //Returns INFINITY as an error code to report that an error has occurred during the evaluation process.
-                return INFINITY;
+ * Writes the range dependents of a column to a snapshot.
+ * writer: Snapshot which is being written.
+ * col: Column whose range dependents are written.
+ * entry: Set to where the range dependents are stored in the snapshot.
+ */
+void write_snapshot_column(SnapshotWriter* writer, int col, SnapshotColumn* entry) {
+    ColumnDependents* column = &sheet.column_dependents[col];
+    entry->offset = 0;
+    entry->count = 0;
+    if (column->stored_dependents != NULL) {
+        entry->offset = write_snapshot_data(writer, column->stored_dependents,
+                                            column->num_stored_dependents * sizeof(StoredRangeDependent));
+        entry->count = (uint64_t) column->num_stored_dependents;
+        return;
+    }
+    //Writes the entries of every bucket one after another.
+    for (int i = 0; column->num_dependents > 0 && i < 2 * sheet.range_buckets - 1; i++) {
+        RangeBucket* bucket = &column->buckets[i];
+        for (int j = 0; j < bucket->num_dependents; j++) {
+            RangeDependent* dependent = &bucket->dependents[j];
+            StoredRangeDependent stored;
+            stored.cell = make_cell_reference(dependent->cell->row, dependent->cell->col);
+            stored.first_row = dependent->first_row;
+            stored.last_row = dependent->last_row;
+            uint64_t offset = write_snapshot_data(writer, &stored, sizeof(stored));
+            if (entry->count++ == 0) {
+                entry->offset = offset;
             }
         }
-        //Adds the constant to the answer
-        else {
-            answer += term.constant;
+    }
+}
+
+/*
+ * Writes the string pool to a snapshot: each string, then the string table pointing to them.
+ * writer: Snapshot which is being written.
+ * return: Offset of the string table, or 0 if the memory allocation failed.
+ */
+uint64_t write_snapshot_strings(SnapshotWriter* writer) {
+    SnapshotString* strings = calloc((size_t) string_pool.num_strings + 1, sizeof(SnapshotString));
+    //Checks if the memory allocation was successful.
+    if (strings == NULL) {
+        writer->failed = 1;
+        return 0;
+    }
+    for (unsigned int id = 1; id < string_pool.num_strings; id++) {
+        PooledString* string = &string_pool.strings[id];
+        if (string->text != NULL) {
+            size_t length = strlen(string->text);
+            strings[id].offset = write_snapshot_data(writer, string->text, length + 1);
+            strings[id].length = (uint32_t) length;
+            strings[id].hash = string->hash;
+            strings[id].references = string->references;
         }
     }
-    //Returns the answer.
-    return answer;
+    uint64_t offset = write_snapshot_data(writer, strings, string_pool.num_strings * sizeof(SnapshotString));
+    free(strings);
+    return offset;
 }
 
 /*
- * Converts a formula to a string.
- * formula: The formula which is to be converted to string.
- * return: String which contains the formula.
+ * Saves the spreadsheet to a snapshot, which stores the cached values of every tile, the compiled formulas and the
+ * dependents of every cell, and the string pool holding their text, so that loading it doesn't need to parse or
+ * evaluate anything. The snapshot is written to a temporary file which then replaces the file at the path, so that a
+ * snapshot the spreadsheet was loaded from stays unchanged while it is still mapped.
+ * path: Path of the file.
+ * return: 0 if the snapshot was saved, or -1 if the file couldn't be written.
  */
-char* formula_to_string(Formula* formula) {
-    //Allocates memory for the string which will contain the formula and a null terminator.
-    char* text = malloc(CELL_DISPLAY_WIDTH + 1);
+int save_snapshot(const char* path) {
+    //Brings every cached result up to date, since the results are saved rather than the formulas being evaluated again
+    //once they are loaded.
+    evaluate_stale_cells();
 
+    //Creates the path of the temporary file.
+    char* temporary = malloc(strlen(path) + 5);
     //Checks if the memory allocation was successful.
-    if (text == NULL) {
-        return NULL;
+    if (temporary == NULL) {
+        return -1;
     }
+    sprintf(temporary, "%s.tmp", path);
 
-    //Sets the first char to '=' and the last char to the null terminator.
-    text[0] = '=';
-    text[1] = '\0';
-
-    for (int i = 0; i < formula->num_terms; i++) {
-        //Retrieves the term from the array of terms in the formula.
-        Terms term = formula->terms[i];
-
-        //Checks if the term is a cell reference or constant.
-        if (term.cell != NULL) {
-            //If the term is a cell reference, it retrieves the cell reference as a string.
-            char* cell_reference = get_cell_reference(term.cell);
-            //Appends the cell reference string to the string containing the formula
-            strcat(text, cell_reference);
-            //Frees the memory allocated for the cell reference string.
-            free(cell_reference);
-        }
-            //If the term is a constant, it adds the constant to the string.
-        else {
-            char number[20];
-            //Converts the constant to a string.
-            snprintf(number, 20, "%f", term.constant);
-            //Appends the constant string to the string containing the formula.
-            strcat(text, number);
-        }
-        //Adds the addition symbol '+' to the string if there are more terms, and it's not the last term.
-        if (i < formula->num_terms - 1) {
-            //Appends the addition symbol
-            strcat(text, "+");
+    int num_tiles = sheet.tile_rows * sheet.tile_cols;
+    SnapshotTile* tiles = calloc((size_t) num_tiles + 1, sizeof(SnapshotTile));
+    SnapshotColumn* columns = calloc((size_t) sheet.num_cols + 1, sizeof(SnapshotColumn));
+    FILE* file = fopen(temporary, "wb");
+    //Checks if the memory allocations were successful and the file could be opened.
+    if (tiles == NULL || columns == NULL || file == NULL) {
+        if (file != NULL) {
+            fclose(file);
+            remove(temporary);
         }
+        free(tiles);
+        free(columns);
+        free(temporary);
+        return -1;
     }
-    //Returns the string.
-    return text;
+    setvbuf(file, NULL, _IOFBF, CSV_BUFFER_SIZE);
+
+    //Leaves room for the header, which is written once the offsets it holds are known.
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    SnapshotWriter writer = {file, 0, 0};
+    write_snapshot_data(&writer, &header, sizeof(header));
+
+    for (int i = 0; i < num_tiles; i++) {
+        write_snapshot_tile(&writer, i, &tiles[i]);
+    }
+    for (int col = 0; col < sheet.num_cols; col++) {
+        write_snapshot_column(&writer, col, &columns[col]);
+    }
+    header.tiles_offset = write_snapshot_data(&writer, tiles, num_tiles * sizeof(SnapshotTile));
+    header.columns_offset = write_snapshot_data(&writer, columns, sheet.num_cols * sizeof(SnapshotColumn));
+    header.strings_offset = write_snapshot_strings(&writer);
+    header.num_strings = string_pool.num_strings;
+
+    //Writes the header at the start of the file.
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.tile_rows = TILE_ROWS;
+    header.tile_cols = TILE_COLS;
+    header.num_rows = sheet.num_rows;
+    header.num_cols = sheet.num_cols;
+    header.values_size = sizeof(TileValues);
+    header.formula_size = sizeof(Formula);
+    header.range_size = sizeof(RangeFunction);
+    header.file_size = writer.offset;
+    header.lowest_order = topological_order.lowest;
+    header.highest_order = topological_order.highest;
+    if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1) {
+        writer.failed = 1;
+    }
+
+    if (fclose(file) != 0) {
+        writer.failed = 1;
+    }
+    //Replaces the file at the path once the snapshot is complete. Windows doesn't rename onto an existing file, so it
+    //is removed first.
+#ifdef _WIN32
+    if (!writer.failed) {
+        remove(path);
+    }
+#endif
+    if (writer.failed || rename(temporary, path) != 0) {
+        remove(temporary);
+        writer.failed = 1;
+    }
+    free(tiles);
+    free(columns);
+    free(temporary);
+    return writer.failed ? -1 : 0;
 }
 
 /*
- * Frees the memory allocated for a formula.
- * formula: Formula to be freed.
+ * Checks if a number of items of the given size starting at an offset are all within a snapshot.
+ * size: Size of the snapshot.
+ * offset: Offset of the first item, which must be a multiple of 8 after the header.
+ * count: Number of items.
+ * item_size: Size of each item.
+ * return: 1 if the items are within the snapshot, otherwise 0.
  */
-void free_formula(Formula* formula) {
-    if (formula != NULL) {
-        free(formula);
-    }
+int is_in_snapshot(size_t size, uint64_t offset, uint64_t count, size_t item_size) {
+    return offset % 8 == 0 && offset >= sizeof(SnapshotHeader) && offset <= size &&
+           count <= (size - offset) / item_size;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
 /*
- * Initializes the 2D array which contains the spreadsheet.
+ * Checks if the header and the directories of tiles and columns of a snapshot are valid, and that the snapshot was
+ * written with the same layout as this build uses.
+ * data: Contents of the snapshot.
+ * size: Size of the snapshot.
+ * return: 1 if the snapshot can be loaded, otherwise 0.
  */
-void model_init() {
-    // TODO: implement this.
-    for (int i = 0; i < NUM_ROWS; i++) {
-        for (int j = 0; j < NUM_COLS; j++) {
-            //Sets the type of the cells in the spreadsheet to TEXT.
-            spreadsheet[i][j].type = TEXT;
-            //Sets the value of the cells in the spreadsheet to NULL.
-            spreadsheet[i][j].value.text = NULL;
+int is_valid_snapshot(const unsigned char* data, size_t size) {
+    const SnapshotHeader* header = (const SnapshotHeader*) data;
+    if (size < sizeof(SnapshotHeader) || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION || header->tile_rows != TILE_ROWS || header->tile_cols != TILE_COLS ||
+        header->values_size != sizeof(TileValues) || header->formula_size != sizeof(Formula) ||
+        header->range_size != sizeof(RangeFunction) || header->file_size != size || header->num_rows < 1 ||
+        header->num_rows > INT32_MAX - TILE_ROWS || header->num_cols < 1 || header->num_cols > INT32_MAX - TILE_COLS ||
+        header->lowest_order > 0 || header->highest_order < 0) {
+        return 0;
+    }
+
+    //Checks that the directories are within the snapshot.
+    uint64_t num_tiles = (uint64_t) ((header->num_rows + TILE_ROWS - 1) / TILE_ROWS) *
+                         (uint64_t) ((header->num_cols + TILE_COLS - 1) / TILE_COLS);
+    if (num_tiles > INT32_MAX || !is_in_snapshot(size, header->tiles_offset, num_tiles, sizeof(SnapshotTile)) ||
+        !is_in_snapshot(size, header->columns_offset, (uint64_t) header->num_cols, sizeof(SnapshotColumn)) ||
+        header->num_strings > INT32_MAX ||
+        !is_in_snapshot(size, header->strings_offset, header->num_strings, sizeof(SnapshotString))) {
+        return 0;
+    }
+
+    //Checks that the values and cell records of each tile, and the range dependents of each column, are within it.
+    const SnapshotTile* tiles = (const SnapshotTile*) (data + header->tiles_offset);
+    for (uint64_t i = 0; i < num_tiles; i++) {
+        if ((tiles[i].values_offset != 0 && !is_in_snapshot(size, tiles[i].values_offset, 1, sizeof(TileValues))) ||
+            (tiles[i].cells_offset != 0 &&
+             !is_in_snapshot(size, tiles[i].cells_offset, TILE_ROWS * TILE_COLS, sizeof(SnapshotCell)))) {
+            return 0;
         }
     }
+    const SnapshotColumn* columns = (const SnapshotColumn*) (data + header->columns_offset);
+    for (int col = 0; col < header->num_cols; col++) {
+        if (columns[col].count > INT32_MAX || (columns[col].count > 0 &&
+                                               !is_in_snapshot(size, columns[col].offset, columns[col].count,
+                                                               sizeof(StoredRangeDependent)))) {
+            return 0;
+        }
+    }
+    return 1;
 }
 
-
 /*
- * Sets the value of a cell based on user input.
- * text: String which contains the user input.
+ * Checks if a formula in a snapshot is valid, so that it can be evaluated and converted to a string safely.
+ * formula: Formula which is checked.
+ * available: Number of bytes of the snapshot from the start of the formula.
+ * return: 1 if the formula is valid, otherwise 0.
  */
-void set_cell_value(ROW row, COL col, char *text) {
-    //Checks if the cell which is being changed contains a formula.
-    if (spreadsheet[row][col].type == FORMULA) {
-        //Frees the memory allocated for the formula.
-        free_formula(spreadsheet[row][col].value.formula);
+int is_valid_formula(Formula* formula, size_t available) {
+    if (formula->num_instructions < 0 || formula->num_constants < 0 || formula->num_references < 0 ||
+        formula->num_ranges < 0) {
+        return 0;
+    }
+    //Checks that the operands, instructions and text are within the snapshot, and that the text is null terminated.
+    uint64_t size = sizeof(Formula) + (uint64_t) formula->num_constants * sizeof(double) +
+                    (uint64_t) formula->num_references * sizeof(CellReference) +
+                    (uint64_t) formula->num_ranges * sizeof(RangeFunction) + (uint64_t) formula->num_instructions;
+    if (formula->text_length < 0 || size + (uint64_t) formula->text_length + 1 > available ||
+        get_formula_text(formula)[formula->text_length] != '\0') {
+        return 0;
+    }
+    //A formula which failed to parse only holds its text.
+    if (formula->error_offset >= 0) {
+        return formula->num_instructions == 0 && formula->num_constants == 0 && formula->num_references == 0 &&
+               formula->num_ranges == 0;
+    }
+    if (formula->error_offset != -1) {
+        return 0;
     }
 
-    //Checks if the user is attempting to create a formula.
-    if (text[0] == '=') {
-        //Changes the cell type to FORMULA.
-        spreadsheet[row][col].type = FORMULA;
-        //Converts the string to a formula.
-        spreadsheet[row][col].value.formula = string_to_formula(text);
-
-        //Checks if the formula conversion was unsuccessful due to invalid syntax.
-        if (spreadsheet[row][col].value.formula == NULL) {
-            //Prints an error message to the user through the cell text.
-            update_cell_display(row, col, "Error: Failed to parse formula");
+    //Checks that the cells the formula reads are within the spreadsheet.
+    CellReference* references = get_formula_references(formula);
+    for (int i = 0; i < formula->num_references; i++) {
+        if (!is_valid_reference(references[i])) {
+            return 0;
+        }
+    }
+    RangeFunction* ranges = get_formula_ranges(formula);
+    for (int i = 0; i < formula->num_ranges; i++) {
+        Range* range = &ranges[i].range;
+        if (ranges[i].function <= NO_FUNCTION || ranges[i].function >= NUM_FUNCTIONS || range->first_row < 0 ||
+            range->first_row > range->last_row || range->last_row >= sheet.num_rows || range->first_col < 0 ||
+            range->first_col > range->last_col || range->last_col >= sheet.num_cols) {
+            return 0;
         }
+    }
 
-        //Evaluates the formula and determines the answer.
-        double result = evaluate_formula(spreadsheet[row][col].value.formula);
-        //Checks for error code relating to circular dependency.
-        if (isnan(result)) {
-            //Prints an error message telling the user that a circular dependency is occurring in the cell which is being used.
-            update_cell_display(row, col, "Error: circular dependency detected");
+    //Checks that the instructions use exactly the operands of the formula, and fit on the stack of the evaluator.
+    const unsigned char* code = get_formula_code(formula);
+    int depth = 0;
+    int operands[3] = {0, 0, 0};
+    for (int i = 0; i < formula->num_instructions; i++) {
+        if (code[i] <= AGGREGATE) {
+            operands[code[i]]++;
+            depth++;
+        } else if (code[i] <= DIVIDE && depth >= 2) {
+            depth--;
+        } else if (code[i] != NEGATE || depth < 1) {
+            return 0;
         }
-            //Checks if an error has occurred due to a cell containing a non-numeric value.
-        else if (isinf(result)) {
-            //Prints an error message telling the user that a cell contains a non-numeric value.
-            update_cell_display(row, col, "Error: cell contains non-numeric value");
-        } else {
-            //Converts the result to string.
-            char result_str[CELL_DISPLAY_WIDTH + 1];
-            snprintf(result_str, CELL_DISPLAY_WIDTH + 1, "%f", result);
-            //Updates the cell display with the resulting string.
-            update_cell_display(row, col, result_str);
+        if (depth > MAX_STACK_DEPTH) {
+            return 0;
         }
     }
-        //Tries converting the input text to a number.
-    else {
-        char* end;
-        double number = strtod(text, &end);
+    return depth <= 1 && operands[PUSH_CONSTANT] == formula->num_constants &&
+           operands[LOAD_CELL] == formula->num_references && operands[AGGREGATE] == formula->num_ranges;
+}
 
-        //Checks if the conversion to a number was successful.
-        if (end != text) {
-            //Changes the cell type to NUMBER.
-            spreadsheet[row][col].type = NUMBER;
-            //Sets the cell value to the number.
-            spreadsheet[row][col].value.number = number;
-            //Updates the cell display with the number.
-            update_cell_display(row, col, text);
+/*
+ * Loads a cell from its record in the snapshot. The formula of the cell is used where it is in the snapshot, and its
+ * text is already in the string pool.
+ * cell: Empty cell which is loaded.
+ * record: Record of the cell.
+ * return: 1 if the cell was loaded, or 0 if the record isn't valid, in which case the cell is left empty.
+ */
+int load_snapshot_cell(Cell* cell, const SnapshotCell* record) {
+    //Checks that the cell has a known type and error, that a formula cell has a formula, and that only a formula closes
+    //a cycle.
+    if (record->type > FORMULA || record->error >= NUM_CELL_ERRORS || (record->type == FORMULA && record->value == 0) ||
+        record->closes_cycle > (record->type == FORMULA)) {
+        return 0;
+    }
+    if (record->type == FORMULA) {
+        if (!is_in_snapshot(snapshot.size, record->value, 1, sizeof(Formula)) ||
+            !is_valid_formula((Formula*) (snapshot.data + record->value), snapshot.size - record->value)) {
+            return 0;
         }
-            //If the conversion failed, then the input text is a string
-        else {
-            //Changes the cell type to TEXT.
-            spreadsheet[row][col].type = TEXT;
-            //Sets the cell value to the string.
-            spreadsheet[row][col].value.text = strdup(text);
-            //Updates the cell display with the string.
-            update_cell_display(row, col, text);
+    } else if (record->type == TEXT && record->value != 0) {
+        //Checks that the text is a string in the pool.
+        if (record->value >= string_pool.num_strings || string_pool.strings[record->value].text == NULL) {
+            return 0;
         }
+    } else if (record->value != 0) {
+        return 0;
     }
-    //Frees the string containing the user input.
-    free(text);
+    if (record->num_dependents > 0 && (record->num_dependents > INT32_MAX ||
+                                       !is_in_snapshot(snapshot.size, record->dependents_offset,
+                                                       record->num_dependents, sizeof(CellReference)))) {
+        return 0;
+    }
+
+    if (record->type == FORMULA) {
+        cell->value.formula = (Formula*) (snapshot.data + record->value);
+    } else if (record->type == TEXT) {
+        cell->value.text = (unsigned int) record->value;
+    }
+    if (record->num_dependents > 0) {
+        cell->stored_dependents = (const CellReference*) (snapshot.data + record->dependents_offset);
+        cell->num_dependents = (int) record->num_dependents;
+    }
+    cell->type = (CellType) record->type;
+    cell->error = (CellError) record->error;
+    cell->closes_cycle = record->closes_cycle;
+    cell->order = record->order;
+    return 1;
 }
 
 /*
- * Clears the value of a cell.
- * row: Row of the cell which is going to be cleared.
- * col: Column of the cell which is going to be cleared.
+ * Loads the string table of the snapshot the spreadsheet is being loaded from into the string pool, which must be
+ * empty. The strings are used where they are in the snapshot, and the hashes stored with them are used to build the
+ * hash table, so that the strings themselves aren't read.
+ * strings: String table of the snapshot.
+ * count: Number of entries in the string table.
+ * return: 1 if the string table was loaded, or 0 if the memory allocation failed.
  */
-void clear_cell(ROW row, COL col) {
-    // TODO: implement this.
-    //Checks if the cell contains a formula.
-    if (spreadsheet[row][col].type == FORMULA) {
-        //Frees the memory allocated for the formula.
-        free_formula(spreadsheet[row][col].value.formula);
+int load_snapshot_strings(const SnapshotString* strings, unsigned int count) {
+    if (count <= 1) {
+        return 1;
     }
-        //Checks if the cell contains a string and isn't already empty.
-    else if (spreadsheet[row][col].type == TEXT && spreadsheet[row][col].value.text != NULL) {
-        //Frees the memory allocated for the cell text string.
-        free(spreadsheet[row][col].value.text);
+    string_pool.strings = malloc(count * sizeof(PooledString));
+    //Checks if the memory allocation was successful.
+    if (string_pool.strings == NULL) {
+        return 0;
     }
+    string_pool.num_strings = count;
+    string_pool.capacity = count;
+    string_pool.strings[0].text = NULL;
+    //Goes backwards, so that the free entries are reused in order. Entries which aren't valid are left free.
+    for (unsigned int id = count - 1; id >= 1; id--) {
+        PooledString* string = &string_pool.strings[id];
+        const SnapshotString* stored = &strings[id];
+        if (stored->offset != 0 && stored->references > 0 &&
+            is_in_snapshot(snapshot.size, stored->offset, (uint64_t) stored->length + 1, 1) &&
+            snapshot.data[stored->offset + stored->length] == '\0') {
+            string->text = (char*) (snapshot.data + stored->offset);
+            string->hash = stored->hash;
+            string->references = stored->references;
+            string_pool.num_used++;
+        } else {
+            string->text = NULL;
+            string->next = string_pool.free_id;
+            string_pool.free_id = id;
+        }
+    }
+    return grow_string_buckets();
+}
 
-    //Sets the cell type to TEXT.
-    spreadsheet[row][col].type = TEXT;
-    //Sets the cell value to NULL.
-    spreadsheet[row][col].value.text = NULL;
-
-    //Updates the cell display with an empty string.
-    update_cell_display(row, col, "");
+/*
+ * Loads the cells of a tile from the snapshot the spreadsheet was loaded from. The values of the tile are already used
+ * from the snapshot, so only the cells are loaded.
+ * index: Index of the tile.
+ * return: Pointer to the tile, or NULL if the memory allocation failed.
+ */
+Tile* load_snapshot_tile(int index) {
+    Tile* tile = allocate_tile(index);
+    //Checks if the memory allocation was successful.
+    if (tile == NULL) {
+        return NULL;
+    }
+    const SnapshotCell* records = (const SnapshotCell*) (snapshot.data + snapshot.tiles[index].cells_offset);
+    for (int col = 0; col < TILE_COLS; col++) {
+        for (int row = 0; row < TILE_ROWS; row++) {
+            Cell* cell = &tile->cells[row][col];
+            //A cell whose record isn't valid is left empty.
+            if (!load_snapshot_cell(cell, &records[col * TILE_ROWS + row])) {
+                set_column_value(cell, VALUE_EMPTY, 0.0);
+            }
+        }
+    }
+    return tile;
 }
 
 /*
- * Creates a textual version of a cell for editing.
- * row: Row of the cell which is going to be retrieved.
- * col: Column of the cell which is going to be retrieved.
- * return: String which contains the cell value.
+ * Loads a snapshot, replacing the whole spreadsheet.
+ * The snapshot is mapped into memory rather than read, and the values of its tiles are used where they are, so that
+ * formulas can read them straight away. The cells of a tile are only loaded the first time they are used, so the time
+ * taken doesn't depend on the size of the snapshot. The mapping is private, so later edits never change the file.
+ * path: Path of the file.
+ * return: 0 if the snapshot was loaded, or -1 if the file couldn't be read, isn't a valid snapshot, or the spreadsheet
+ * is in use by a batch or a view.
  */
-char *get_textual_value(ROW row, COL col) {
-    //Creates a string which will contain the cell value.
-    char *textual_value;
+int load_snapshot(const char* path) {
+    //Checks if a batch of edits is in progress or a view is open, since the cells they use would be freed.
+    if (batch_depth > 0 || get_oldest_view_epoch() != UINT64_MAX) {
+        return -1;
+    }
+    size_t size;
+    unsigned char* data = map_file(path, &size);
+    //Checks if the file could be mapped, and is a valid snapshot.
+    if (data == NULL) {
+        return -1;
+    }
+    if (size < sizeof(SnapshotHeader) || !is_valid_snapshot(data, size)) {
+        unmap_file(data, size);
+        return -1;
+    }
 
-    //Checks if the cell contains a formula.
-    if (spreadsheet[row][col].type == FORMULA) {
-        //Converts the formula to a string and stores it in the string.
-        textual_value = formula_to_string(spreadsheet[row][col].value.formula);
+    //Replaces the spreadsheet with an empty one of the same size as the snapshot.
+    const SnapshotHeader* header = (const SnapshotHeader*) data;
+    free_sheet();
+    model_init(header->num_rows, header->num_cols);
+    //Checks if the memory allocation was successful.
+    if (sheet.num_rows != header->num_rows) {
+        unmap_file(data, size);
+        return -1;
     }
-        //Checks if the cell contains a number.
-    else if (spreadsheet[row][col].type == NUMBER) {
-        //Allocates memory for a string which contains the number.
-        textual_value = malloc(CELL_DISPLAY_WIDTH + 1);
-        //Adds the number to the string.
-        snprintf(textual_value, CELL_DISPLAY_WIDTH + 1, "%f", spreadsheet[row][col].value.number);
+    snapshot.data = data;
+    snapshot.size = size;
+    snapshot.tiles = (const SnapshotTile*) (snapshot.data + header->tiles_offset);
+    topological_order.lowest = header->lowest_order;
+    topological_order.highest = header->highest_order;
+    if (!load_snapshot_strings((const SnapshotString*) (snapshot.data + header->strings_offset),
+                               (unsigned int) header->num_strings)) {
+        free_sheet();
+        return -1;
     }
-        //If the cell contains a string, then it copies the string to the textual string.
-    else {
-        //Checks if the cell is empty.
-        if (spreadsheet[row][col].value.text != NULL) {
-            //Copies the cell string to the textual string.
-            textual_value = strdup(spreadsheet[row][col].value.text);
+
+    //Uses the values of each tile and the range dependents of each column from the snapshot.
+    for (int i = 0; i < sheet.tile_rows * sheet.tile_cols; i++) {
+        if (snapshot.tiles[i].values_offset != 0) {
+            sheet.values[i] = (TileValues*) (snapshot.data + snapshot.tiles[i].values_offset);
         }
-            //Executes if the cell is empty.
-        else {
-            //Allocate memory for an empty string
-            textual_value = malloc(1);
-            //Set the first character to the null terminator
-            textual_value[0] = '\0';
+    }
+    const SnapshotColumn* columns = (const SnapshotColumn*) (snapshot.data + header->columns_offset);
+    for (int col = 0; col < sheet.num_cols; col++) {
+        if (columns[col].count > 0) {
+            sheet.column_dependents[col].stored_dependents =
+                    (const StoredRangeDependent*) (snapshot.data + columns[col].offset);
+            sheet.column_dependents[col].num_stored_dependents = (int) columns[col].count;
         }
     }
-    //Returns the textual string.
-    return textual_value;
-}
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
\ No newline at end of file
+    //Displays the cells shown by the interface, which only loads the tiles containing them.
+    display_viewport();
+    return 0;
+}
@@ -1,12 +1,30 @@
 #ifndef ASSIGNMENT_MODEL_H
 #define ASSIGNMENT_MODEL_H
 
+#include <stddef.h>
+
 #include "defs.h"
 
-// Initializes the data structure.
+// Initializes the data structure with room for 'num_rows' rows and 'num_cols'
+// columns. Memory for cells is only allocated once they are written to.
+//
+// This is called once, at program start. Calling it again replaces the
+// spreadsheet with an empty one of the new size, as 'model_reset' does, but
+// without displaying the cleared cells.
+void model_init(int num_rows, int num_cols);
+
+// Clears every cell of the spreadsheet, keeping its size. The memory of the
+// cells is freed all at once rather than cell by cell.
+void model_reset(void);
+
+// Sets the region of the spreadsheet shown by the interface, 'num_rows' rows
+// from 'first_row' and 'num_cols' columns from 'first_col'. From then on
+// 'update_cell_display' is only called for cells inside the region, with the
+// row and column of the cell in the spreadsheet. Every cell of the region is
+// displayed straight away, from its cached value.
 //
-// This is called once, at program start.
-void model_init();
+// Until this is called, the region is the top left NUM_ROWS by NUM_COLS cells.
+void set_viewport(int first_row, int first_col, int num_rows, int num_cols);
 
 // Sets the value of a cell based on user input.
 //
@@ -18,6 +36,246 @@ void set_cell_value(ROW row, COL col, char *text);
 // Clears the value of a cell.
 void clear_cell(ROW row, COL col);
 
+// Switches between eager and lazy evaluation. By default evaluation is eager,
+// so every formula affected by an edit is recalculated straight away. In lazy
+// evaluation an edit only marks the affected formulas out of date, and each
+// one is evaluated once its result is needed: when it is displayed, when a
+// formula being evaluated reads it, or when a snapshot is saved. Switching
+// back to eager evaluation brings every result up to date.
+void set_lazy_evaluation(int enabled);
+
+// Starts a batch of edits. Until the matching 'end_batch', 'set_cell_value'
+// and 'clear_cell' only change the cells, without recalculating or displaying
+// anything. Batches can be nested, in which case only the outermost
+// 'end_batch' finishes the batch.
+void begin_batch(void);
+
+// Finishes a batch of edits. Every formula affected by any edit in the batch
+// is recalculated once, and each changed cell is displayed once.
+void end_batch(void);
+
+// An edit of a single cell, for 'set_cells_batch'. A NULL 'text' clears the
+// cell, otherwise the string is owned by the model as for 'set_cell_value'.
+typedef struct {
+    ROW row;
+    COL col;
+    char *text;
+} CellEdit;
+
+// Applies 'count' edits as a single batch.
+void set_cells_batch(const CellEdit *edits, size_t count);
+
+// Sets how much memory the journal of edits kept for 'undo' and 'redo' can
+// hold, including the formulas and texts the edited cells held before. The
+// oldest edits are forgotten once the journal holds more than 'num_bytes'. A
+// budget of 0, which is the default, keeps no journal. Setting the budget
+// forgets every edit made so far.
+void set_journal_budget(size_t num_bytes);
+
+// Undoes the last edit, which is a whole batch of edits if it was made in a
+// batch, or the loading of a CSV file. The cells get back the contents they
+// held before, without parsing anything, and the affected formulas are
+// recalculated once.
+//
+// Returns 1 if an edit was undone, or 0 if there was nothing to undo or a batch
+// of edits is in progress.
+int undo(void);
+
+// Redoes the last edit undone by 'undo', as long as no other edit has been made
+// since.
+//
+// Returns 1 if an edit was redone, or 0 if there was nothing to redo or a batch
+// of edits is in progress.
+int redo(void);
+
+// A view of the values of the spreadsheet as they were when it was opened.
+typedef struct SheetView SheetView;
+
+// Kinds of value a cell can hold in a view.
+typedef enum {
+    VIEW_EMPTY,
+    VIEW_NUMBER,
+    VIEW_TEXT,
+    VIEW_ERROR
+} ViewValueKind;
+
+// Opens a view of the value of every cell as it is now, without copying
+// anything, so that the values can be exported or reported while edits carry
+// on. From then on the first edit of each block of cells copies the block, and
+// the view keeps reading the old one, so a view never sees an edit made after
+// it was opened. Blocks which were copied are freed once every view which
+// reads them has been closed.
+//
+// Views are opened from the thread which edits the spreadsheet, between edits,
+// and can then be read and closed from any one thread at a time. Up to 16 views
+// can be open at once. Every view is closed by 'model_reset', and
+// 'load_snapshot' fails while any is open.
+//
+// Returns the view, or NULL if too many views are open or a batch of edits is
+// in progress.
+SheetView *open_sheet_view(void);
+
+// Reads the value of a cell as it was when 'view' was opened. 'number' is set
+// to the number the cell held, or to 0 if it didn't hold a number. Cells out of
+// bounds are empty.
+//
+// Returns the kind of value the cell held.
+ViewValueKind get_view_value(SheetView *view, int row, int col, double *number);
+
+// Closes a view opened by 'open_sheet_view', after which it must not be used.
+// Closing NULL does nothing.
+void close_sheet_view(SheetView *view);
+
+// Loads a CSV file into the spreadsheet, with the first field of the file in
+// the top left cell. Fields are entered as if they were typed into each cell,
+// and empty fields clear their cell. The formulas are evaluated once the whole
+// file has been read. Large files are parsed by the worker threads at the same
+// time, with the same result as parsing them one field at a time. The file is
+// loaded a few megabytes at a time, so the memory used doesn't depend on its
+// size, and it can be a pipe.
+//
+// Returns the number of rows read, or -1 if the file couldn't be read.
+int load_csv(const char *path);
+
+// Saves the spreadsheet to a CSV file, up to the last row and column containing
+// a value. Formulas are saved rather than their results.
+//
+// Returns the number of rows written, or -1 if the file couldn't be written.
+int save_csv(const char *path);
+
+// Saves the spreadsheet to a binary snapshot, holding the cached value of
+// every cell, the compiled formulas and the dependencies between cells, so
+// that it can be loaded again without parsing or evaluating anything. The
+// file is replaced once the snapshot is complete.
+//
+// Snapshots are written in the memory layout of the build which saves them,
+// and are only loaded by builds with the same layout.
+//
+// Returns 0 if the snapshot was saved, or -1 if it couldn't be written.
+int save_snapshot(const char *path);
+
+// Loads a snapshot saved by 'save_snapshot', replacing the whole spreadsheet
+// including its size. The file is mapped into memory and its values are used
+// in place, and the cells are only loaded as they are used, so loading takes
+// the same time however large the snapshot is.
+// On Windows, where files aren't mapped, the whole file is read instead.
+//
+// Returns 0 if the snapshot was loaded, or -1 if it couldn't be read, isn't a
+// valid snapshot, or a batch of edits is in progress.
+int load_snapshot(const char *path);
+
+// Memory held by the spreadsheet, so that long sessions can be checked for
+// leaks. Each count covers the whole spreadsheet, and goes back to 0 when it is
+// reset or replaced by a snapshot.
+//
+// num_tiles: Tiles of cells which have been allocated.
+// num_formulas: Compiled formulas, not counting those used from a snapshot.
+// num_strings: Distinct texts held by cells.
+// num_blocks: Blocks allocated for formulas, dependencies and texts.
+// num_bytes: Bytes of those blocks.
+// num_allocations: Blocks allocated so far, including those freed since.
+// num_journal_bytes: Bytes held by the journal of edits, which are kept within
+// its budget.
+// num_tile_versions: Blocks of cells copied by edits made while a view was
+// open, which haven't been freed yet.
+typedef struct {
+    size_t num_tiles;
+    size_t num_formulas;
+    size_t num_strings;
+    size_t num_blocks;
+    size_t num_bytes;
+    size_t num_allocations;
+    size_t num_journal_bytes;
+    size_t num_tile_versions;
+} MemoryStats;
+
+// Gets the memory held by the spreadsheet.
+void get_memory_stats(MemoryStats *stats);
+
+// Number of ranges of durations in the histogram of 'RecalcStats'.
+#define RECALC_HISTOGRAM_SIZE 24
+
+// Counts and timings of the recalculations since the program started, or since
+// 'reset_recalc_stats', for finding out why recalculating is slow. They are
+// only kept when the model is built with MODEL_STATS defined, which the
+// MODEL_STATS option of the build does, so that they cost nothing otherwise.
+// A recalculation is an edit, a batch of edits, or in lazy evaluation the
+// evaluation of a formula whose result is needed.
+//
+// enabled: 1 if the model was built with MODEL_STATS, otherwise 0 and every
+// count is 0.
+// num_recalculations: Recalculations.
+// num_evaluations: Formulas evaluated.
+// num_cell_reads: Cells read by the formulas evaluated, counting each cell of
+// a range. Those which aren't stale are read from the cache.
+// num_stale_reads: Cells counted by num_cell_reads which were stale, so they
+// were evaluated before the formula reading them, in lazy evaluation.
+// num_circular: Cells found to be part of, or depend on, a circular
+// dependency.
+// total_seconds: Time taken by every recalculation.
+// max_seconds: Time taken by the longest recalculation.
+// histogram: Recalculations by the time they took. Entry i counts those taking
+// under 2^i microseconds but not under half that, and the last entry counts
+// every longer one.
+typedef struct {
+    int enabled;
+    size_t num_recalculations;
+    size_t num_evaluations;
+    size_t num_cell_reads;
+    size_t num_stale_reads;
+    size_t num_circular;
+    double total_seconds;
+    double max_seconds;
+    size_t histogram[RECALC_HISTOGRAM_SIZE];
+} RecalcStats;
+
+// Gets the counts and timings of the recalculations.
+void get_recalc_stats(RecalcStats *stats);
+
+// Sets every count and timing of the recalculations back to 0.
+void reset_recalc_stats(void);
+
+// Number of cells listed in 'hottest' by 'GraphStats'.
+#define GRAPH_STATS_HOTTEST 8
+
+// A cell, and how many cells it is related to.
+typedef struct {
+    int row;
+    int col;
+    size_t count;
+} CellCount;
+
+// Shape of the dependencies between the cells of the spreadsheet.
+//
+// max_depth: Most cells in a chain where each cell after the first is a
+// formula reading the one before it, which is how many formulas a
+// recalculation may have to evaluate one after the other.
+// max_fan_in: Formula reading the most cells, counting each cell of a range,
+// with the number of cells it reads. The count is 0 if there are no formulas.
+// hottest: Cells read by the most formulas, from the most read, with the
+// number of times formulas read them. A formula is counted once for each of
+// its terms reading the cell.
+// num_hottest: Number of cells in 'hottest'.
+typedef struct {
+    int max_depth;
+    CellCount max_fan_in;
+    CellCount hottest[GRAPH_STATS_HOTTEST];
+    int num_hottest;
+} GraphStats;
+
+// Measures the dependencies between the cells of the spreadsheet. This goes
+// through every cell, loading any still in a snapshot, so it takes as long as a
+// recalculation of the whole spreadsheet. It works whether or not the model was
+// built with MODEL_STATS.
+void get_graph_stats(GraphStats *stats);
+
+// Writes a report of the recalculations, the memory held, and the dependencies
+// between the cells to a text file, to find the formulas which make a
+// spreadsheet slow.
+//
+// Returns 0 if the report was written, or -1 if the file couldn't be written.
+int save_model_stats(const char *path);
+
 // Gets a textual representation of the value of a cell, for editing.
 //
 // The returned string must have been allocated using 'malloc' and is now owned
@@ -25,4 +283,14 @@ void clear_cell(ROW row, COL col);
 // retain any reference to it after the function returns.
 char *get_textual_value(ROW row, COL col);
 
+// Writes the same text as 'get_textual_value' into 'buffer' without allocating
+// any memory, so that it can be called for every move of the cursor. At most
+// 'capacity' characters are written including the null terminator, so text
+// which doesn't fit is cut short. Nothing is written if 'capacity' is 0.
+//
+// Returns the length of the whole text, not counting the null terminator. If
+// this is 'capacity' or more, the text was cut short, and it can be written
+// again into a buffer with room for the returned length plus one.
+size_t get_textual_value_into(ROW row, COL col, char *buffer, size_t capacity);
+
 #endif //ASSIGNMENT_MODEL_H
@@ -0,0 +1,545 @@
+#include "number.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Number of digits Grisu2 can write for a double. Shortest digits never need more than 17, but the buffer leaves room.
+#define MAX_DIGITS 20
+//Number of significand bits of a double, not counting the hidden bit, and the bias of its exponent.
+#define SIGNIFICAND_BITS 52
+#define EXPONENT_BIAS 1075
+#define HIDDEN_BIT ((uint64_t) 1 << SIGNIFICAND_BITS)
+//Largest significand which every smaller integer can be stored exactly in a double.
+#define MAX_EXACT_INTEGER ((uint64_t) 1 << 53)
+//Largest power of ten which is stored exactly in a double.
+#define MAX_EXACT_POWER 22
+
+/*
+ * Struct to represent a floating point number with a 64 bit significand and a binary exponent, which the digits are
+ * generated in.
+ * f: Significand.
+ * e: Binary exponent, so that the number is f * 2^e.
+ */
+typedef struct {
+    uint64_t f;
+    int e;
+} DiyFp;
+
+//Significands and binary exponents of the powers of ten from 10^-348 to 10^340, in steps of 8, rounded to 64 bits.
+static const uint64_t cached_significands[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+static const int16_t cached_exponents[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+    -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+    -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+    -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+    56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+    694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+    1013, 1039, 1066
+};
+
+//Powers of ten which fit in 64 bits.
+static const uint64_t powers_of_ten[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+    10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+    1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+//Powers of ten which are stored exactly in a double.
+static const double exact_powers[MAX_EXACT_POWER + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+    1e21, 1e22
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Splits a positive double into its significand and binary exponent.
+ */
+static DiyFp make_diy_fp(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int biased_exponent = (int) (bits >> SIGNIFICAND_BITS) & 0x7FF;
+    DiyFp result;
+    result.f = bits & (HIDDEN_BIT - 1);
+    //Subnormal numbers have no hidden bit, and the exponent of the smallest normal numbers.
+    if (biased_exponent != 0) {
+        result.f += HIDDEN_BIT;
+        result.e = biased_exponent - EXPONENT_BIAS;
+    } else {
+        result.e = 1 - EXPONENT_BIAS;
+    }
+    return result;
+}
+
+/*
+ * Shifts a number until the top bit of its significand is set.
+ */
+static DiyFp normalize(DiyFp x) {
+    while ((x.f & ((uint64_t) 1 << 63)) == 0) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+/*
+ * Multiplies two numbers, keeping the top 64 bits of the product rounded to nearest.
+ */
+static DiyFp multiply(DiyFp x, DiyFp y) {
+    const uint64_t mask = 0xFFFFFFFFULL;
+    uint64_t a = x.f >> 32, b = x.f & mask, c = y.f >> 32, d = y.f & mask;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t middle = (bd >> 32) + (ad & mask) + (bc & mask) + (1ULL << 31);
+    DiyFp result = {ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e + y.e + 64};
+    return result;
+}
+
+/*
+ * Finds the boundaries halfway between a number and its neighbouring doubles, with the same exponent, so that any
+ * digits strictly between them read back as the number.
+ */
+static void get_boundaries(DiyFp value, DiyFp* minus, DiyFp* plus) {
+    DiyFp upper = {(value.f << 1) + 1, value.e - 1};
+    while ((upper.f & (HIDDEN_BIT << 1)) == 0) {
+        upper.f <<= 1;
+        upper.e--;
+    }
+    upper.f <<= 64 - SIGNIFICAND_BITS - 2;
+    upper.e -= 64 - SIGNIFICAND_BITS - 2;
+    //The gap below a power of two is half the size of the gap above it.
+    DiyFp lower = value.f == HIDDEN_BIT ? (DiyFp) {(value.f << 2) - 1, value.e - 2} :
+                  (DiyFp) {(value.f << 1) - 1, value.e - 1};
+    lower.f <<= lower.e - upper.e;
+    lower.e = upper.e;
+    *minus = lower;
+    *plus = upper;
+}
+
+/*
+ * Finds the cached power of ten which brings a number with the given binary exponent into the range the digits are
+ * generated in.
+ * e: Binary exponent of the number.
+ * power: Set to the decimal exponent the digits need to be scaled by once they have been generated.
+ */
+static DiyFp get_cached_power(int e, int* power) {
+    double estimate = (-61 - e) * 0.30102999566398114 + 347;
+    int k = (int) estimate;
+    if (estimate - k > 0.0) {
+        k++;
+    }
+    int index = (k >> 3) + 1;
+    *power = -(-348 + index * 8);
+    DiyFp result = {cached_significands[index], cached_exponents[index]};
+    return result;
+}
+
+/*
+ * Moves the last digit down towards the number while that keeps the digits inside the boundaries and brings them
+ * closer to it.
+ */
+static void round_last_digit(char* digits, int length, uint64_t delta, uint64_t rest, uint64_t ten_kappa,
+                             uint64_t distance) {
+    while (rest < distance && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < distance || distance - rest > rest + ten_kappa - distance)) {
+        digits[length - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+/*
+ * Generates the fewest digits which lie between the scaled boundaries of a number.
+ * w: Scaled number.
+ * plus: Scaled upper boundary.
+ * delta: Distance between the scaled boundaries.
+ * digits: Buffer the digits are written to.
+ * power: Decimal exponent of the digits, which is adjusted for the digits which are left out.
+ * return: Number of digits.
+ */
+static int generate_digits(DiyFp w, DiyFp plus, uint64_t delta, char* digits, int* power) {
+    DiyFp one = {(uint64_t) 1 << -plus.e, plus.e};
+    uint64_t distance = plus.f - w.f;
+    uint32_t integral = (uint32_t) (plus.f >> -one.e);
+    uint64_t fraction = plus.f & (one.f - 1);
+    int length = 0;
+
+    //Writes the digits of the integral part, stopping as soon as the rest fits between the boundaries.
+    int kappa = 1;
+    while (kappa < 10 && integral >= powers_of_ten[kappa]) {
+        kappa++;
+    }
+    while (kappa > 0) {
+        uint32_t digit = integral / (uint32_t) powers_of_ten[kappa - 1];
+        integral %= (uint32_t) powers_of_ten[kappa - 1];
+        if (digit != 0 || length != 0) {
+            digits[length++] = (char) ('0' + digit);
+        }
+        kappa--;
+        uint64_t rest = ((uint64_t) integral << -one.e) + fraction;
+        if (rest <= delta) {
+            *power += kappa;
+            round_last_digit(digits, length, delta, rest, powers_of_ten[kappa] << -one.e, distance);
+            return length;
+        }
+    }
+    //Writes the digits of the fractional part.
+    for (;;) {
+        fraction *= 10;
+        delta *= 10;
+        char digit = (char) (fraction >> -one.e);
+        if (digit != 0 || length != 0) {
+            digits[length++] = (char) ('0' + digit);
+        }
+        fraction &= one.f - 1;
+        kappa--;
+        if (fraction < delta) {
+            *power += kappa;
+            int index = -kappa;
+            round_last_digit(digits, length, delta, fraction, one.f, distance * (index < 20 ? powers_of_ten[index] : 0));
+            return length;
+        }
+    }
+}
+
+/*
+ * Finds the shortest digits of a positive number with Grisu2.
+ * value: Number, which must be positive and finite.
+ * digits: Buffer with room for MAX_DIGITS digits.
+ * point: Set to the position of the decimal point, so that the number is 0.digits * 10^point.
+ * return: Number of digits, without any trailing zeros.
+ */
+static int get_shortest_digits(double value, char* digits, int* point) {
+    //Whole numbers below 2^53 are 1 or less apart from the numbers next to them, so their own digits are the shortest.
+    if (value < 9007199254740992.0 && value == (double) (uint64_t) value) {
+        char reversed[MAX_DIGITS];
+        int num_digits = 0;
+        for (uint64_t number = (uint64_t) value; number > 0; number /= 10) {
+            reversed[num_digits++] = (char) ('0' + number % 10);
+        }
+        int skipped = 0;
+        while (reversed[skipped] == '0') {
+            skipped++;
+        }
+        for (int i = num_digits - 1; i >= skipped; i--) {
+            digits[num_digits - 1 - i] = reversed[i];
+        }
+        *point = num_digits;
+        return num_digits - skipped;
+    }
+    DiyFp v = make_diy_fp(value);
+    DiyFp minus, plus;
+    get_boundaries(v, &minus, &plus);
+    int power;
+    DiyFp cached = get_cached_power(plus.e, &power);
+    DiyFp w = multiply(normalize(v), cached);
+    DiyFp upper = multiply(plus, cached);
+    DiyFp lower = multiply(minus, cached);
+    //Narrows the boundaries by the rounding error of the multiplications, so that every digit inside them is safe.
+    lower.f++;
+    upper.f--;
+    int length = generate_digits(w, upper, upper.f - lower.f, digits, &power);
+    while (length > 1 && digits[length - 1] == '0') {
+        length--;
+        power++;
+    }
+    *point = length + power;
+    return length;
+}
+
+/*
+ * Rounds digits to a number of significant digits, half away from zero, and drops any trailing zeros.
+ * digits: Digits which are rounded.
+ * length: Number of digits.
+ * keep: Number of digits to keep, which is at least 1.
+ * point: Position of the decimal point, which moves up if the digits round up to a power of ten.
+ * return: Number of digits left.
+ */
+static int round_digits(char* digits, int length, int keep, int* point) {
+    if (keep >= length) {
+        return length;
+    }
+    int carry = digits[keep] >= '5';
+    length = keep;
+    for (int i = length - 1; carry && i >= 0; i--) {
+        if (digits[i] == '9') {
+            digits[i] = '0';
+        } else {
+            digits[i]++;
+            carry = 0;
+        }
+    }
+    //Every digit was a 9, so the digits round up to the next power of ten.
+    if (carry) {
+        digits[0] = '1';
+        length = 1;
+        (*point)++;
+    }
+    while (length > 1 && digits[length - 1] == '0') {
+        length--;
+    }
+    return length;
+}
+
+/*
+ * Finds how many characters digits take in fixed notation.
+ */
+static int get_fixed_length(int length, int point) {
+    if (point <= 0) {
+        return 2 - point + length;
+    }
+    return point < length ? length + 1 : point;
+}
+
+/*
+ * Finds how many characters digits take in exponent notation.
+ */
+static int get_exponent_length(int length, int point) {
+    int exponent = abs(point - 1);
+    return length + (length > 1) + 2 + (exponent >= 100 ? 3 : 2);
+}
+
+/*
+ * Writes digits in fixed notation, as in 0.0125 or 1250.
+ * return: Number of characters written.
+ */
+static int write_fixed(char* out, const char* digits, int length, int point) {
+    int written = 0;
+    if (point <= 0) {
+        out[written++] = '0';
+        out[written++] = '.';
+        for (int i = 0; i < -point; i++) {
+            out[written++] = '0';
+        }
+        memcpy(out + written, digits, length);
+        return written + length;
+    }
+    for (int i = 0; i < point; i++) {
+        out[written++] = i < length ? digits[i] : '0';
+    }
+    if (point < length) {
+        out[written++] = '.';
+        memcpy(out + written, digits + point, length - point);
+        written += length - point;
+    }
+    return written;
+}
+
+/*
+ * Writes digits in exponent notation, with at least two digits in the exponent, as in 1.25e+20 or 5e-07.
+ * return: Number of characters written.
+ */
+static int write_exponent(char* out, const char* digits, int length, int point) {
+    int written = 0;
+    out[written++] = digits[0];
+    if (length > 1) {
+        out[written++] = '.';
+        memcpy(out + written, digits + 1, length - 1);
+        written += length - 1;
+    }
+    int exponent = point - 1;
+    out[written++] = 'e';
+    out[written++] = exponent < 0 ? '-' : '+';
+    exponent = abs(exponent);
+    if (exponent >= 100) {
+        out[written++] = (char) ('0' + exponent / 100);
+    }
+    out[written++] = (char) ('0' + exponent / 10 % 10);
+    out[written++] = (char) ('0' + exponent % 10);
+    return written;
+}
+
+/*
+ * Drops digits which Grisu2 gave beyond the shortest, which happens for a small fraction of numbers with 16 or more
+ * digits. The last digit is dropped by rounding to nearest, or failing that in the other direction, and each shorter
+ * rounding is read back to check that it is still the same number.
+ * value: Number the digits are of.
+ * digits: Digits of the number.
+ * length: Number of digits.
+ * point: Position of the decimal point of the digits.
+ * return: Number of digits left.
+ */
+static int shorten_digits(double value, char* digits, int length, int* point) {
+    while (length > 1) {
+        int shortened = 0;
+        for (int direction = 0; direction < 2 && !shortened; direction++) {
+            char shorter[MAX_DIGITS];
+            char text[NUMBER_MAX_LENGTH + 1];
+            int shorter_point = *point;
+            memcpy(shorter, digits, length);
+            //Replacing the last digit rounds the other way, up with a 9 and down with a 0.
+            if (direction == 1) {
+                shorter[length - 1] = digits[length - 1] >= '5' ? '0' : '9';
+            }
+            int shorter_length = round_digits(shorter, length, length - 1, &shorter_point);
+            text[write_exponent(text, shorter, shorter_length, shorter_point)] = '\0';
+            if (strtod(text, NULL) == value) {
+                memcpy(digits, shorter, shorter_length);
+                length = shorter_length;
+                *point = shorter_point;
+                shortened = 1;
+            }
+        }
+        if (!shortened) {
+            break;
+        }
+    }
+    return length;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t format_number(double value, char *buffer, int width) {
+    size_t written = 0;
+    if (signbit(value) && !isnan(value)) {
+        buffer[written++] = '-';
+        value = -value;
+    }
+    if (isnan(value) || isinf(value) || value == 0.0) {
+        const char *text = isnan(value) ? "nan" : isinf(value) ? "inf" : "0";
+        strcpy(buffer + written, text);
+        return written + strlen(text);
+    }
+
+    char digits[MAX_DIGITS];
+    int point;
+    int length = get_shortest_digits(value, digits, &point);
+    int available = width - (int) written;
+    //Only digits which are all written need to be the shortest.
+    if (length >= 16 && get_exponent_length(length, point) <= available) {
+        length = shorten_digits(value, digits, length, &point);
+    }
+    //Numbers from 0.0001 up are written in fixed notation if they fit, like printf's %g.
+    for (;;) {
+        int fixed = point >= -3 && get_fixed_length(length, point) <= available;
+        if (fixed || get_exponent_length(length, point) <= available) {
+            break;
+        }
+        //Rounds the digits to fit in fixed notation if the integral part fits, otherwise in exponent notation.
+        int keep;
+        if (point >= -3 && point <= available) {
+            keep = point <= 0 ? available - 2 + point : available - 1 > point ? available - 1 : point;
+        } else {
+            keep = available - get_exponent_length(1, point);
+        }
+        length = round_digits(digits, length, keep < 1 ? 1 : keep, &point);
+        //Stops if even a single digit doesn't fit.
+        if (keep < 1) {
+            break;
+        }
+    }
+    if (point >= -3 && get_fixed_length(length, point) <= available) {
+        written += write_fixed(buffer + written, digits, length, point);
+    } else {
+        written += write_exponent(buffer + written, digits, length, point);
+    }
+    buffer[written] = '\0';
+    return written;
+}
+
+double parse_number(const char *text, char **end) {
+#if FLT_EVAL_METHOD == 0
+    //Reads the sign, the digits and the exponent, keeping up to 19 significant digits.
+    const char *position = text;
+    int negative = *position == '-';
+    if (*position == '-' || *position == '+') {
+        position++;
+    }
+    uint64_t significand = 0;
+    int num_digits = 0;
+    int significant_digits = 0;
+    int exponent = 0;
+    const char *integral = position;
+    while (*position >= '0' && *position <= '9') {
+        if (significand != 0 || *position != '0') {
+            significant_digits++;
+        }
+        significand = significand * 10 + (uint64_t) (*position - '0');
+        num_digits++;
+        position++;
+    }
+    //Hexadecimal numbers are left to strtod.
+    int hexadecimal = position - integral == 1 && *integral == '0' && (*position == 'x' || *position == 'X');
+    if (*position == '.') {
+        position++;
+        while (*position >= '0' && *position <= '9') {
+            if (significand != 0 || *position != '0') {
+                significant_digits++;
+            }
+            significand = significand * 10 + (uint64_t) (*position - '0');
+            num_digits++;
+            exponent--;
+            position++;
+        }
+    }
+    //The exponent is only part of the number if it has digits.
+    if (num_digits > 0 && (*position == 'e' || *position == 'E')) {
+        const char *exponent_position = position + 1;
+        int exponent_negative = *exponent_position == '-';
+        if (*exponent_position == '-' || *exponent_position == '+') {
+            exponent_position++;
+        }
+        if (*exponent_position >= '0' && *exponent_position <= '9') {
+            int written_exponent = 0;
+            while (*exponent_position >= '0' && *exponent_position <= '9') {
+                if (written_exponent < 100000) {
+                    written_exponent = written_exponent * 10 + (*exponent_position - '0');
+                }
+                exponent_position++;
+            }
+            exponent += exponent_negative ? -written_exponent : written_exponent;
+            position = exponent_position;
+        }
+    }
+    //Converts exactly when the significand and the power of ten are both exact doubles, since a single multiplication
+    //or division then rounds correctly.
+    if (num_digits > 0 && !hexadecimal && significant_digits <= 19 && significand <= MAX_EXACT_INTEGER &&
+        (significand == 0 || (exponent >= -MAX_EXACT_POWER && exponent <= MAX_EXACT_POWER))) {
+        double result = (double) significand;
+        if (significand != 0 && exponent < 0) {
+            result /= exact_powers[-exponent];
+        } else if (significand != 0) {
+            result *= exact_powers[exponent];
+        }
+        if (end != NULL) {
+            *end = (char *) position;
+        }
+        return negative ? -result : result;
+    }
+#endif
+    //Leaves everything else to strtod, including text which isn't a number.
+    return strtod(text, end);
+}
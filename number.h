@@ -0,0 +1,37 @@
+#ifndef ASSIGNMENT_NUMBER_H
+#define ASSIGNMENT_NUMBER_H
+
+#include <stddef.h>
+
+// Conversions between numbers and text, which are used for every number the
+// model displays, saves or reads, without going through printf.
+//
+// Numbers are formatted with the fewest digits which read back as exactly the
+// same number. The digits are found with the Grisu2 algorithm, which only
+// gives more digits than needed for a few numbers with 16 or more digits, so
+// those are checked with 'strtod'. Numbers are parsed exactly with a single
+// multiplication or division when they have few enough digits, and by
+// 'strtod' otherwise.
+
+// Number of characters of the longest text 'format_number' writes for any
+// number when the digits don't need rounding, not counting the null
+// terminator. ie, -2.2250738585072014e-308.
+#define NUMBER_MAX_LENGTH 24
+
+// Writes a number into 'buffer' in at most 'width' characters followed by a
+// null terminator, so 'buffer' must have room for 'width' + 1 characters.
+// The shortest digits are written in fixed notation, as in 12.5, when they
+// fit, and in exponent notation, as in 1.25e+20, otherwise. If neither fits,
+// the digits are rounded to fit, so a width of NUMBER_MAX_LENGTH always gives
+// text which reads back as exactly the same number. 'width' must be at least
+// 7.
+//
+// Returns the number of characters written, not counting the null terminator.
+size_t format_number(double value, char *buffer, int width);
+
+// Parses a number from the start of 'text' the way 'strtod' does, including
+// setting 'end' to the character after the number, or to 'text' if it doesn't
+// start with a number. 'end' can be NULL.
+double parse_number(const char *text, char **end);
+
+#endif //ASSIGNMENT_NUMBER_H
@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "defs.h"
+#include "interface.h"
+#include "model.h"
+
+// Headless driver which replays a recorded stream of edits against the model,
+// for load testing and for comparing the recalculation engine before and after
+// a change. Each command is timed on its own, and the display is a stub which
+// only counts its updates.
+//
+// Usage: replay [--json] [--lazy] [--rows N] [--cols N] [FILE]
+//
+// The commands are read from FILE, or from standard input if it is missing or
+// is -, one per line:
+//
+//   set A1 TEXT   Sets a cell to the rest of the line, as if it was typed in.
+//   clear A1      Clears a cell.
+//   get A1        Reads the text of a cell for editing.
+//   begin         Starts a batch of edits.
+//   end           Finishes a batch of edits.
+//
+// Blank lines and lines starting with # are skipped. Every batch must be
+// finished within the stream, since the edits of a batch aren't recalculated
+// or displayed until it is. The whole stream is read before anything is
+// replayed, so reading it isn't timed, and a stream which isn't valid is
+// rejected without replaying anything. The sheet has at
+// least as many rows and columns as the cells named by the commands, or as
+// --rows and --cols if they are larger. With --lazy the formulas are evaluated
+// lazily. Only the top left NUM_ROWS by NUM_COLS cells are displayed, as they
+// are by default in the model.
+//
+// The results are written to standard output as CSV, or as a JSON array with
+// --json, with one line for each kind of command and one for all of them.
+
+//Initial number of commands the stream has room for.
+#define INITIAL_COMMANDS 1024
+//Number of bytes the buffer for reading a line starts with.
+#define INITIAL_LINE_CAPACITY 256
+
+//Kinds of command in the stream.
+typedef enum {
+    COMMAND_SET,
+    COMMAND_CLEAR,
+    COMMAND_GET,
+    COMMAND_BEGIN,
+    COMMAND_END,
+    NUM_COMMANDS
+} CommandKind;
+
+//Names of the kinds of command, as they are written in the stream and in the results.
+static const char *command_names[NUM_COMMANDS] = {"set", "clear", "get", "begin", "end"};
+
+/*
+ * A command of the stream.
+ * kind: Kind of command.
+ * row: Row of the cell, for the commands which name one.
+ * col: Column of the cell, for the commands which name one.
+ * text: Text a cell is set to, which is passed on to the model when it is set.
+ */
+typedef struct {
+    CommandKind kind;
+    int row;
+    int col;
+    char *text;
+} Command;
+
+//Number of times the display has been updated.
+static long num_display_updates = 0;
+
+//Whether the results are written as JSON rather than CSV.
+static int json_output = 0;
+//Number of results written so far.
+static int num_results = 0;
+
+void update_cell_display(ROW row, COL col, const char *text) {
+    (void) row;
+    (void) col;
+    (void) text;
+    num_display_updates++;
+}
+
+/*
+ * Reads a monotonic clock.
+ * return: Current time in seconds.
+ */
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec / 1e9;
+}
+
+/*
+ * Parses the reference of a cell. ie, A1, B2, AA10, etc.
+ * text: Text starting with the reference.
+ * row: Set to the row of the cell.
+ * col: Set to the column of the cell.
+ * return: Character after the reference, or NULL if the text doesn't start with a reference.
+ */
+static const char *parse_reference(const char *text, int *row, int *col) {
+    //Reads the letters of the column, where A is 1, Z is 26 and AA is 27.
+    int column = 0;
+    while (*text >= 'A' && *text <= 'Z') {
+        if (column > (1 << 20)) {
+            return NULL;
+        }
+        column = column * 26 + (*text++ - 'A' + 1);
+    }
+    if (column == 0 || *text < '1' || *text > '9') {
+        return NULL;
+    }
+    int number = 0;
+    while (*text >= '0' && *text <= '9') {
+        if (number > (1 << 26)) {
+            return NULL;
+        }
+        number = number * 10 + (*text++ - '0');
+    }
+    *row = number - 1;
+    *col = column - 1;
+    return text;
+}
+
+/*
+ * Parses a line of the stream into a command.
+ * line: Line without its line break.
+ * command: Set to the command.
+ * return: 1 if the line holds a command, 0 if it is blank or a comment, or -1 if it isn't valid.
+ */
+static int parse_command(const char *line, Command *command) {
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    if (*line == '\0' || *line == '#') {
+        return 0;
+    }
+    size_t length = strcspn(line, " \t");
+    int kind = 0;
+    while (kind < NUM_COMMANDS &&
+           (strlen(command_names[kind]) != length || strncmp(line, command_names[kind], length) != 0)) {
+        kind++;
+    }
+    if (kind == NUM_COMMANDS) {
+        return -1;
+    }
+    command->kind = (CommandKind) kind;
+    command->row = 0;
+    command->col = 0;
+    command->text = NULL;
+    line += length;
+    if (command->kind == COMMAND_BEGIN || command->kind == COMMAND_END) {
+        return line[strspn(line, " \t")] == '\0' ? 1 : -1;
+    }
+
+    line += strspn(line, " \t");
+    line = parse_reference(line, &command->row, &command->col);
+    if (line == NULL) {
+        return -1;
+    }
+    if (command->kind != COMMAND_SET) {
+        return line[strspn(line, " \t")] == '\0' ? 1 : -1;
+    }
+    //The text is the rest of the line after the space following the reference, so it can be empty.
+    if (*line == ' ' || *line == '\t') {
+        line++;
+    } else if (*line != '\0') {
+        return -1;
+    }
+    command->text = strdup(line);
+    return 1;
+}
+
+/*
+ * Frees the texts of commands which haven't been replayed, and the commands.
+ * commands: Commands to free.
+ * num_commands: Number of commands.
+ */
+static void free_commands(Command *commands, long num_commands) {
+    for (long i = 0; i < num_commands; i++) {
+        free(commands[i].text);
+    }
+    free(commands);
+}
+
+/*
+ * Reads the next line of a stream, growing the buffer until the whole line fits in it.
+ * file: Stream to read.
+ * line: Buffer the line is read into, which is grown and updated if the line doesn't fit.
+ * capacity: Size of the buffer, which is updated when it is grown.
+ * return: Length of the line without its line break, or -1 at the end of the stream, if it couldn't be read, or if
+ * the memory couldn't be allocated, in which case the stream is at neither its end nor an error.
+ */
+static long read_line(FILE *file, char **line, size_t *capacity) {
+    size_t length = 0;
+    while (fgets(*line + length, (int) (*capacity - length), file) != NULL) {
+        length += strlen(*line + length);
+        if (length > 0 && (*line)[length - 1] == '\n') {
+            break;
+        }
+        //Grows the buffer to read the rest of a line which is longer than it.
+        if (length == *capacity - 1) {
+            char *grown = realloc(*line, *capacity * 2);
+            //Checks if the memory allocation was successful.
+            if (grown == NULL) {
+                return -1;
+            }
+            *line = grown;
+            *capacity *= 2;
+        }
+    }
+    //The last line of a stream may have been read without a line break.
+    if (length == 0) {
+        return -1;
+    }
+    while (length > 0 && ((*line)[length - 1] == '\n' || (*line)[length - 1] == '\r')) {
+        (*line)[--length] = '\0';
+    }
+    return (long) length;
+}
+
+/*
+ * Reads every command of a stream, checking that every batch started by begin is finished by end.
+ * file: Stream to read.
+ * name: Name of the stream, for reporting errors.
+ * num_commands: Set to the number of commands read.
+ * return: Commands read, or NULL if the stream isn't valid or couldn't be read, in which case the error has been
+ * reported.
+ */
+static Command *read_commands(FILE *file, const char *name, long *num_commands) {
+    long capacity = INITIAL_COMMANDS;
+    Command *commands = malloc((size_t) capacity * sizeof(Command));
+    //Checks if the memory allocation was successful.
+    if (commands == NULL) {
+        fprintf(stderr, "%s: out of memory\n", name);
+        return NULL;
+    }
+    *num_commands = 0;
+    size_t line_capacity = INITIAL_LINE_CAPACITY;
+    char *line = malloc(line_capacity);
+    //Checks if the memory allocation was successful.
+    if (line == NULL) {
+        fprintf(stderr, "%s: out of memory\n", name);
+        free(commands);
+        return NULL;
+    }
+    long line_number = 0;
+    //Number of batches which have been started and not finished, and the line which started the outermost one.
+    int batch_depth = 0;
+    long batch_line = 0;
+    const char *error = NULL;
+    while (error == NULL && read_line(file, &line, &line_capacity) >= 0) {
+        line_number++;
+        //Grows the array of commands if it is full.
+        if (*num_commands == capacity) {
+            Command *grown = realloc(commands, (size_t) capacity * 2 * sizeof(Command));
+            //Checks if the memory allocation was successful.
+            if (grown == NULL) {
+                error = "out of memory";
+                break;
+            }
+            commands = grown;
+            capacity *= 2;
+        }
+        Command *command = &commands[*num_commands];
+        int parsed = parse_command(line, command);
+        if (parsed < 0) {
+            error = "invalid command";
+        } else if (parsed == 0) {
+            continue;
+        } else if (command->kind == COMMAND_SET && command->text == NULL) {
+            error = "out of memory";
+        } else if (command->kind == COMMAND_END && batch_depth == 0) {
+            error = "end without begin";
+        } else {
+            if (command->kind == COMMAND_BEGIN && batch_depth++ == 0) {
+                batch_line = line_number;
+            } else if (command->kind == COMMAND_END) {
+                batch_depth--;
+            }
+            (*num_commands)++;
+        }
+    }
+
+    if (error != NULL) {
+        fprintf(stderr, "%s:%ld: %s: %s\n", name, line_number, error, line);
+    } else if (!feof(file) && !ferror(file)) {
+        fprintf(stderr, "%s:%ld: out of memory\n", name, line_number + 1);
+        error = "";
+    } else if (ferror(file)) {
+        fprintf(stderr, "%s: couldn't be read\n", name);
+        error = "";
+    } else if (batch_depth > 0) {
+        fprintf(stderr, "%s:%ld: begin without end\n", name, batch_line);
+        error = "";
+    }
+    free(line);
+    if (error != NULL) {
+        free_commands(commands, *num_commands);
+        return NULL;
+    }
+    return commands;
+}
+
+/*
+ * Compares two durations, for sorting them.
+ */
+static int compare_durations(const void *first, const void *second) {
+    double a = *(const double *) first;
+    double b = *(const double *) second;
+    return (a > b) - (a < b);
+}
+
+/*
+ * Writes the results of a kind of command.
+ * name: Name of the kind of command.
+ * count: Number of commands which were replayed.
+ * durations: Time taken by each command, which are sorted by this function.
+ * display_updates: Number of times the display was updated by the commands.
+ */
+static void report(const char *name, long count, double *durations, long display_updates) {
+    double seconds = 0.0;
+    for (long i = 0; i < count; i++) {
+        seconds += durations[i];
+    }
+    double p50 = 0.0;
+    double p90 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+    if (count > 0) {
+        qsort(durations, (size_t) count, sizeof(double), compare_durations);
+        p50 = durations[count / 2] * 1e6;
+        p90 = durations[(count * 9) / 10] * 1e6;
+        p99 = durations[(count * 99) / 100] * 1e6;
+        max = durations[count - 1] * 1e6;
+    }
+    double rate = seconds > 0.0 ? (double) count / seconds : 0.0;
+    if (json_output) {
+        printf("%s\n  {\"command\": \"%s\", \"count\": %ld, \"seconds\": %.6f, \"ops_per_second\": %.1f, "
+               "\"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f, \"display_updates\": %ld}",
+               num_results == 0 ? "[" : ",", name, count, seconds, rate, p50, p90, p99, max, display_updates);
+    } else {
+        if (num_results == 0) {
+            printf("command,count,seconds,ops_per_second,p50_us,p90_us,p99_us,max_us,display_updates\n");
+        }
+        printf("%s,%ld,%.6f,%.1f,%.3f,%.3f,%.3f,%.3f,%ld\n", name, count, seconds, rate, p50, p90, p99, max,
+               display_updates);
+    }
+    num_results++;
+}
+
+/*
+ * Replays every command of the stream, timing each one, and writes the results.
+ * commands: Commands of the stream. The texts are passed on to the model as the commands are replayed.
+ * num_commands: Number of commands.
+ * return: 1 if the commands were replayed, or 0 if a memory allocation failed, in which case nothing was replayed.
+ */
+static int replay(Command *commands, long num_commands) {
+    size_t size = (size_t) (num_commands > 0 ? num_commands : 1) * sizeof(double);
+    double *durations = malloc(size);
+    double *kind_durations[NUM_COMMANDS];
+    long counts[NUM_COMMANDS] = {0};
+    long display_updates[NUM_COMMANDS] = {0};
+    int allocated = durations != NULL;
+    for (int kind = 0; kind < NUM_COMMANDS; kind++) {
+        kind_durations[kind] = malloc(size);
+        allocated = allocated && kind_durations[kind] != NULL;
+    }
+    //Checks if the memory allocations were successful.
+    if (!allocated) {
+        for (int kind = 0; kind < NUM_COMMANDS; kind++) {
+            free(kind_durations[kind]);
+        }
+        free(durations);
+        return 0;
+    }
+
+    char buffer[256];
+    for (long i = 0; i < num_commands; i++) {
+        Command *command = &commands[i];
+        long updates = num_display_updates;
+        double start = now();
+        switch (command->kind) {
+            case COMMAND_SET:
+                set_cell_value((ROW) command->row, (COL) command->col, command->text);
+                break;
+            case COMMAND_CLEAR:
+                clear_cell((ROW) command->row, (COL) command->col);
+                break;
+            case COMMAND_GET:
+                get_textual_value_into((ROW) command->row, (COL) command->col, buffer, sizeof(buffer));
+                break;
+            case COMMAND_BEGIN:
+                begin_batch();
+                break;
+            case COMMAND_END:
+                end_batch();
+                break;
+            default:
+                break;
+        }
+        double duration = now() - start;
+        command->text = NULL;
+        durations[i] = duration;
+        kind_durations[command->kind][counts[command->kind]++] = duration;
+        display_updates[command->kind] += num_display_updates - updates;
+    }
+
+    for (int kind = 0; kind < NUM_COMMANDS; kind++) {
+        report(command_names[kind], counts[kind], kind_durations[kind], display_updates[kind]);
+        free(kind_durations[kind]);
+    }
+    report("all", num_commands, durations, num_display_updates);
+    if (json_output) {
+        printf("\n]\n");
+    }
+    free(durations);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    int num_rows = 0;
+    int num_cols = 0;
+    int lazy = 0;
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json_output = 1;
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            lazy = 1;
+        } else if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc) {
+            num_rows = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cols") == 0 && i + 1 < argc) {
+            num_cols = atoi(argv[++i]);
+        } else if (path == NULL && (argv[i][0] != '-' || strcmp(argv[i], "-") == 0)) {
+            path = argv[i];
+        } else {
+            num_rows = -1;
+            break;
+        }
+    }
+    if (num_rows < 0 || num_cols < 0) {
+        fprintf(stderr, "usage: %s [--json] [--lazy] [--rows N] [--cols N] [FILE]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = stdin;
+    const char *name = "stdin";
+    if (path != NULL && strcmp(path, "-") != 0) {
+        file = fopen(path, "r");
+        name = path;
+        if (file == NULL) {
+            perror(path);
+            return 1;
+        }
+    }
+    long num_commands;
+    Command *commands = read_commands(file, name, &num_commands);
+    if (file != stdin) {
+        fclose(file);
+    }
+    if (commands == NULL) {
+        return 1;
+    }
+
+    //Makes the sheet large enough for every cell named by the commands.
+    for (long i = 0; i < num_commands; i++) {
+        if (commands[i].kind != COMMAND_BEGIN && commands[i].kind != COMMAND_END) {
+            if (commands[i].row >= num_rows) {
+                num_rows = commands[i].row + 1;
+            }
+            if (commands[i].col >= num_cols) {
+                num_cols = commands[i].col + 1;
+            }
+        }
+    }
+    model_init(num_rows > 0 ? num_rows : NUM_ROWS, num_cols > 0 ? num_cols : NUM_COLS);
+    set_lazy_evaluation(lazy);
+    if (!replay(commands, num_commands)) {
+        fprintf(stderr, "%s: out of memory\n", name);
+        free_commands(commands, num_commands);
+        return 1;
+    }
+    free(commands);
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,11 +15,20 @@ static char display[NUM_ROWS][NUM_COLS][CELL_DISPLAY_WIDTH + 1];
 
 int main() {
     memset(display, 0, sizeof(display));
+    //Uses several workers even on a single processor, so that the large recalculations are shared between them. The
+    //workers are started by the first recalculation large enough to need them, so this is set before any test runs.
+#ifdef _WIN32
+    _putenv_s("MODEL_THREADS", "4");
+#else
+    setenv("MODEL_THREADS", "4", 1);
+#endif
+    model_init(NUM_ROWS, NUM_COLS);
     run_tests();
     return 0;
 }
 
 void update_cell_display(ROW row, COL col, const char *text) {
+    assert(row < NUM_ROWS && col < NUM_COLS);
     snprintf(display[row][col], CELL_DISPLAY_WIDTH + 1, "%s", text);
 }
 
@@ -31,3 +41,15 @@ void assert_edit_text(ROW row, COL col, const char *text) {
     assert(value != NULL && strcmp(text, value) == 0);
     free(value);
 }
+
+void assert_display_number(ROW row, COL col, double number) {
+    char *end;
+    double value = strtod(display[row][col], &end);
+    assert(end != display[row][col] && *end == '\0' && fabs(value - number) < 1e-9);
+}
+
+void assert_display_error(ROW row, COL col) {
+    char *end;
+    strtod(display[row][col], &end);
+    assert(display[row][col][0] != '\0' && (end == display[row][col] || *end != '\0'));
+}
@@ -5,5 +5,7 @@
 
 void assert_display_text(ROW row, COL col, const char *text);
 void assert_edit_text(ROW row, COL col, const char *text);
+void assert_display_number(ROW row, COL col, double number);
+void assert_display_error(ROW row, COL col);
 
 #endif //ASSIGNMENT_TESTRUNNER_H
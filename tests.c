@@ -1,9 +1,714 @@
+#include <assert.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "model.h"
 #include "testrunner.h"
 #include "tests.h"
 
+static void test_dependents_recalculated() {
+    set_cell_value(ROW_4, COL_A, strdup("1"));
+    set_cell_value(ROW_4, COL_B, strdup("=A4+1"));
+    set_cell_value(ROW_4, COL_C, strdup("=B4+A4"));
+    assert_display_number(ROW_4, COL_C, 3);
+    set_cell_value(ROW_4, COL_A, strdup("2"));
+    assert_display_number(ROW_4, COL_B, 3);
+    assert_display_number(ROW_4, COL_C, 5);
+    set_cell_value(ROW_4, COL_B, strdup("7"));
+    assert_display_number(ROW_4, COL_C, 9);
+}
+
+static void test_results_cached() {
+    set_cell_value(ROW_5, COL_A, strdup("2"));
+    set_cell_value(ROW_5, COL_B, strdup("=A5+A5"));
+    set_cell_value(ROW_5, COL_C, strdup("=B5+B5+A5"));
+    assert_display_number(ROW_5, COL_C, 10);
+    set_cell_value(ROW_5, COL_D, strdup("=C5+1"));
+    assert_display_number(ROW_5, COL_D, 11);
+    set_cell_value(ROW_5, COL_A, strdup("3"));
+    assert_display_number(ROW_5, COL_D, 16);
+}
+
+static void test_circular_dependency() {
+    set_cell_value(ROW_6, COL_A, strdup("=B6+1"));
+    set_cell_value(ROW_6, COL_B, strdup("=A6+1"));
+    assert_display_error(ROW_6, COL_A);
+    assert_display_error(ROW_6, COL_B);
+    set_cell_value(ROW_6, COL_B, strdup("5"));
+    assert_display_number(ROW_6, COL_A, 6);
+    set_cell_value(ROW_6, COL_C, strdup("=A6+B6"));
+    assert_display_number(ROW_6, COL_C, 11);
+}
+
+static void test_reference_out_of_bounds() {
+    set_cell_value(ROW_7, COL_A, strdup("=H1"));
+    assert_display_error(ROW_7, COL_A);
+    set_cell_value(ROW_7, COL_A, strdup("=A11"));
+    assert_display_error(ROW_7, COL_A);
+    set_cell_value(ROW_7, COL_A, strdup("=G10"));
+    assert_display_error(ROW_7, COL_A);
+    set_cell_value(ROW_10, COL_G, strdup("8"));
+    assert_display_number(ROW_7, COL_A, 8);
+    clear_cell(ROW_7, COL_A);
+    assert_edit_text(ROW_7, COL_A, "");
+}
+
+static void test_range_functions() {
+    set_cell_value(ROW_8, COL_A, strdup("1"));
+    set_cell_value(ROW_8, COL_B, strdup("2"));
+    set_cell_value(ROW_8, COL_C, strdup("text"));
+    set_cell_value(ROW_8, COL_D, strdup("=SUM(A8:C8)"));
+    assert_display_number(ROW_8, COL_D, 3);
+    assert_edit_text(ROW_8, COL_D, "=SUM(A8:C8)");
+    set_cell_value(ROW_8, COL_E, strdup("=AVERAGE(A8:C8)"));
+    assert_display_number(ROW_8, COL_E, 1.5);
+    set_cell_value(ROW_8, COL_F, strdup("=MAX(A8:B8)+MIN(B8:A8)"));
+    assert_display_number(ROW_8, COL_F, 3);
+    set_cell_value(ROW_8, COL_A, strdup("5"));
+    assert_display_number(ROW_8, COL_D, 7);
+    assert_display_number(ROW_8, COL_E, 3.5);
+    assert_display_number(ROW_8, COL_F, 7);
+    set_cell_value(ROW_9, COL_A, strdup("=SUM(A8:F8)"));
+    assert_display_number(ROW_9, COL_A, 24.5);
+    set_cell_value(ROW_8, COL_C, strdup("=SUM(C8)"));
+    assert_display_error(ROW_8, COL_C);
+    assert_display_error(ROW_9, COL_A);
+    clear_cell(ROW_8, COL_C);
+    assert_display_number(ROW_9, COL_A, 24.5);
+    set_cell_value(ROW_9, COL_B, strdup("=SUM(A8:A)"));
+    assert_display_error(ROW_9, COL_B);
+    set_cell_value(ROW_9, COL_B, strdup("=MEDIAN(A8)"));
+    assert_display_error(ROW_9, COL_B);
+}
+
+static void test_many_terms() {
+    set_cell_value(ROW_10, COL_A, strdup("1"));
+    set_cell_value(ROW_10, COL_B, strdup("=A10+A10+A10+A10+A10+A10+A10+A10+A10+A10+A10+A10+A10+A10+A10+A10+A10+1"));
+    assert_display_number(ROW_10, COL_B, 18);
+    set_cell_value(ROW_10, COL_A, strdup("2"));
+    assert_display_number(ROW_10, COL_B, 35);
+}
+
+static void test_mixed_terms() {
+    set_cell_value(ROW_10, COL_C, strdup("=SUM(A10:B10)+A10+MAX(B10)"));
+    assert_edit_text(ROW_10, COL_C, "=SUM(A10:B10)+A10+MAX(B10)");
+    assert_display_number(ROW_10, COL_C, 74);
+    set_cell_value(ROW_10, COL_A, strdup("1"));
+    assert_display_number(ROW_10, COL_C, 38);
+}
+
+static void test_operators() {
+    set_cell_value(ROW_3, COL_A, strdup("2"));
+    set_cell_value(ROW_3, COL_B, strdup("4"));
+    set_cell_value(ROW_3, COL_C, strdup("=A3+B3*A3"));
+    assert_display_number(ROW_3, COL_C, 10);
+    assert_edit_text(ROW_3, COL_C, "=A3+B3*A3");
+    set_cell_value(ROW_3, COL_D, strdup("=(A3+B3)*SUM(A3:B3)"));
+    assert_display_number(ROW_3, COL_D, 36);
+    assert_edit_text(ROW_3, COL_D, "=(A3+B3)*SUM(A3:B3)");
+    set_cell_value(ROW_3, COL_E, strdup("=-A3*B3-B3/A3"));
+    assert_display_number(ROW_3, COL_E, -10);
+    assert_edit_text(ROW_3, COL_E, "=-A3*B3-B3/A3");
+    set_cell_value(ROW_3, COL_F, strdup("= ( A3 - B3 ) - - A3"));
+    assert_display_number(ROW_3, COL_F, 0);
+    assert_edit_text(ROW_3, COL_F, "=A3-B3--A3");
+    set_cell_value(ROW_3, COL_G, strdup("=A3/(B3/A3)-(A3-B3)"));
+    assert_display_number(ROW_3, COL_G, 3);
+    assert_edit_text(ROW_3, COL_G, "=A3/(B3/A3)-(A3-B3)");
+    set_cell_value(ROW_3, COL_A, strdup("8"));
+    assert_display_number(ROW_3, COL_C, 40);
+    assert_display_number(ROW_3, COL_E, -32.5);
+}
+
+static void test_parse_errors() {
+    set_cell_value(ROW_1, COL_A, strdup("=1+"));
+    assert_display_error(ROW_1, COL_A);
+    assert_edit_text(ROW_1, COL_A, "=1+");
+    set_cell_value(ROW_1, COL_B, strdup("=(A3"));
+    assert_display_error(ROW_1, COL_B);
+    set_cell_value(ROW_1, COL_B, strdup("=A3 B3"));
+    assert_display_error(ROW_1, COL_B);
+    set_cell_value(ROW_1, COL_B, strdup("=SUM(A3:B3"));
+    assert_display_error(ROW_1, COL_B);
+    set_cell_value(ROW_1, COL_B, strdup("="));
+    assert_display_error(ROW_1, COL_B);
+    set_cell_value(ROW_1, COL_B, strdup("=A3*2"));
+    assert_display_number(ROW_1, COL_B, 16);
+}
+
+static void test_batch_edits() {
+    begin_batch();
+    set_cell_value(ROW_9, COL_C, strdup("1"));
+    set_cell_value(ROW_9, COL_D, strdup("=C9+E9"));
+    set_cell_value(ROW_9, COL_E, strdup("2"));
+    set_cell_value(ROW_9, COL_C, strdup("5"));
+    assert_display_text(ROW_9, COL_C, "");
+    assert_display_text(ROW_9, COL_D, "");
+    end_batch();
+    assert_display_number(ROW_9, COL_C, 5);
+    assert_display_number(ROW_9, COL_D, 7);
+
+    CellEdit edits[] = {
+            {ROW_9, COL_E, strdup("3")},
+            {ROW_9, COL_F, strdup("=D9*2")},
+            {ROW_9, COL_C, NULL},
+    };
+    set_cells_batch(edits, 2);
+    assert_display_number(ROW_9, COL_D, 8);
+    assert_display_number(ROW_9, COL_F, 16);
+    set_cells_batch(edits + 2, 1);
+    assert_display_text(ROW_9, COL_C, "");
+    assert_display_error(ROW_9, COL_D);
+    assert_display_error(ROW_9, COL_F);
+}
+
+static void test_csv() {
+    const char* path = "test_csv.tmp";
+    FILE* file = fopen(path, "wb");
+    assert(file != NULL);
+    fputs("1,\"say \"\"hi\"\", ok\",=A1*2\r\n2.5,,=SUM(A1:A2)", file);
+    fclose(file);
+    assert(load_csv(path) == 2);
+    assert_display_number(ROW_1, COL_A, 1);
+    assert_edit_text(ROW_1, COL_B, "say \"hi\", ok");
+    assert_display_number(ROW_1, COL_C, 2);
+    assert_display_number(ROW_2, COL_C, 3.5);
+    assert_display_text(ROW_2, COL_B, "");
+
+    assert(save_csv(path) == NUM_ROWS);
+    char line[256];
+    file = fopen(path, "rb");
+    assert(file != NULL);
+    assert(fgets(line, sizeof(line), file) != NULL);
+    assert(strncmp(line, "1,\"say \"\"hi\"\", ok\",=A1*2", 23) == 0);
+    fclose(file);
+    remove(path);
+    assert(load_csv("does_not_exist.csv") == -1);
+}
+
+static void test_snapshot() {
+    const char* path = "test_snapshot.tmp";
+    assert(save_snapshot(path) == 0);
+    //Changes a cell after saving, which loading the snapshot undoes.
+    set_cell_value(ROW_4, COL_A, strdup("100"));
+    assert_display_number(ROW_4, COL_C, 107);
+
+    assert(load_snapshot(path) == 0);
+    assert_display_number(ROW_4, COL_C, 9);
+    assert_display_number(ROW_3, COL_C, 40);
+    assert_edit_text(ROW_3, COL_C, "=A3+B3*A3");
+    assert_edit_text(ROW_1, COL_B, "say \"hi\", ok");
+    assert_display_error(ROW_9, COL_F);
+
+    //The dependencies are loaded too, so edits recalculate both references and ranges.
+    set_cell_value(ROW_3, COL_A, strdup("2"));
+    assert_display_number(ROW_3, COL_C, 10);
+    assert_display_number(ROW_3, COL_D, 36);
+    set_cell_value(ROW_4, COL_A, strdup("3"));
+    assert_display_number(ROW_4, COL_C, 10);
+    remove(path);
+    assert(load_snapshot("does_not_exist.snapshot") == -1);
+}
+
+static void test_shared_text() {
+    set_cell_value(ROW_7, COL_B, strdup("label"));
+    set_cell_value(ROW_7, COL_C, strdup("label"));
+    set_cell_value(ROW_7, COL_D, strdup("other"));
+    //Clearing one of the cells leaves the text of the others.
+    clear_cell(ROW_7, COL_B);
+    assert_edit_text(ROW_7, COL_C, "label");
+    assert_display_text(ROW_7, COL_D, "other");
+    clear_cell(ROW_7, COL_C);
+    set_cell_value(ROW_7, COL_E, strdup("label"));
+    assert_edit_text(ROW_7, COL_E, "label");
+    assert_edit_text(ROW_7, COL_D, "other");
+    clear_cell(ROW_7, COL_D);
+    clear_cell(ROW_7, COL_E);
+    assert_edit_text(ROW_7, COL_E, "");
+}
+
+static void test_memory_released() {
+    MemoryStats before, after;
+    set_cell_value(ROW_8, COL_A, strdup("first"));
+    set_cell_value(ROW_8, COL_B, strdup("=A9+1"));
+    set_cell_value(ROW_9, COL_A, strdup("1"));
+    get_memory_stats(&before);
+    //Overwriting text, formulas and numbers many times releases what each of them held.
+    for (int i = 0; i < 100; i++) {
+        char text[16];
+        snprintf(text, sizeof(text), "text %d", i);
+        set_cell_value(ROW_8, COL_A, strdup(text));
+        set_cell_value(ROW_8, COL_B, strdup(i % 2 == 0 ? "=A9*2" : "=A9+"));
+    }
+    set_cell_value(ROW_8, COL_A, strdup("first"));
+    set_cell_value(ROW_8, COL_B, strdup("=A9+1"));
+    get_memory_stats(&after);
+    assert(after.num_formulas == before.num_formulas);
+    assert(after.num_strings == before.num_strings);
+    assert(after.num_blocks == before.num_blocks);
+    assert(after.num_bytes == before.num_bytes);
+
+    //Numbers don't allocate anything.
+    for (int i = 0; i < 100; i++) {
+        set_cell_value(ROW_9, COL_A, strdup(i % 2 == 0 ? "2" : "3"));
+    }
+    get_memory_stats(&before);
+    assert(before.num_allocations == after.num_allocations);
+    assert_display_number(ROW_8, COL_B, 4);
+    clear_cell(ROW_8, COL_A);
+    clear_cell(ROW_8, COL_B);
+    clear_cell(ROW_9, COL_A);
+}
+
+static void test_viewport() {
+    clear_cell(ROW_10, COL_F);
+    clear_cell(ROW_10, COL_G);
+    //Cells outside the viewport aren't displayed while they change.
+    set_viewport(ROW_1, COL_A, 5, NUM_COLS);
+    set_cell_value(ROW_10, COL_F, strdup("5"));
+    set_cell_value(ROW_10, COL_G, strdup("=F10*2"));
+    assert_display_text(ROW_10, COL_F, "");
+    assert_display_text(ROW_10, COL_G, "");
+    set_cell_value(ROW_10, COL_F, strdup("6"));
+    assert_display_text(ROW_10, COL_G, "");
+    //They are displayed from their cached values once they are visible again.
+    set_viewport(ROW_1, COL_A, NUM_ROWS, NUM_COLS);
+    assert_display_number(ROW_10, COL_F, 6);
+    assert_display_number(ROW_10, COL_G, 12);
+    clear_cell(ROW_10, COL_F);
+    clear_cell(ROW_10, COL_G);
+}
+
+static void test_lazy_evaluation() {
+    set_cell_value(ROW_10, COL_D, strdup("1"));
+    set_cell_value(ROW_10, COL_E, strdup("=D10*2"));
+    set_viewport(ROW_1, COL_A, 5, NUM_COLS);
+    set_lazy_evaluation(1);
+    //Formulas which aren't visible aren't evaluated or displayed when their inputs change.
+    set_cell_value(ROW_10, COL_D, strdup("4"));
+    assert_display_number(ROW_10, COL_E, 2);
+    //A visible formula is evaluated straight away, along with the stale formulas it reads.
+    set_cell_value(ROW_5, COL_E, strdup("=E10+1"));
+    assert_display_number(ROW_5, COL_E, 9);
+    set_cell_value(ROW_10, COL_D, strdup("5"));
+    assert_display_number(ROW_5, COL_E, 11);
+    //Stale formulas are evaluated once they are visible.
+    set_cell_value(ROW_10, COL_D, strdup("6"));
+    set_viewport(ROW_1, COL_A, NUM_ROWS, NUM_COLS);
+    assert_display_number(ROW_10, COL_E, 12);
+
+    //A CSV file holds the stale formulas too, even past every other value.
+    const char* path = "test_lazy_csv.tmp";
+    model_reset();
+    set_viewport(ROW_1, COL_A, 5, NUM_COLS);
+    set_cell_value(ROW_1, COL_A, strdup("1"));
+    set_cell_value(ROW_10, COL_G, strdup("=A1+1"));
+    assert(save_csv(path) == NUM_ROWS);
+    model_reset();
+    assert(load_csv(path) == NUM_ROWS);
+    remove(path);
+    set_viewport(ROW_1, COL_A, NUM_ROWS, NUM_COLS);
+    assert_edit_text(ROW_10, COL_G, "=A1+1");
+    assert_display_number(ROW_10, COL_G, 2);
+    set_lazy_evaluation(0);
+    clear_cell(ROW_1, COL_A);
+    clear_cell(ROW_10, COL_G);
+}
+
+static void test_reset() {
+    set_cell_value(ROW_3, COL_C, strdup("=A2*2"));
+    model_reset();
+    //Every cell is empty after the reset, and the spreadsheet keeps working.
+    assert_display_text(ROW_3, COL_C, "");
+    assert_edit_text(ROW_3, COL_C, "");
+    assert_edit_text(ROW_7, COL_B, "");
+    set_cell_value(ROW_1, COL_A, strdup("2"));
+    set_cell_value(ROW_2, COL_A, strdup("=A1*3"));
+    set_cell_value(ROW_3, COL_A, strdup("=SUM(A1:A2)"));
+    assert_display_number(ROW_3, COL_A, 8);
+    set_cell_value(ROW_1, COL_A, strdup("1"));
+    assert_display_number(ROW_3, COL_A, 4);
+}
+
+static void test_large_csv() {
+    const char* path = "test_large_csv.tmp";
+    FILE* file = fopen(path, "wb");
+    assert(file != NULL);
+    //A large file is split between the workers, and none of them starts inside the quoted lines of the first field.
+    fputc('"', file);
+    for (int i = 0; i < 100000; i++) {
+        fputs("line\n", file);
+    }
+    fputs("\",5\n=B1*2,\"a,b\"\n", file);
+    for (int i = 0; i < 100000; i++) {
+        fputs("1,2,=A3+B3\n", file);
+    }
+    fputs("=A2", file);
+    fclose(file);
+    assert(load_csv(path) == 100003);
+    assert_display_number(ROW_1, COL_B, 5);
+    assert_display_number(ROW_2, COL_A, 10);
+    assert_edit_text(ROW_2, COL_B, "a,b");
+    assert_display_number(ROW_10, COL_C, 3);
+    remove(path);
+
+    set_cell_value(ROW_3, COL_A, strdup("4"));
+    assert_display_number(ROW_10, COL_C, 6);
+    for (int row = ROW_1; row <= ROW_10; row++) {
+        for (int col = COL_A; col <= COL_C; col++) {
+            clear_cell((ROW) row, (COL) col);
+        }
+    }
+}
+
+static void test_number_text() {
+    //Results are displayed with the fewest digits which give the number, rounded to fit the cell.
+    set_cell_value(ROW_1, COL_A, strdup("0.1"));
+    set_cell_value(ROW_1, COL_B, strdup("=A1+0.2"));
+    assert_display_text(ROW_1, COL_B, "0.3");
+    set_cell_value(ROW_1, COL_C, strdup("=1/3"));
+    assert_display_text(ROW_1, COL_C, "0.333333333");
+    set_cell_value(ROW_1, COL_D, strdup("=A1*1e300"));
+    assert_display_text(ROW_1, COL_D, "1e+299");
+    //Numbers and constants are edited with every digit they need, and no more.
+    set_cell_value(ROW_1, COL_A, strdup("1.25e-7"));
+    assert_edit_text(ROW_1, COL_A, "1.25e-07");
+    set_cell_value(ROW_1, COL_A, strdup("0.30000000000000004"));
+    assert_edit_text(ROW_1, COL_A, "0.30000000000000004");
+    assert_edit_text(ROW_1, COL_B, "=A1+0.2");
+    set_cell_value(ROW_1, COL_A, strdup("12abc"));
+    assert_edit_text(ROW_1, COL_A, "12");
+    for (int col = COL_A; col <= COL_D; col++) {
+        clear_cell(ROW_1, (COL) col);
+    }
+}
+
+static void test_textual_value_into() {
+    set_cell_value(ROW_1, COL_A, strdup("=SUM(A2:B3)+C4*2"));
+    set_cell_value(ROW_1, COL_B, strdup("2.5"));
+    set_cell_value(ROW_1, COL_C, strdup("hello"));
+    //Text which fits is written whole, and its length is returned.
+    char buffer[32];
+    assert(get_textual_value_into(ROW_1, COL_A, buffer, sizeof(buffer)) == 16);
+    assert(strcmp(buffer, "=SUM(A2:B3)+C4*2") == 0);
+    assert(get_textual_value_into(ROW_1, COL_B, buffer, sizeof(buffer)) == 3);
+    assert(strcmp(buffer, "2.5") == 0);
+    assert(get_textual_value_into(ROW_1, COL_D, buffer, sizeof(buffer)) == 0);
+    assert(strcmp(buffer, "") == 0);
+    //Text which doesn't fit is cut short, but the whole length is still returned.
+    assert(get_textual_value_into(ROW_1, COL_A, buffer, 6) == 16);
+    assert(strcmp(buffer, "=SUM(") == 0);
+    assert(get_textual_value_into(ROW_1, COL_C, buffer, 3) == 5);
+    assert(strcmp(buffer, "he") == 0);
+    //Nothing is written into a buffer with no room.
+    assert(get_textual_value_into(ROW_1, COL_C, NULL, 0) == 5);
+    for (int col = COL_A; col <= COL_C; col++) {
+        clear_cell(ROW_1, (COL) col);
+    }
+}
+
+static void test_formula_text() {
+    //Formulas are edited without spaces or unneeded brackets, and with constants written as they are displayed.
+    set_cell_value(ROW_1, COL_A, strdup("=((A2 + 1e3) * 2) / -(+B2 - 0.50)"));
+    assert_edit_text(ROW_1, COL_A, "=(A2+1000)*2/-(B2-0.5)");
+    set_cell_value(ROW_1, COL_B, strdup("=-(-A2)-(B2-(C2*D2))"));
+    assert_edit_text(ROW_1, COL_B, "=--A2-(B2-C2*D2)");
+    //Long formulas which are already written that way are edited exactly as they were typed.
+    char text[1024] = "=(A2";
+    for (int i = 0; i < 100; i++) {
+        strcat(text, i % 2 == 0 ? "+B2)*(C2" : "-D2)/(E2");
+    }
+    strcat(text, "+A2)");
+    set_cell_value(ROW_1, COL_C, strdup(text));
+    assert_edit_text(ROW_1, COL_C, text);
+    for (int col = COL_A; col <= COL_C; col++) {
+        clear_cell(ROW_1, (COL) col);
+    }
+}
+
+static void test_undo_redo() {
+    set_journal_budget(1 << 20);
+    set_cell_value(ROW_1, COL_A, strdup("1"));
+    set_cell_value(ROW_1, COL_B, strdup("=A1*2"));
+    set_cell_value(ROW_1, COL_A, strdup("5"));
+    assert_display_number(ROW_1, COL_B, 10);
+    //Each edit is undone on its own, and the formulas which depend on it are recalculated.
+    assert(undo());
+    assert_display_number(ROW_1, COL_B, 2);
+    assert(undo());
+    assert_edit_text(ROW_1, COL_B, "");
+    assert(redo());
+    assert_edit_text(ROW_1, COL_B, "=A1*2");
+    assert(redo());
+    assert_display_number(ROW_1, COL_B, 10);
+    assert(!redo());
+
+    //A batch is undone as a whole.
+    CellEdit edits[] = {{ROW_1, COL_A, strdup("7")}, {ROW_1, COL_C, strdup("hi")}, {ROW_1, COL_B, NULL}};
+    set_cells_batch(edits, 3);
+    assert_display_text(ROW_1, COL_C, "hi");
+    assert(undo());
+    assert_display_number(ROW_1, COL_B, 10);
+    assert_display_text(ROW_1, COL_C, "");
+    assert_edit_text(ROW_1, COL_A, "5");
+    //A new edit can't be followed by redoing an edit undone before it.
+    set_cell_value(ROW_1, COL_A, strdup("3"));
+    assert(!redo());
+    assert_display_number(ROW_1, COL_B, 6);
+
+    //The oldest edits are forgotten once the journal is over its budget.
+    set_journal_budget(512);
+    MemoryStats stats;
+    for (int i = 0; i < 100; i++) {
+        set_cell_value(ROW_1, COL_D, strdup(i % 2 == 0 ? "=A1+B1" : "text"));
+        get_memory_stats(&stats);
+        assert(stats.num_journal_bytes <= 512);
+    }
+    int num_undone = 0;
+    while (undo()) {
+        num_undone++;
+    }
+    assert(num_undone > 0 && num_undone < 100);
+    set_journal_budget(0);
+    for (int col = COL_A; col <= COL_D; col++) {
+        clear_cell(ROW_1, (COL) col);
+    }
+}
+
+static void test_sheet_view() {
+    set_cell_value(ROW_1, COL_A, strdup("1"));
+    set_cell_value(ROW_1, COL_B, strdup("=A1*2"));
+    set_cell_value(ROW_1, COL_C, strdup("text"));
+    SheetView *view = open_sheet_view();
+    assert(view != NULL);
+    //Edits made after a view is opened aren't seen by it, including the formulas they recalculate.
+    set_cell_value(ROW_1, COL_A, strdup("5"));
+    clear_cell(ROW_1, COL_C);
+    set_cell_value(ROW_1, COL_D, strdup("=1/0"));
+    SheetView *later = open_sheet_view();
+    assert(later != NULL);
+    set_cell_value(ROW_1, COL_A, strdup("7"));
+    assert_display_number(ROW_1, COL_B, 14);
+
+    double number;
+    assert(get_view_value(view, ROW_1, COL_A, &number) == VIEW_NUMBER && number == 1);
+    assert(get_view_value(view, ROW_1, COL_B, &number) == VIEW_NUMBER && number == 2);
+    assert(get_view_value(view, ROW_1, COL_C, &number) == VIEW_TEXT && number == 0);
+    assert(get_view_value(view, ROW_1, COL_D, &number) == VIEW_EMPTY);
+    assert(get_view_value(later, ROW_1, COL_B, &number) == VIEW_NUMBER && number == 10);
+    assert(get_view_value(later, ROW_1, COL_C, &number) == VIEW_EMPTY);
+    assert(get_view_value(later, ROW_1, COL_D, &number) == VIEW_ERROR);
+    assert(get_view_value(later, -1, COL_A, &number) == VIEW_EMPTY);
+
+    //Each view keeps a copy of the tile, which is freed once the views are closed.
+    MemoryStats stats;
+    get_memory_stats(&stats);
+    assert(stats.num_tile_versions == 2);
+    close_sheet_view(view);
+    close_sheet_view(later);
+    for (int col = COL_A; col <= COL_D; col++) {
+        clear_cell(ROW_1, (COL) col);
+    }
+    get_memory_stats(&stats);
+    assert(stats.num_tile_versions == 0);
+}
+
+static void test_model_stats() {
+    model_reset();
+    set_cell_value(ROW_1, COL_A, strdup("1"));
+    set_cell_value(ROW_1, COL_B, strdup("=A1+1"));
+    set_cell_value(ROW_1, COL_C, strdup("=B1+A1"));
+    set_cell_value(ROW_1, COL_D, strdup("=SUM(A1:C1)"));
+    set_cell_value(ROW_1, COL_E, strdup("=F1"));
+    set_cell_value(ROW_1, COL_F, strdup("=E1"));
+    GraphStats graph;
+    get_graph_stats(&graph);
+    //The cells in a circular dependency aren't part of any chain.
+    assert(graph.max_depth == 4);
+    assert(graph.max_fan_in.row == ROW_1 && graph.max_fan_in.col == COL_D && graph.max_fan_in.count == 3);
+    assert(graph.num_hottest == 5);
+    assert(graph.hottest[0].col == COL_A && graph.hottest[0].count == 3);
+    assert(graph.hottest[1].col == COL_B && graph.hottest[1].count == 2);
+
+    RecalcStats recalc;
+    reset_recalc_stats();
+    set_cell_value(ROW_1, COL_A, strdup("2"));
+    get_recalc_stats(&recalc);
+#ifdef MODEL_STATS
+    assert(recalc.enabled && recalc.num_recalculations == 1 && recalc.num_evaluations == 3);
+    assert(recalc.num_cell_reads == 6 && recalc.num_circular == 0);
+#else
+    assert(!recalc.enabled && recalc.num_evaluations == 0);
+#endif
+
+    //In lazy evaluation, the stale formulas a formula reads are evaluated first.
+    set_viewport(ROW_10, COL_G, 1, 1);
+    set_lazy_evaluation(1);
+    reset_recalc_stats();
+    set_cell_value(ROW_1, COL_A, strdup("3"));
+    set_viewport(ROW_1, COL_D, 1, 1);
+    get_recalc_stats(&recalc);
+#ifdef MODEL_STATS
+    //D1 reads B1 and C1 while they are stale, and C1 reads B1 while it is stale.
+    assert(recalc.num_evaluations == 3 && recalc.num_cell_reads == 6 && recalc.num_stale_reads == 3);
+#endif
+    set_lazy_evaluation(0);
+    set_viewport(ROW_1, COL_A, NUM_ROWS, NUM_COLS);
+    assert_display_number(ROW_1, COL_D, 14);
+
+    const char* path = "test_model_stats.tmp";
+    assert(save_model_stats(path) == 0);
+    remove(path);
+    for (int col = COL_A; col <= COL_F; col++) {
+        clear_cell(ROW_1, (COL) col);
+    }
+}
+
+static void test_error_kinds() {
+    set_cell_value(ROW_2, COL_A, strdup("=1/0"));
+    assert_display_text(ROW_2, COL_A, "#DIV/0!");
+    set_cell_value(ROW_2, COL_B, strdup("text"));
+    set_cell_value(ROW_2, COL_C, strdup("=AVERAGE(B2)"));
+    assert_display_text(ROW_2, COL_C, "#DIV/0!");
+    set_cell_value(ROW_2, COL_C, strdup("=B2+1"));
+    assert_display_text(ROW_2, COL_C, "#VALUE!");
+    //A formula reading a cell with an error reports the same error.
+    set_cell_value(ROW_2, COL_D, strdup("=SUM(A2:B2)*2"));
+    assert_display_text(ROW_2, COL_D, "#DIV/0!");
+    set_cell_value(ROW_2, COL_A, strdup("=1+"));
+    assert_display_text(ROW_2, COL_A, "#PARSE@3");
+    assert_display_text(ROW_2, COL_D, "#VALUE!");
+    set_cell_value(ROW_2, COL_A, strdup("=D2"));
+    assert_display_text(ROW_2, COL_A, "#CIRCULAR!");
+    assert_display_text(ROW_2, COL_D, "#CIRCULAR!");
+
+    //Infinite results are numbers, while results which aren't numbers are errors.
+    set_cell_value(ROW_2, COL_A, strdup("=1e308*10"));
+    assert_display_text(ROW_2, COL_A, "inf");
+    assert_display_text(ROW_2, COL_D, "inf");
+    set_cell_value(ROW_2, COL_E, strdup("=A2-A2"));
+    assert_display_text(ROW_2, COL_E, "#NUM!");
+    for (int col = COL_A; col <= COL_E; col++) {
+        clear_cell(ROW_2, (COL) col);
+    }
+}
+
+static void test_cycle_detection() {
+    set_journal_budget(1 << 20);
+    //A cycle made in a batch, and one through a range.
+    begin_batch();
+    set_cell_value(ROW_3, COL_A, strdup("=C3+1"));
+    set_cell_value(ROW_3, COL_B, strdup("=A3*2"));
+    set_cell_value(ROW_3, COL_C, strdup("=SUM(B3:B4)"));
+    end_batch();
+    assert_display_text(ROW_3, COL_A, "#CIRCULAR!");
+    assert_display_text(ROW_3, COL_B, "#CIRCULAR!");
+    assert_display_text(ROW_3, COL_C, "#CIRCULAR!");
+    //A formula reading a cycle reports it rather than its other errors.
+    set_cell_value(ROW_4, COL_D, strdup("=1/0"));
+    set_cell_value(ROW_4, COL_E, strdup("=D4+B3"));
+    assert_display_text(ROW_4, COL_E, "#CIRCULAR!");
+
+    set_cell_value(ROW_3, COL_C, strdup("4"));
+    assert_display_number(ROW_3, COL_A, 5);
+    assert_display_number(ROW_3, COL_B, 10);
+    assert_display_text(ROW_4, COL_E, "#DIV/0!");
+    undo();
+    assert_display_text(ROW_3, COL_A, "#CIRCULAR!");
+    assert_display_text(ROW_4, COL_E, "#CIRCULAR!");
+    redo();
+    assert_display_number(ROW_3, COL_A, 5);
+
+    //A cycle made in lazy evaluation is found once the results are needed.
+    set_lazy_evaluation(1);
+    set_cell_value(ROW_3, COL_C, strdup("=A3"));
+    assert_display_text(ROW_3, COL_B, "#CIRCULAR!");
+    set_cell_value(ROW_3, COL_A, strdup("1"));
+    assert_display_number(ROW_3, COL_C, 1);
+    set_lazy_evaluation(0);
+    set_journal_budget(0);
+    for (int col = COL_A; col <= COL_E; col++) {
+        clear_cell(ROW_3, (COL) col);
+        clear_cell(ROW_4, (COL) col);
+    }
+}
+
+//Number of rows of the sheet used to test the recalculations which are shared between the workers.
+#define LARGE_SHEET_ROWS 5000
+
+static void test_large_sheet() {
+    model_init(LARGE_SHEET_ROWS, NUM_COLS);
+    //Every row reads A1 and doubles it, and D1 sums the doubled values, so editing A1 recalculates every row.
+    char formula[32];
+    set_cell_value(ROW_1, COL_A, strdup("1"));
+    for (int row = 0; row < LARGE_SHEET_ROWS; row++) {
+        snprintf(formula, sizeof(formula), "=A1+%d", row);
+        set_cell_value((ROW) row, COL_B, strdup(formula));
+        snprintf(formula, sizeof(formula), "=B%d*2", row + 1);
+        set_cell_value((ROW) row, COL_C, strdup(formula));
+    }
+    snprintf(formula, sizeof(formula), "=SUM(C1:C%d)", LARGE_SHEET_ROWS);
+    set_cell_value(ROW_1, COL_D, strdup(formula));
+    double total = (double) LARGE_SHEET_ROWS * (LARGE_SHEET_ROWS - 1);
+    assert_display_number(ROW_1, COL_D, total + 2.0 * LARGE_SHEET_ROWS);
+
+    set_cell_value(ROW_1, COL_A, strdup("3"));
+    assert_display_number(ROW_10, COL_B, 12);
+    assert_display_number(ROW_10, COL_C, 24);
+    assert_display_number(ROW_1, COL_D, total + 6.0 * LARGE_SHEET_ROWS);
+    //The rows outside the viewport were recalculated too.
+    SheetView* view = open_sheet_view();
+    assert(view != NULL);
+    double number;
+    assert(get_view_value(view, LARGE_SHEET_ROWS - 1, COL_C, &number) == VIEW_NUMBER &&
+           number == 2.0 * (LARGE_SHEET_ROWS + 2));
+    close_sheet_view(view);
+
+    //A file with this many formulas has them registered by every worker. Every row reads A1, so its dependents array
+    //keeps growing, and sums the last ten values of column A.
+    const char* path = "test_large_sheet.tmp";
+    FILE* file = fopen(path, "wb");
+    assert(file != NULL);
+    double sums = 0.0;
+    for (int row = 1; row <= LARGE_SHEET_ROWS; row++) {
+        int first = row > 10 ? row - 9 : 1;
+        fprintf(file, "%d,=A1+A%d,=SUM(A%d:A%d)", row, row, first, row);
+        if (row == 1) {
+            fprintf(file, ",=SUM(C1:C%d)", LARGE_SHEET_ROWS);
+        }
+        fputc('\n', file);
+        sums += (double) (first + row) * (row - first + 1) / 2;
+    }
+    fclose(file);
+    model_reset();
+    assert(load_csv(path) == LARGE_SHEET_ROWS);
+    remove(path);
+    assert_display_number(ROW_10, COL_B, 11);
+    assert_display_number(ROW_10, COL_C, 55);
+    assert_display_number(ROW_1, COL_D, sums);
+
+    //Both the references and the ranges were registered with the cells they read.
+    set_cell_value(ROW_1, COL_A, strdup("100"));
+    assert_display_number(ROW_10, COL_B, 110);
+    assert_display_number(ROW_10, COL_C, 154);
+    assert_display_number(ROW_1, COL_D, sums + 99 * 10);
+    set_cell_value((ROW) (LARGE_SHEET_ROWS - 6), COL_A, strdup("0"));
+    view = open_sheet_view();
+    assert(view != NULL);
+    assert(get_view_value(view, LARGE_SHEET_ROWS - 1, COL_B, &number) == VIEW_NUMBER &&
+           number == 100 + LARGE_SHEET_ROWS);
+    assert(get_view_value(view, LARGE_SHEET_ROWS - 6, COL_B, &number) == VIEW_NUMBER && number == 100);
+    //The sums of the rows from the edited one to the last include it, and the sum just above doesn't.
+    assert(get_view_value(view, LARGE_SHEET_ROWS - 1, COL_C, &number) == VIEW_NUMBER &&
+           number == 10.0 * LARGE_SHEET_ROWS - 45 - (LARGE_SHEET_ROWS - 5));
+    assert(get_view_value(view, LARGE_SHEET_ROWS - 7, COL_C, &number) == VIEW_NUMBER &&
+           number == 10.0 * (LARGE_SHEET_ROWS - 6) - 45);
+    close_sheet_view(view);
+
+    //Leaves the sheet the size the other tests expect.
+    model_init(NUM_ROWS, NUM_COLS);
+}
+
 void run_tests() {
     set_cell_value(ROW_2, COL_A, strdup("1.4"));
     assert_display_text(ROW_2, COL_A, strdup("1.4"));
@@ -14,4 +719,32 @@ void run_tests() {
     assert_display_text(ROW_2, COL_C, strdup("4.7"));
     set_cell_value(ROW_2, COL_B, strdup("3.1"));
     assert_display_text(ROW_2, COL_C, strdup("4.9"));
+
+    test_dependents_recalculated();
+    test_results_cached();
+    test_circular_dependency();
+    test_reference_out_of_bounds();
+    test_range_functions();
+    test_many_terms();
+    test_mixed_terms();
+    test_operators();
+    test_parse_errors();
+    test_batch_edits();
+    test_csv();
+    test_snapshot();
+    test_shared_text();
+    test_memory_released();
+    test_viewport();
+    test_lazy_evaluation();
+    test_reset();
+    test_large_csv();
+    test_number_text();
+    test_textual_value_into();
+    test_formula_text();
+    test_undo_redo();
+    test_sheet_view();
+    test_model_stats();
+    test_error_kinds();
+    test_cycle_detection();
+    test_large_sheet();
 }